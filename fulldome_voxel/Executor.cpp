@@ -48,7 +48,7 @@ ProcessExecutorComponent::ProcessExecutorComponent(
     n->root_outputs().push_back(new ossia::texture_outlet);
     n->root_inputs().push_back(new ossia::geometry_inlet);
 
-    for(std::size_t i = 1; i <= 4; i++)
+    for(std::size_t i = 1; i < element.inlets().size(); i++)
     {
       auto ctrl = qobject_cast<Process::ControlInlet*>(element.inlets()[i]);
       auto& p = n->add_control();
@@ -0,0 +1,96 @@
+#include "FrameRecorder.hpp"
+
+#include <QDebug>
+#include <QDir>
+#include <QImage>
+
+#include <algorithm>
+
+namespace vkfrt
+{
+FrameRecorder::FrameRecorder(const QString& directory, int workerCount)
+    : m_directory{directory}
+{
+  if (!QDir().mkpath(directory))
+  {
+    qWarning() << "[Recorder] cannot create" << directory;
+    return;
+  }
+  m_valid = true;
+
+  // png encoding dominates: a 4k frame takes a core for tens of milliseconds
+  if (workerCount <= 0)
+    workerCount = std::max(1, int(std::thread::hardware_concurrency()) / 2);
+  m_workers.reserve(workerCount);
+  for (int i = 0; i < workerCount; ++i)
+    m_workers.emplace_back([this] { workerLoop(); });
+}
+
+FrameRecorder::~FrameRecorder()
+{
+  {
+    std::lock_guard lock{m_mutex};
+    m_quit = true;
+  }
+  m_condition.notify_all();
+  for (auto& t : m_workers)
+    t.join();
+}
+
+void FrameRecorder::push(VkReadback::Frame frame)
+{
+  if (!m_valid)
+    return;
+  {
+    std::lock_guard lock{m_mutex};
+    m_frames.push_back(std::move(frame));
+  }
+  m_condition.notify_one();
+}
+
+void FrameRecorder::workerLoop()
+{
+  for (;;)
+  {
+    VkReadback::Frame frame;
+    {
+      std::unique_lock lock{m_mutex};
+      m_condition.wait(lock, [this] { return m_quit || !m_frames.empty(); });
+      if (m_frames.empty())
+        return;
+      frame = std::move(m_frames.front());
+      m_frames.pop_front();
+    }
+    write(frame);
+    // the buffer goes back to the readback ring here
+  }
+}
+
+void FrameRecorder::write(const VkReadback::Frame& frame) const
+{
+  QImage::Format format = QImage::Format_RGBA8888;
+  switch (frame.format)
+  {
+    case vkrt::ColorFormat::RGB10A2:
+      // A2B10G10R10: red in the low bits; traced pixels are opaque and
+      // masked ones black, so premultiplied or not makes no difference
+      format = QImage::Format_A2BGR30_Premultiplied;
+      break;
+    case vkrt::ColorFormat::RGBA16F:
+      format = QImage::Format_RGBA16FPx4;
+      break;
+    case vkrt::ColorFormat::RGBA8:
+    default:
+      break;
+  }
+
+  // wraps the mapped buffer, nothing is copied before encoding
+  const QImage img(
+      frame.data, frame.size.width(), frame.size.height(), frame.bytesPerLine, format);
+  const QString path = QDir(m_directory).filePath(
+      QStringLiteral("%1.png").arg(frame.index, 6, 10, QLatin1Char('0')));
+  // low compression: recording has to keep up with the render
+  if (!img.save(path, "PNG", 90))
+    qWarning() << "[Recorder] cannot write" << path;
+}
+}
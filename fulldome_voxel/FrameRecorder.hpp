@@ -0,0 +1,48 @@
+#pragma once
+#include <fulldome_voxel/vk_raytracing/vk_readback.hpp>
+
+#include <QString>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkfrt
+{
+// Writes the frames read back from the GPU as an image sequence
+// (<directory>/<index>.png), encoding several frames at once on a pool of
+// worker threads. A frame keeps its readback buffer until written, so a
+// recorder falling behind makes VkReadback drop frames instead of growing
+// its queue.
+class FrameRecorder
+{
+public:
+  // 0: half the hardware threads
+  explicit FrameRecorder(const QString& directory, int workerCount = 0);
+  FrameRecorder(const FrameRecorder&) = delete;
+  FrameRecorder& operator=(const FrameRecorder&) = delete;
+  // writes the queued frames first
+  ~FrameRecorder();
+
+  bool isValid() const noexcept { return m_valid; }
+  const QString& directory() const noexcept { return m_directory; }
+
+  // to be used as the VkReadback consumer
+  void push(VkReadback::Frame frame);
+
+private:
+  void workerLoop();
+  void write(const VkReadback::Frame& frame) const;
+
+  QString m_directory;
+  bool m_valid{false};
+
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<VkReadback::Frame> m_frames;
+  bool m_quit{false};
+  std::vector<std::thread> m_workers;
+};
+}
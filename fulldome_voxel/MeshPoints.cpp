@@ -0,0 +1,53 @@
+#include "MeshPoints.hpp"
+
+#include "halp/geometry.hpp"
+
+namespace vkfrt
+{
+PointCloudIngest::Points meshPoints(std::shared_ptr<const ossia::mesh_list> meshes)
+{
+  PointCloudIngest::Points points;
+
+  const ossia::geometry* mesh = nullptr;
+  for (const auto& geom : meshes->meshes)
+  {
+    if (geom.vertices > 0 && !geom.buffers.empty())
+      mesh = &geom;
+  }
+  if (!mesh)
+    return points;
+
+  for (std::size_t i = 0; i < mesh->attributes.size(); ++i)
+  {
+    const auto& attr = mesh->attributes[i];
+    const auto& in = mesh->input[i];
+    if (in.buffer < 0 || in.buffer >= static_cast<int>(mesh->buffers.size()))
+      continue;
+
+    const auto& buf = mesh->buffers[in.buffer];
+    if (!buf.data || buf.size <= 0)
+      continue;
+    if (static_cast<int>(attr.format)
+        != static_cast<int>(halp::dynamic_geometry::attribute::float3))
+      continue;
+
+    const char* base = static_cast<const char*>(buf.data.get()) + in.offset + attr.offset;
+    const int64_t stride = mesh->bindings[attr.binding].stride;
+    if (attr.location == halp::dynamic_geometry::attribute::position)
+    {
+      points.positions = base;
+      points.positionStride = stride;
+    }
+    else if (attr.location == halp::dynamic_geometry::attribute::color)
+    {
+      points.colors = base;
+      points.colorStride = stride;
+    }
+  }
+
+  if (points.positions)
+    points.count = std::size_t(mesh->vertices);
+  points.owner = std::move(meshes);
+  return points;
+}
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <fulldome_voxel/PointCloudIngest.hpp>
+
+#include <ossia/dataflow/geometry_port.hpp>
+
+namespace vkfrt
+{
+// The points of the meshes received by the node, as submitted to
+// PointCloudIngest: the cloud is the last mesh with vertices, its float3
+// position and color attributes are read in place. meshes is a snapshot:
+// the geometry buffers are shared, not copied, and kept alive by the
+// returned Points. No positions when no mesh has them.
+PointCloudIngest::Points meshPoints(std::shared_ptr<const ossia::mesh_list> meshes);
+}
@@ -1,11 +1,18 @@
 #include "Node.hpp"
 #include "halp/geometry.hpp"
 #include <private/qrhivulkan_p.h>
+#include <fulldome_voxel/FrameRecorder.hpp>
+#include <fulldome_voxel/MeshPoints.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_readback.hpp>
 #include <fulldome_voxel/vk_raytracing/vk_voxel_raytracing.hpp>
 #include "score/gfx/Vulkan.hpp"
 #include <Gfx/Graph/NodeRenderer.hpp>
+#include <Gfx/Graph/Utils.hpp>
 #include <score/tools/Debug.hpp>
 
+#include <iterator>
+#include <thread>
+
 namespace vkfrt
 {
 static const constexpr auto images_vertex_shader = R"_(#version 450
@@ -53,6 +60,8 @@ void main ()
 
 
 Node::Node()
+    : m_ingest{std::make_unique<PointCloudIngest>()}
+    , m_sequence{std::make_unique<PointCloudSequence>()}
 {
   this->requiresDepth = true;
 
@@ -63,15 +72,56 @@ Node::Node()
   input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Vec3, {}});
   input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
   input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Vec3, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Empty, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Empty, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Float, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Int, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Empty, {}});
+  input.push_back(new score::gfx::Port{this, nullptr, score::gfx::Types::Empty, {}});
 
   output.push_back(
       new score::gfx::Port{this, {}, score::gfx::Types::Image, {}});
+
+  publishState();
+  publishPose();
 }
 
 Node::~Node()
 {
 }
 
+static QRhiTexture::Format rhiFormat(vkrt::ColorFormat format)
+{
+  switch (format)
+  {
+    case vkrt::ColorFormat::RGB10A2:
+      return QRhiTexture::RGB10A2;
+    case vkrt::ColorFormat::RGBA16F:
+      return QRhiTexture::RGBA16F;
+    case vkrt::ColorFormat::RGBA8:
+    default:
+      return QRhiTexture::RGBA8;
+  }
+}
+
 // This header is used because some function names change between Qt 5 and Qt 6
 class Renderer : public score::gfx::GenericNodeRenderer
 {
@@ -81,6 +131,10 @@ public:
 private:
   ~Renderer() { }
   bool m_isRtReady = false;
+  // last state and cloud given to the tracer
+  uint64_t m_stateVersion = 0;
+  uint64_t m_refreshCount = 0;
+  std::shared_ptr<const PointCloud> m_cloud;
   QSize m_pixelSize;
   QRhi* m_rhi = nullptr;
   QRhiTexture* m_rhiTex = nullptr;
@@ -97,9 +151,20 @@ private:
   VkImageLayout m_outputLayout = VK_IMAGE_LAYOUT_UNDEFINED;
   VkDeviceMemory m_outputMemory = VK_NULL_HANDLE;
   VkImageView m_outputView = VK_NULL_HANDLE;
+  vkrt::ColorFormat m_colorFormat = vkrt::ColorFormat::RGBA8;
+
+  // direct path: the single output edge has a render target the tracer can
+  // write to, no copy pass is needed
+  QRhiTexture* m_directTexture = nullptr;
+  VkImageView m_directView = VK_NULL_HANDLE;
 
   VkRayTracer raytracing;
 
+  // recording: the output is copied back every frame and handed to the
+  // recorder, whose workers encode the frames
+  std::unique_ptr<VkReadback> m_readback;
+  std::shared_ptr<FrameRecorder> m_recorder;
+
   int frameSlotCount;
 
   // This function is only useful to reimplement if the node has an
@@ -152,6 +217,21 @@ private:
     return {ps, srb};
   }
 
+  // the requested format when both the device and QRhi handle it, else
+  // rgba8 which always works
+  vkrt::ColorFormat supportedColorFormat(int requested) const
+  {
+    const auto format = vkrt::ColorFormat(std::clamp(requested, 0, int(vkrt::ColorFormat::RGBA16F)));
+    if (format == vkrt::ColorFormat::RGBA8)
+      return format;
+    if (vkrt::supportsColorFormat(m_physDev, m_funcs, format)
+        && m_rhi->isTextureFormatSupported(rhiFormat(format), QRhiTexture::UsedWithLoadStore))
+      return format;
+
+    qWarning() << "output format" << requested << "not supported, falling back to RGBA8";
+    return vkrt::ColorFormat::RGBA8;
+  }
+
   void createNativeTexture()
   {
     qDebug() << "new texture of size" << m_pixelSize;
@@ -162,7 +242,7 @@ private:
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.flags = 0;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.format = vkrt::vkFormat(m_colorFormat);
     imageInfo.extent.width = uint32_t(m_pixelSize.width());
     imageInfo.extent.height = uint32_t(m_pixelSize.height());
     imageInfo.extent.depth = 1;
@@ -171,7 +251,8 @@ private:
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = m_outputLayout;
-    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT
+                      | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
     m_devFuncs->vkCreateImage(m_dev, &imageInfo, nullptr, &m_output);
 
@@ -199,11 +280,12 @@ private:
     m_devFuncs->vkAllocateMemory(m_dev, &allocInfo, nullptr, &m_outputMemory);
     m_devFuncs->vkBindImageMemory(m_dev, m_output, m_outputMemory, 0);
 
+    // the tracer writes to an image2DArray, one layer per view
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.image = m_output;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = vkrt::vkFormat(m_colorFormat);
     viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
     viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
     viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
@@ -215,7 +297,7 @@ private:
     viewInfo.subresourceRange.layerCount = 1;
     m_devFuncs->vkCreateImageView(m_dev, &viewInfo, nullptr, &m_outputView);
 
-    m_rhiTex = m_rhi->newTexture(QRhiTexture::RGBA8, m_pixelSize, 1,
+    m_rhiTex = m_rhi->newTexture(rhiFormat(m_colorFormat), m_pixelSize, 1,
                                QRhiTexture::RenderTarget
                              | QRhiTexture::UsedWithLoadStore);
 
@@ -227,6 +309,121 @@ private:
     Q_ASSERT(ok);
   }
 
+  void releaseNativeTexture()
+  {
+    if (m_rhiTex)
+    {
+      m_rhiTex->deleteLater();
+      m_rhiTex = nullptr;
+    }
+    m_devFuncs->vkDestroyImageView(m_dev, m_outputView, nullptr);
+    m_devFuncs->vkDestroyImage(m_dev, m_output, nullptr);
+    m_devFuncs->vkFreeMemory(m_dev, m_outputMemory, nullptr);
+    m_outputView = VK_NULL_HANDLE;
+    m_output = VK_NULL_HANDLE;
+    m_outputMemory = VK_NULL_HANDLE;
+  }
+
+  void releaseDirectView()
+  {
+    if (m_directView)
+    {
+      m_devFuncs->vkDestroyImageView(m_dev, m_directView, nullptr);
+      m_directView = VK_NULL_HANDLE;
+    }
+    m_directTexture = nullptr;
+  }
+
+  // output format change: new texture in every pipeline reading it, and
+  // new direct target
+  void recreateOutput(score::gfx::RenderList& renderer)
+  {
+    // rare and user driven: simply wait for the frames using the output
+    m_devFuncs->vkDeviceWaitIdle(m_dev);
+
+    releaseDirectView();
+    releaseNativeTexture();
+    createNativeTexture();
+
+    m_samplers[0].texture = m_rhiTex;
+    for (auto& [edge, pipeline] : m_p)
+      score::gfx::replaceTexture(*pipeline.srb, m_samplers[0].sampler, m_rhiTex);
+
+    m_directTexture = directTarget(renderer);
+    if (m_directTexture)
+      createDirectView();
+
+    raytracing.setColorFormat(m_colorFormat);
+  }
+
+  // starts, stops or moves the recording
+  void updateRecording(const RenderState& state)
+  {
+    const bool record = state.record && !state.recordDirectory.isEmpty();
+    if (record && m_recorder && m_recorder->directory() == state.recordDirectory)
+      return;
+    if (!record && !m_recorder)
+      return;
+
+    if (m_readback)
+    {
+      // the copies in flight must be complete before they are written
+      m_devFuncs->vkDeviceWaitIdle(m_dev);
+      m_readback.reset();
+    }
+    m_recorder.reset();
+    if (!record)
+      return;
+
+    const uint32_t workers = std::max(1u, std::thread::hardware_concurrency() / 2);
+    auto recorder = std::make_shared<FrameRecorder>(state.recordDirectory, int(workers));
+    if (!recorder->isValid())
+      return;
+    m_recorder = recorder;
+
+    // a buffer for each frame in flight, each frame being encoded and a
+    // couple more waiting for an encoder
+    m_readback = std::make_unique<VkReadback>(
+        m_physDev, m_dev, m_funcs, m_devFuncs, uint32_t(frameSlotCount),
+        uint32_t(frameSlotCount) + workers + 2,
+        [recorder](VkReadback::Frame frame) { recorder->push(std::move(frame)); });
+    qDebug() << "recording into" << state.recordDirectory;
+  }
+
+  // the tracer can write the downstream texture itself when it is a storage
+  // capable image of the output format and trace size whose pass keeps its contents
+  QRhiTexture* directTarget(score::gfx::RenderList& renderer) const
+  {
+    if (m_p.size() != 1)
+      return nullptr;
+
+    const auto rt = renderer.renderTargetForOutput(*m_p.front().first);
+    if (!rt.texture || !rt.renderTarget)
+      return nullptr;
+    if (rt.texture->format() != rhiFormat(m_colorFormat) || rt.texture->pixelSize() != m_pixelSize
+        || !(rt.texture->flags() & QRhiTexture::UsedWithLoadStore))
+      return nullptr;
+    if (rt.renderTarget->resourceType() != QRhiResource::TextureRenderTarget)
+      return nullptr;
+    auto* textureRt = static_cast<QRhiTextureRenderTarget*>(rt.renderTarget);
+    if (!(textureRt->flags() & QRhiTextureRenderTarget::PreserveColorContents))
+      return nullptr;
+    return rt.texture;
+  }
+
+  void createDirectView()
+  {
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = VkImage(m_directTexture->nativeTexture().object);
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = vkrt::vkFormat(m_colorFormat);
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+    m_devFuncs->vkCreateImageView(m_dev, &viewInfo, nullptr, &m_directView);
+  }
+
   void init(score::gfx::RenderList& renderer, QRhiResourceUpdateBatch& res) override
   {
     // Start initialize raytracing
@@ -251,6 +448,11 @@ private:
     m_funcs = m_inst->functions();
     Q_ASSERT(m_devFuncs && m_funcs);
 
+    // the format requested so far; later changes go through update()
+    auto& n = static_cast<const Node&>(this->node);
+    n.m_renderState.acquire();
+    m_colorFormat = supportedColorFormat(n.m_renderState.front().outputFormat);
+    raytracing.setColorFormat(m_colorFormat);
     raytracing.init(m_physDev, m_dev, m_funcs, m_devFuncs);
 
     m_pixelSize = renderer.state.renderSize;
@@ -264,7 +466,6 @@ private:
     const auto& mesh = renderer.defaultQuad();
     defaultMeshInit(renderer, mesh, res);
 
-    auto& n = static_cast<const Node&>(this->node);
     auto& rhi = *renderer.state.rhi;
 
     // Create GPU textures for the image
@@ -311,6 +512,13 @@ private:
         m_p.emplace_back(edge, pipeline);
       }
     }
+
+    m_directTexture = directTarget(renderer);
+    if (m_directTexture)
+    {
+      createDirectView();
+      qDebug() << "tracing directly into the output render target";
+    }
   }
 
   int m_rotationCount = 0;
@@ -326,21 +534,62 @@ private:
         &n.standardUBO);
 
 
-    if (n.cameraChanged)
+    // latest state published by the node; the renderers of the node share
+    // the render thread so they may each acquire it
+    n.m_renderState.acquire();
+    const RenderState& state = n.m_renderState.front();
+    if (state.version != m_stateVersion)
     {
-      QVector3D pos(n.position[0], n.position[1], n.position[2]);
-      QVector3D center(n.look_point[0], n.look_point[1], n.look_point[2]);
-      raytracing.setCamera(pos, center, n.fov, n.projectionMode);
-      n.cameraChanged = false; // Reset the flag
+      m_stateVersion = state.version;
+
+      raytracing.setCamera(state.camera);
+      raytracing.setCaching(state.cacheFrames);
+      raytracing.setDynamicResolution(state.dynamicResolution, state.targetFrameTime, state.minResolutionScale);
+      raytracing.setProgressiveRefinement(state.progressiveStride);
+      raytracing.setTraceBudget(state.traceBudget);
+
+      // "Trace backend" entries after the pipeline: ray query workgroup sizes
+      static const QSize queryGroups[] = {{8, 8}, {16, 8}, {16, 16}, {32, 4}};
+      if (state.traceBackend >= 1 && state.traceBackend <= int(std::size(queryGroups)))
+      {
+        const QSize group = queryGroups[state.traceBackend - 1];
+        raytracing.setTraceBackend(VkRtPipeline::RayQuery, uint32_t(group.width()), uint32_t(group.height()));
+      }
+      else
+      {
+        raytracing.setTraceBackend(VkRtPipeline::RayTracingPipeline);
+      }
+      raytracing.setBackendBenchmark(state.benchmarkBackends);
+      raytracing.setLateLatch(state.lateLatch, state.predictionMs);
+      raytracing.setVisibilityCulling(state.visibilityCulling);
+      updateRecording(state);
+
+      const auto colorFormat = supportedColorFormat(state.outputFormat);
+      if (colorFormat != m_colorFormat)
+      {
+        m_colorFormat = colorFormat;
+        recreateOutput(renderer);
+      }
+      if (state.refreshCount != m_refreshCount)
+      {
+        m_refreshCount = state.refreshCount;
+        raytracing.invalidate();
+      }
     }
 
-    if (this->geometryChanged)  // n = static_cast<const Node&>(this->node);
+    // the ingestion finishes on its own time, the previous cloud is traced
+    // until then; so do the frames of a sequence
+    const auto& cloud
+        = state.sequencePlayback ? n.m_sequence->latest() : n.m_ingest->latest();
+    if (cloud && cloud != m_cloud)
     {
-      if (!n.m_positions.empty())
+      m_cloud = cloud;
+      if (!m_cloud->positions.empty())
       {
-        raytracing.setPointCloud(n.m_positions, n.m_colors);
+        raytracing.setPointCloud(m_cloud);
         m_isRtReady = true;
-        qDebug() << "Geometry input updated, uploaded to GPU!";
+        if (m_cloud->sequenceCapacity == 0)
+          qDebug() << "Geometry input updated, uploaded to GPU!";
       }
     }
     // If images haven't been uploaded yet, upload them.
@@ -351,28 +600,70 @@ private:
     }
   }
 
-  // Everything is set up, we can render our mesh
-  void runRenderPass(
+  // The trace runs outside of the render passes, once per frame before the
+  // pass of the first output
+  void runInitialPasses(
       score::gfx::RenderList& renderer,
       QRhiCommandBuffer& cb,
+      QRhiResourceUpdateBatch*& res,
       score::gfx::Edge& edge) override
   {
-    uint currentFrameSlot = renderer.frame % frameSlotCount;
+    if (!m_isRtReady || m_p.empty() || &edge != m_p.front().first)
+      return;
 
-    auto *cbHandles = static_cast<const QRhiVulkanCommandBufferNativeHandles *>(cb.nativeHandles());
+    // descriptor sets of a slot are rewritten when the slot comes back, so
+    // this must be the slot QRhi waited for
+    uint currentFrameSlot = m_rhi->currentFrameSlot();
 
+    // native commands go after what QRhi recorded so far
+    cb.beginExternal();
+    auto *cbHandles = static_cast<const QRhiVulkanCommandBufferNativeHandles *>(cb.nativeHandles());
     VkCommandBuffer vkCmdBuf = cbHandles->commandBuffer;
-    if (m_isRtReady)
+
+    if (m_directTexture)
+    {
+      const auto layout = VkImageLayout(m_directTexture->nativeTexture().layout);
+      const VkImageLayout newLayout = raytracing.render(
+          m_inst, m_physDev, m_dev, m_devFuncs, m_funcs, vkCmdBuf,
+          VkImage(m_directTexture->nativeTexture().object), layout, m_directView,
+          currentFrameSlot, m_pixelSize);
+      m_directTexture->setNativeLayout(int(newLayout));
+      if (m_readback)
+        m_readback->record(
+            vkCmdBuf, currentFrameSlot, VkImage(m_directTexture->nativeTexture().object),
+            newLayout, m_pixelSize, m_colorFormat);
+    }
+    else
     {
       m_outputLayout = raytracing.render(m_inst, m_physDev, m_dev, m_devFuncs, m_funcs,
                               vkCmdBuf, m_output, m_outputLayout, m_outputView,
                               currentFrameSlot, m_pixelSize);
+      m_rhiTex->setNativeLayout(int(m_outputLayout));
+      if (m_readback)
+        m_readback->record(
+            vkCmdBuf, currentFrameSlot, m_output, m_outputLayout, m_pixelSize, m_colorFormat);
     }
 
-    m_rhiTex->setNativeLayout(int(m_outputLayout));
+    cb.endExternal();
+  }
 
-    m_rhiTex->setNativeLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    m_outputLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  // Copy of the traced image into each output, unless traced there directly
+  void runRenderPass(
+      score::gfx::RenderList& renderer,
+      QRhiCommandBuffer& cb,
+      score::gfx::Edge& edge) override
+  {
+    // late latch: the last call before QRhi submits the frame traced by
+    // runInitialPasses, the camera pose of now goes into its uniforms
+    if (m_isRtReady && !m_p.empty() && &edge == m_p.front().first)
+    {
+      auto& n = static_cast<const Node&>(this->node);
+      n.m_poses.acquire();
+      raytracing.latchPose(n.m_poses.front(), m_rhi->currentFrameSlot());
+    }
+
+    if (m_directTexture)
+      return;
 
     m_samplers[0].texture = m_rhiTex;
 
@@ -384,11 +675,17 @@ private:
   // Free resources allocated in this class
   void release(score::gfx::RenderList& r) override
   {
+    raytracing.release();
+    // the device is idle: the last copies are delivered, then written
+    m_readback.reset();
+    m_recorder.reset();
+
+    releaseDirectView();
+
     m_texture->deleteLater();
     m_texture = nullptr;
 
-    m_rhiTex->deleteLater();
-    m_rhiTex = nullptr;
+    releaseNativeTexture();
 
     // This will free all the other resources - material & process UBO, etc
     defaultRelease(r);
@@ -416,102 +713,176 @@ void Node::process(score::gfx::Message&& msg)
       ProcessNode::process(p, *val);
       if (lastIndex == val->meshes->dirty_index)
       {
+        p++;
         continue;
       }
 
       geometryChanged = true;
       lastIndex = val->meshes->dirty_index;
+      m_geometrySource = val->meshes.get();
 
       qDebug() << "Received a new Mesh with size: " << val->meshes->dirty_index;
-      m_positions.clear();
-      m_colors.clear();
-
-      for (const auto& geom : val->meshes->meshes)
-      {
-        if (geom.vertices <= 0 || geom.buffers.empty())
-          continue;
-
-        m_positions.clear();
-        m_colors.clear();
-
-        const int vertexCount = geom.vertices;
-
-        // Iterate over attributes and extract positions/colors
-        for (size_t i = 0; i < geom.attributes.size(); ++i)
-        {
-          const auto& attr = geom.attributes[i];
-          const auto& in   = geom.input[i];
-
-          // Find the buffer containing the data
-          if (in.buffer < 0 || in.buffer >= static_cast<int>(geom.buffers.size()))
-            continue;
-
-          const auto& buf = geom.buffers[in.buffer];
-          if (!buf.data || buf.size <= 0)
-            continue;
-
-          const char* base = static_cast<const char*>(buf.data.get()) + in.offset + attr.offset;
-
-          switch (attr.location)
-          {
-            case halp::dynamic_geometry::attribute::position:
-              if (static_cast<int>(attr.format) == static_cast<int>(halp::dynamic_geometry::attribute::float3))
-              {
-                for (int v = 0; v < vertexCount; ++v)
-                {
-                  const float* p = reinterpret_cast<const float*>(base + v * geom.bindings[attr.binding].stride);
-                  m_positions.emplace_back(p[0], p[1], p[2], 1.0f);
-                }
-                qDebug() << "get point data with size: " << m_positions.size();
-              }
-              break;
-
-            case halp::dynamic_geometry::attribute::color:
-              if (static_cast<int>(attr.format) == static_cast<int>(halp::dynamic_geometry::attribute::float3))
-              {
-                for (int v = 0; v < vertexCount; ++v)
-                {
-                  const float* c = reinterpret_cast<const float*>(base + v * geom.bindings[attr.binding].stride);
-                  m_colors.emplace_back(c[0], c[1], c[2], 1.0f);
-                }
-                qDebug() << "get color data with size: " << m_colors.size();
-              }
-              break;
-            default:
-              break;
-          }
-        }
-      }
+      // the descriptors are copied, the vertex buffers are shared
+      m_ingest->submit(
+          m_geometrySource, lastIndex,
+          meshPoints(std::make_shared<const ossia::mesh_list>(*val->meshes)));
       p++;
     }
     else if (auto val = ossia::get_if<ossia::value>(&m))
     {
+      auto& cam = m_state.camera;
       switch(p)
       {
         case 1: // Position
-          this->position = ossia::convert<ossia::vec3f>(*val);
-          this->cameraChanged = true;
+        {
+          const auto v = ossia::convert<ossia::vec3f>(*val);
+          cam.position = QVector3D(v[0], v[1], v[2]);
           break;
+        }
         case 2: // Look at Point
-          this->look_point = ossia::convert<ossia::vec3f>(*val);
-          this->cameraChanged = true;
+        {
+          const auto v = ossia::convert<ossia::vec3f>(*val);
+          cam.center = QVector3D(v[0], v[1], v[2]);
           break;
+        }
         case 3: // FOV
-          this->fov = ossia::convert<float>(*val);
-          this->cameraChanged = true;
+          cam.fov = ossia::convert<float>(*val);
           break;
         case 4: // Projection Mode
-          this->projectionMode = ossia::convert<int>(*val);
-          this->cameraChanged = true;
+          cam.projectionMode = ossia::convert<int>(*val);
+          break;
+        case 5: // Dome mask
+          cam.domeMask = ossia::convert<bool>(*val);
+          break;
+        case 6: // Foveation
+          cam.foveation = ossia::convert<bool>(*val);
           break;
+        case 7: // Focus direction
+        {
+          const auto v = ossia::convert<ossia::vec3f>(*val);
+          cam.focusDirection = QVector3D(v[0], v[1], v[2]);
+          break;
+        }
+        case 8: // Full-rate angle
+          cam.fullRateAngle = ossia::convert<float>(*val);
+          break;
+        case 9: // Fall-off angle
+          cam.falloffAngle = ossia::convert<float>(*val);
+          break;
+        case 10: // Temporal interleave
+          cam.temporalInterleave = ossia::convert<int>(*val);
+          break;
+        case 11: // Cache static frames
+          m_state.cacheFrames = ossia::convert<bool>(*val);
+          break;
+        case 12: // Refresh
+          m_state.refreshCount++;
+          break;
+        case 13: // Dynamic resolution
+          m_state.dynamicResolution = ossia::convert<bool>(*val);
+          break;
+        case 14: // Target frame time
+          m_state.targetFrameTime = ossia::convert<float>(*val);
+          break;
+        case 15: // Minimum scale
+          m_state.minResolutionScale = ossia::convert<float>(*val);
+          break;
+        case 16: // Progressive refinement
+          m_state.progressiveStride = ossia::convert<int>(*val);
+          break;
+        case 17: // Trace budget
+          m_state.traceBudget = ossia::convert<float>(*val);
+          break;
+        case 18: // Output format
+          m_state.outputFormat = ossia::convert<int>(*val);
+          break;
+        case 19: // Calibration map
+          cam.calibrationMap = QString::fromStdString(ossia::convert<std::string>(*val));
+          break;
+        case 20: // Trace backend
+          m_state.traceBackend = ossia::convert<int>(*val);
+          break;
+        case 21: // Benchmark backends
+          m_state.benchmarkBackends = ossia::convert<bool>(*val);
+          break;
+        case 22: // Late latch
+          m_state.lateLatch = ossia::convert<bool>(*val);
+          break;
+        case 23: // Prediction
+          m_state.predictionMs = ossia::convert<float>(*val);
+          break;
+        case 24: // Visibility culling
+          m_state.visibilityCulling = ossia::convert<bool>(*val);
+          break;
+        case 25: // Record
+          m_state.record = ossia::convert<bool>(*val);
+          break;
+        case 26: // Record folder
+          m_state.recordDirectory = QString::fromStdString(ossia::convert<std::string>(*val));
+          break;
+        case 27: // Point cloud sequence
+        {
+          const QString path = QString::fromStdString(ossia::convert<std::string>(*val));
+          if (path != m_sequencePath)
+          {
+            m_sequencePath = path;
+            if (path.isEmpty())
+              m_sequence->close();
+            else
+              m_sequence->open(path);
+            m_state.sequencePlayback = m_sequence->isOpen();
+          }
+          break;
+        }
       }
+      m_stateChanged = true;
       p++;
     }
     else
     {
       p++;
     }
-    }
   }
+
+  // the frame at the timeline position, prefetched ahead of it
+  if (m_sequence->isOpen())
+    m_sequence->seek(standardUBO.time);
+
+  if (m_state.camera.position != m_pose.position || m_state.camera.center != m_pose.center)
+    publishPose();
+  if (m_stateChanged)
+    publishState();
+}
+
+void Node::publishState()
+{
+  m_state.version++;
+  m_renderState.back() = m_state;
+  m_renderState.publish();
+  m_stateChanged = false;
+}
+
+void Node::publishPose()
+{
+  // velocities from the last two samples, unless the camera was still
+  // in between
+  constexpr std::chrono::milliseconds maxInterval{250};
+
+  const auto now = CameraPose::Clock::now();
+  CameraPose pose;
+  pose.position = m_state.camera.position;
+  pose.center = m_state.camera.center;
+  pose.timestamp = now;
+  if (m_pose.isValid() && now > m_pose.timestamp && now - m_pose.timestamp <= maxInterval)
+  {
+    const float dt = std::chrono::duration<float>(now - m_pose.timestamp).count();
+    pose.positionVelocity = (pose.position - m_pose.position) / dt;
+    pose.centerVelocity = (pose.center - m_pose.center) / dt;
+  }
+
+  m_pose = pose;
+  m_poses.back() = pose;
+  m_poses.publish();
+}
 }
 
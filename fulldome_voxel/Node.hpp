@@ -3,8 +3,66 @@
 #include <Gfx/Graph/RenderList.hpp>
 #include <Gfx/Graph/CommonUBOs.hpp>
 
+#include <fulldome_voxel/PointCloudIngest.hpp>
+#include <fulldome_voxel/PointCloudSequence.hpp>
+#include <fulldome_voxel/Projection.hpp>
+#include <fulldome_voxel/TripleBuffer.hpp>
+
 namespace vkfrt
 {
+// What the renderers read from the node. process() writes it as a whole and
+// hands it over through a TripleBuffer: the render thread never reads a
+// half-updated state and neither thread waits on the other.
+struct RenderState
+{
+  // incremented by every publish, renderers compare it with the last one
+  // they applied
+  uint64_t version{};
+
+  CameraState camera;
+
+  // skip the trace while nothing changed, unless a refresh is requested
+  bool cacheFrames{true};
+  // incremented by the Refresh impulse
+  uint64_t refreshCount{};
+
+  // trace resolution follows the gpu time, target in milliseconds
+  bool dynamicResolution{false};
+  float targetFrameTime{16.6f};
+  float minResolutionScale{0.5f};
+
+  // coarsest lattice traced after a change, 1 when off
+  int progressiveStride{1};
+
+  // gpu time per frame for the tiled trace, 0 traces whole frames
+  float traceBudget{0.f};
+
+  // vkrt::ColorFormat of the output texture
+  int outputFormat{0};
+
+  // 0: ray tracing pipeline, else ray queries with the workgroup tiling
+  // of the "Trace backend" entry
+  int traceBackend{0};
+  bool benchmarkBackends{false};
+
+  // camera pose read again right before the frame is submitted, see
+  // VkRayTracer::latchPose, and extrapolated to the display time
+  bool lateLatch{false};
+  float predictionMs{0.f};
+
+  // only the chunks of points in view are traced, see VkRtCulling
+  bool visibilityCulling{false};
+
+  // the output is read back every frame and written as an image sequence
+  // into recordDirectory, see FrameRecorder
+  bool record{false};
+  QString recordDirectory;
+
+  // the clouds come from the sequence played along the timeline instead of
+  // the geometry input
+  bool sequencePlayback{false};
+};
+
 class Renderer;
 class Node : public score::gfx::NodeModel
 {
@@ -16,21 +74,30 @@ public:
   createRenderer(score::gfx::RenderList& r) const noexcept override;
   void process(score::gfx::Message&& msg) override;
 private:
-  score::gfx::ModelCameraUBO ubo;
+  void publishState();
+  void publishPose();
 
-  //store camera state
-  ossia::vec3f position{ -15.0f, 6.0f, -35.75f };
-  ossia::vec3f look_point{ 20.0f, 0.0f, -36.75f };
-  float fov{ 60.f };
-  int projectionMode;
-
-  mutable bool cameraChanged = true;
+  score::gfx::ModelCameraUBO ubo;
 
-  int lastIndex = -1;
-  std::vector<QVector4D> m_positions;
-  std::vector<QVector4D> m_colors;
+  // graph thread copy, published at the end of process() when changed
+  RenderState m_state;
+  bool m_stateChanged{true};
+  // read by the renderers, which share the render thread
+  mutable TripleBuffer<RenderState> m_renderState;
+  // camera position and target alone, with their velocity, for the late
+  // latch
+  CameraPose m_pose;
+  mutable TripleBuffer<CameraPose> m_poses;
 
-  bool m_geometryDirty = false;
+  // identifies the geometry for sharing acceleration structures
+  const void* m_geometrySource = nullptr;
+  int64_t lastIndex = -1;
+  // decodes the received meshes off the graph thread; the renderers pick
+  // the finished clouds up with latest()
+  std::unique_ptr<PointCloudIngest> m_ingest;
+  // sequence file played at the timeline position, same hand-over
+  QString m_sequencePath;
+  std::unique_ptr<PointCloudSequence> m_sequence;
 
   friend Renderer;
   QImage m_image;
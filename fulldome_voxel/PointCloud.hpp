@@ -0,0 +1,37 @@
+#pragma once
+#include <QVector3D>
+#include <QVector4D>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vkfrt
+{
+// A point cloud as passed to VkRayTracer::setPointCloud. Immutable once
+// published: renderers and scenes share it instead of copying the points.
+struct PointCloud
+{
+  // identify the geometry, see VkRtScene::Key
+  const void* source{};
+  int64_t revision{-1};
+  std::vector<QVector4D> positions;
+  // empty when the mesh has no color attribute
+  std::vector<QVector4D> colors;
+
+  // bounds of the points of chunk i, [i * chunkPoints, (i + 1) *
+  // chunkPoints), for the visibility culling; empty when not computed
+  struct ChunkBounds
+  {
+    QVector3D lo;
+    QVector3D hi;
+  };
+  static constexpr uint32_t chunkPoints = 4096;
+  std::vector<ChunkBounds> chunks;
+
+  // frame of a sequence: points of its largest frame. Frames of the same
+  // source replace each other in one scene instead of being rebuilt, see
+  // VkRtScene::stream. 0 for a standalone cloud.
+  std::size_t sequenceCapacity{};
+};
+}
@@ -0,0 +1,318 @@
+#include "PointCloudIngest.hpp"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace vkfrt
+{
+namespace
+{
+// float3 attribute, read in place
+struct Stream
+{
+  const char* base{};
+  int64_t stride{};
+
+  const float* operator[](std::size_t vertex) const noexcept
+  {
+    return reinterpret_cast<const float*>(base + vertex * stride);
+  }
+};
+
+struct Chunk
+{
+  std::vector<QVector4D> positions;
+  std::vector<QVector4D> colors;
+};
+
+// 10 bits of v spread over every third bit
+uint32_t spreadBits(uint32_t v)
+{
+  v &= 0x3ff;
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// Morton order over the bounds of the chunk: neighbouring instances end up
+// close in space, which keeps the tlas build inputs coherent
+void sortChunk(Chunk& chunk)
+{
+  const std::size_t n = chunk.positions.size();
+  if (n < 2)
+    return;
+
+  QVector3D lo = chunk.positions.front().toVector3D();
+  QVector3D hi = lo;
+  for (const QVector4D& p : chunk.positions)
+  {
+    lo = QVector3D(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+    hi = QVector3D(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+  }
+  const QVector3D extent = hi - lo;
+  const float side = std::max({extent.x(), extent.y(), extent.z(), 1e-6f});
+
+  std::vector<std::pair<uint32_t, uint32_t>> order(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    const QVector3D q = (chunk.positions[i].toVector3D() - lo) * (1023.f / side);
+    order[i] = {
+        (spreadBits(uint32_t(q.x())) << 2) | (spreadBits(uint32_t(q.y())) << 1)
+            | spreadBits(uint32_t(q.z())),
+        uint32_t(i)};
+  }
+  std::sort(order.begin(), order.end());
+
+  auto permute = [&](std::vector<QVector4D>& v) {
+    if (v.empty())
+      return;
+    std::vector<QVector4D> sorted(n);
+    for (std::size_t i = 0; i < n; ++i)
+      sorted[i] = v[order[i].second];
+    v.swap(sorted);
+  };
+  permute(chunk.positions);
+  permute(chunk.colors);
+}
+}
+
+PointCloudIngest::PointCloudIngest(int workerCount)
+{
+  if (workerCount <= 0)
+    workerCount = std::max(1, int(std::thread::hardware_concurrency()) / 2);
+
+  for (int i = 0; i < workerCount; ++i)
+    m_workers.emplace_back([this] { workerLoop(); });
+  m_coordinator = std::thread{[this] { coordinatorLoop(); }};
+}
+
+PointCloudIngest::~PointCloudIngest()
+{
+  // the running submission stops at its next chunk
+  m_generation.fetch_add(1, std::memory_order_acq_rel);
+  {
+    std::lock_guard lock{m_jobMutex};
+    m_quit = true;
+  }
+  m_jobCondition.notify_all();
+  m_coordinator.join();
+
+  {
+    std::lock_guard lock{m_taskMutex};
+    m_stopWorkers = true;
+  }
+  m_taskCondition.notify_all();
+  for (std::thread& worker : m_workers)
+    worker.join();
+}
+
+void PointCloudIngest::submit(const void* source, int64_t revision, Points points)
+{
+  // cancels the running submission
+  const uint64_t generation = m_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+  {
+    std::lock_guard lock{m_jobMutex};
+    m_pending = Job{source, revision, generation, std::move(points)};
+    m_busy.store(true, std::memory_order_release);
+  }
+  m_jobCondition.notify_one();
+}
+
+const std::shared_ptr<const PointCloud>& PointCloudIngest::latest() noexcept
+{
+  m_published.acquire();
+  return m_published.front();
+}
+
+void PointCloudIngest::coordinatorLoop()
+{
+  for (;;)
+  {
+    Job job;
+    {
+      std::unique_lock lock{m_jobMutex};
+      m_jobCondition.wait(lock, [this] { return m_quit || m_pending; });
+      if (m_quit)
+        return;
+      job = std::move(*m_pending);
+      m_pending.reset();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    if (std::shared_ptr<PointCloud> cloud = run(job))
+    {
+      qDebug() << "[TIMESTAMP] point cloud" << job.revision << "ingested with"
+               << cloud->positions.size() << "points in" << timer.elapsed() << "ms.";
+      m_published.back() = std::move(cloud);
+      m_published.publish();
+      // drops a cloud the renderers are done with here rather than on the
+      // render thread
+      m_published.back() = nullptr;
+    }
+
+    std::lock_guard lock{m_jobMutex};
+    if (!m_pending)
+      m_busy.store(false, std::memory_order_release);
+  }
+}
+
+void PointCloudIngest::workerLoop()
+{
+  for (;;)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock lock{m_taskMutex};
+      m_taskCondition.wait(lock, [this] { return m_stopWorkers || !m_tasks.empty(); });
+      if (m_tasks.empty())
+        return;
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void PointCloudIngest::parallelFor(
+    std::size_t count, const std::function<void(std::size_t)>& fn)
+{
+  if (count == 0)
+    return;
+
+  // shared with the helper tasks, which may only start once every index is
+  // taken: they then leave without touching fn
+  struct State
+  {
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> done{0};
+    std::size_t count{};
+    const std::function<void(std::size_t)>* fn{};
+    std::mutex mutex;
+    std::condition_variable condition;
+  };
+  auto state = std::make_shared<State>();
+  state->count = count;
+  state->fn = &fn;
+
+  auto work = [state] {
+    for (std::size_t i; (i = state->next.fetch_add(1)) < state->count;)
+    {
+      (*state->fn)(i);
+      if (state->done.fetch_add(1) + 1 == state->count)
+      {
+        std::lock_guard lock{state->mutex};
+        state->condition.notify_all();
+      }
+    }
+  };
+
+  const std::size_t helpers = std::min(count - 1, m_workers.size());
+  {
+    std::lock_guard lock{m_taskMutex};
+    for (std::size_t i = 0; i < helpers; ++i)
+      m_tasks.push_back(work);
+  }
+  m_taskCondition.notify_all();
+
+  work();
+  std::unique_lock lock{state->mutex};
+  state->condition.wait(lock, [&] { return state->done.load() == count; });
+}
+
+// ------------------------------------------------------------
+// decode -> filter -> sort per chunk, then pack the chunks
+// ------------------------------------------------------------
+std::shared_ptr<PointCloud> PointCloudIngest::run(const Job& job)
+{
+  auto cloud = std::make_shared<PointCloud>();
+  cloud->source = job.source;
+  cloud->revision = job.revision;
+
+  // decode: the float3 streams are read in place by the chunks
+  const Stream position{job.points.positions, job.points.positionStride};
+  const Stream color{job.points.colors, job.points.colorStride};
+  if (!position.base)
+    return cloud;
+
+  const std::size_t count = job.points.count;
+  const std::size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+  std::vector<Chunk> chunks(chunkCount);
+  parallelFor(chunkCount, [&](std::size_t c) {
+    if (cancelled(job.generation))
+      return;
+
+    const std::size_t begin = c * chunkSize;
+    const std::size_t end = std::min(count, begin + chunkSize);
+    Chunk& chunk = chunks[c];
+    chunk.positions.reserve(end - begin);
+    if (color.base)
+      chunk.colors.reserve(end - begin);
+
+    // filter: points with a non-finite coordinate are dropped
+    for (std::size_t v = begin; v < end; ++v)
+    {
+      const float* p = position[v];
+      if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || !std::isfinite(p[2]))
+        continue;
+      chunk.positions.emplace_back(p[0], p[1], p[2], 1.0f);
+      if (color.base)
+      {
+        const float* rgb = color[v];
+        chunk.colors.emplace_back(rgb[0], rgb[1], rgb[2], 1.0f);
+      }
+    }
+
+    if (cancelled(job.generation))
+      return;
+    sortChunk(chunk);
+  });
+  if (cancelled(job.generation))
+    return nullptr;
+
+  // pack: chunks copied one after the other
+  std::vector<std::size_t> offsets(chunkCount + 1, 0);
+  for (std::size_t c = 0; c < chunkCount; ++c)
+    offsets[c + 1] = offsets[c] + chunks[c].positions.size();
+  cloud->positions.resize(offsets.back());
+  if (color.base)
+    cloud->colors.resize(offsets.back());
+
+  parallelFor(chunkCount, [&](std::size_t c) {
+    if (cancelled(job.generation))
+      return;
+    std::copy(chunks[c].positions.begin(), chunks[c].positions.end(),
+              cloud->positions.begin() + offsets[c]);
+    std::copy(chunks[c].colors.begin(), chunks[c].colors.end(),
+              cloud->colors.begin() + offsets[c]);
+    chunks[c] = {};
+  });
+  if (cancelled(job.generation))
+    return nullptr;
+
+  // bounds of the culling chunks, compact as the points are in Morton order
+  const std::size_t pointCount = cloud->positions.size();
+  cloud->chunks.resize((pointCount + PointCloud::chunkPoints - 1) / PointCloud::chunkPoints);
+  parallelFor(cloud->chunks.size(), [&](std::size_t c) {
+    const std::size_t begin = c * PointCloud::chunkPoints;
+    const std::size_t end = std::min(pointCount, begin + PointCloud::chunkPoints);
+    QVector3D lo = cloud->positions[begin].toVector3D();
+    QVector3D hi = lo;
+    for (std::size_t v = begin + 1; v < end; ++v)
+    {
+      const QVector4D& p = cloud->positions[v];
+      lo = QVector3D(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+      hi = QVector3D(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+    }
+    cloud->chunks[c] = {lo, hi};
+  });
+
+  return cloud;
+}
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <fulldome_voxel/PointCloud.hpp>
+#include <fulldome_voxel/TripleBuffer.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace vkfrt
+{
+// Turns the meshes received by the node (or the frames of the sequence
+// converter) into point clouds away from the gfx graph thread. Each submission goes through decode -> filter -> sort ->
+// pack, chunk by chunk on a small worker pool; a newer submission cancels
+// the running one at the next chunk. The finished cloud replaces the
+// previous one as a whole and is read by the renderers with latest().
+class PointCloudIngest
+{
+public:
+  // 0: half the hardware threads
+  explicit PointCloudIngest(int workerCount = 0);
+  PointCloudIngest(const PointCloudIngest&) = delete;
+  PointCloudIngest& operator=(const PointCloudIngest&) = delete;
+  ~PointCloudIngest();
+
+  // float3 positions, and colors when present, read in place by the
+  // workers: owner keeps the memory they point into alive until then. See
+  // meshPoints for the meshes received by the node.
+  struct Points
+  {
+    std::shared_ptr<const void> owner;
+    std::size_t count{};
+    const char* positions{};
+    int64_t positionStride{};
+    // null without colors
+    const char* colors{};
+    int64_t colorStride{};
+  };
+  void submit(const void* source, int64_t revision, Points points);
+
+  // last finished cloud, null until there is one. Lock-free, to be called
+  // from a single thread (the render thread)
+  const std::shared_ptr<const PointCloud>& latest() noexcept;
+  // a submission is waiting or running
+  bool busy() const noexcept { return m_busy.load(std::memory_order_acquire); }
+
+  // points per chunk of the stages
+  static constexpr std::size_t chunkSize = std::size_t(1) << 18;
+
+private:
+  struct Job
+  {
+    const void* source{};
+    int64_t revision{-1};
+    uint64_t generation{};
+    Points points;
+  };
+
+  void coordinatorLoop();
+  void workerLoop();
+  // calls fn(0) ... fn(count - 1) on the workers and the calling thread,
+  // returns once every call is done
+  void parallelFor(std::size_t count, const std::function<void(std::size_t)>& fn);
+  bool cancelled(uint64_t generation) const noexcept
+  {
+    return generation != m_generation.load(std::memory_order_acquire);
+  }
+  // null when cancelled
+  std::shared_ptr<PointCloud> run(const Job& job);
+
+  std::atomic<uint64_t> m_generation{0};
+  std::atomic<bool> m_busy{false};
+
+  // the coordinator runs the stages of the latest submission only
+  std::mutex m_jobMutex;
+  std::condition_variable m_jobCondition;
+  std::optional<Job> m_pending;
+  bool m_quit{false};
+  std::thread m_coordinator;
+
+  // chunk tasks of parallelFor
+  std::mutex m_taskMutex;
+  std::condition_variable m_taskCondition;
+  std::deque<std::function<void()>> m_tasks;
+  bool m_stopWorkers{false};
+  std::vector<std::thread> m_workers;
+
+  // written by the coordinator, read by latest()
+  TripleBuffer<std::shared_ptr<const PointCloud>> m_published;
+};
+}
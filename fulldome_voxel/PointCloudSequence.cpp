@@ -0,0 +1,408 @@
+#include "PointCloudSequence.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace vkfrt
+{
+namespace
+{
+constexpr char sequenceMagic[8] = {'V', 'K', 'F', 'R', 'T', 'S', 'E', 'Q'};
+constexpr uint32_t sequenceVersion = 1;
+constexpr uint64_t frameHasColors = 0x1;
+// bounds checked before any size computation, so that a corrupt header
+// cannot overflow them or have the workers allocate without limit
+constexpr uint64_t maxSequencePoints = uint64_t(1) << 30;
+constexpr uint32_t maxSequenceFrames = uint32_t(1) << 24;
+
+struct FileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t frameCount;
+  float fps;
+  uint32_t reserved;
+  uint64_t maxPoints;
+  uint64_t tableOffset;
+};
+static_assert(sizeof(FileHeader) == 40);
+static_assert(sizeof(QVector4D) == 16);
+static_assert(sizeof(PointCloud::ChunkBounds) == 24);
+
+uint64_t frameBytes(uint64_t pointCount, uint64_t chunkCount, uint64_t flags)
+{
+  const uint64_t streams = (flags & frameHasColors) ? 2 : 1;
+  return pointCount * sizeof(QVector4D) * streams
+         + chunkCount * sizeof(PointCloud::ChunkBounds);
+}
+
+uint64_t chunksOf(uint64_t pointCount)
+{
+  return (pointCount + PointCloud::chunkPoints - 1) / PointCloud::chunkPoints;
+}
+
+std::vector<PointCloud::ChunkBounds> chunkBounds(const std::vector<QVector4D>& positions)
+{
+  const std::size_t pointCount = positions.size();
+  std::vector<PointCloud::ChunkBounds> chunks(chunksOf(pointCount));
+  for (std::size_t c = 0; c < chunks.size(); ++c)
+  {
+    const std::size_t begin = c * PointCloud::chunkPoints;
+    const std::size_t end = std::min(pointCount, begin + PointCloud::chunkPoints);
+    QVector3D lo = positions[begin].toVector3D();
+    QVector3D hi = lo;
+    for (std::size_t v = begin + 1; v < end; ++v)
+    {
+      const QVector4D& p = positions[v];
+      lo = QVector3D(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+      hi = QVector3D(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+    }
+    chunks[c] = {lo, hi};
+  }
+  return chunks;
+}
+}
+
+// ------------------------------------------------------------
+// writer
+// ------------------------------------------------------------
+bool PointCloudSequenceWriter::open(const QString& path, float fps)
+{
+  Q_ASSERT(fps > 0.f);
+  m_file.setFileName(path);
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    qWarning() << "[Sequence] cannot write" << path;
+    return false;
+  }
+  m_fps = fps;
+  m_maxPoints = 0;
+  m_entries.clear();
+
+  // rewritten by finish()
+  const FileHeader header{};
+  return m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+}
+
+bool PointCloudSequenceWriter::append(const PointCloud& frame)
+{
+  Q_ASSERT(m_file.isOpen());
+  Q_ASSERT(frame.colors.empty() || frame.colors.size() == frame.positions.size());
+  if (frame.positions.size() > maxSequencePoints || m_entries.size() >= maxSequenceFrames)
+  {
+    qWarning() << "[Sequence] frame" << m_entries.size() << "exceeds the limits of"
+               << m_file.fileName();
+    return false;
+  }
+
+  const qint64 offset = (m_file.pos() + 15) & ~qint64(15);
+  const QByteArray padding(int(offset - m_file.pos()), '\0');
+  if (m_file.write(padding) != padding.size())
+    return false;
+
+  // the culling takes chunk c as the points [c * chunkPoints, (c + 1) *
+  // chunkPoints): bounds of another chunking are computed again
+  std::vector<PointCloud::ChunkBounds> computed;
+  const std::vector<PointCloud::ChunkBounds>* chunks = &frame.chunks;
+  if (frame.chunks.size() != chunksOf(frame.positions.size()))
+  {
+    computed = chunkBounds(frame.positions);
+    chunks = &computed;
+  }
+
+  Entry entry;
+  entry.offset = uint64_t(offset);
+  entry.pointCount = frame.positions.size();
+  entry.chunkCount = chunks->size();
+  entry.flags = frame.colors.empty() ? 0 : frameHasColors;
+
+  const auto write = [this](const void* data, std::size_t bytes) {
+    return m_file.write(static_cast<const char*>(data), qint64(bytes)) == qint64(bytes);
+  };
+  if (!write(frame.positions.data(), frame.positions.size() * sizeof(QVector4D))
+      || !write(frame.colors.data(), frame.colors.size() * sizeof(QVector4D))
+      || !write(chunks->data(), chunks->size() * sizeof(PointCloud::ChunkBounds)))
+  {
+    qWarning() << "[Sequence] cannot write frame" << m_entries.size() << "to" << m_file.fileName();
+    return false;
+  }
+
+  m_maxPoints = std::max(m_maxPoints, entry.pointCount);
+  m_entries.push_back(entry);
+  return true;
+}
+
+bool PointCloudSequenceWriter::finish()
+{
+  Q_ASSERT(m_file.isOpen());
+
+  const qint64 tableOffset = (m_file.pos() + 15) & ~qint64(15);
+  const QByteArray padding(int(tableOffset - m_file.pos()), '\0');
+  const qint64 tableBytes = qint64(m_entries.size() * sizeof(Entry));
+  bool ok = m_file.write(padding) == padding.size()
+            && m_file.write(reinterpret_cast<const char*>(m_entries.data()), tableBytes) == tableBytes;
+
+  FileHeader header{};
+  std::memcpy(header.magic, sequenceMagic, sizeof(sequenceMagic));
+  header.version = sequenceVersion;
+  header.frameCount = uint32_t(m_entries.size());
+  header.fps = m_fps;
+  header.maxPoints = m_maxPoints;
+  header.tableOffset = uint64_t(tableOffset);
+  ok = ok && m_file.seek(0)
+       && m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+
+  if (!ok)
+    qWarning() << "[Sequence] cannot write" << m_file.fileName();
+  m_file.close();
+  m_entries.clear();
+  return ok;
+}
+
+// ------------------------------------------------------------
+// player
+// ------------------------------------------------------------
+PointCloudSequence::PointCloudSequence(int workerCount)
+{
+  // a frame is a few memcpys: more workers only help with large frames
+  // played faster than they decode
+  for (int i = 0; i < std::max(1, workerCount); ++i)
+    m_workers.emplace_back([this] { workerLoop(); });
+}
+
+PointCloudSequence::~PointCloudSequence()
+{
+  close();
+  {
+    std::lock_guard lock{m_mutex};
+    m_quit = true;
+  }
+  m_taskCondition.notify_all();
+  for (std::thread& worker : m_workers)
+    worker.join();
+}
+
+bool PointCloudSequence::open(const QString& path)
+{
+  close();
+
+  std::lock_guard lock{m_mutex};
+  m_file.setFileName(path);
+  if (!m_file.open(QIODevice::ReadOnly))
+  {
+    qWarning() << "[Sequence] cannot open" << path;
+    return false;
+  }
+
+  // the pages are faulted in by the workers, off the graph and render threads
+  const qint64 size = m_file.size();
+  uchar* data = size >= qint64(sizeof(FileHeader)) ? m_file.map(0, size) : nullptr;
+  const auto fail = [&](const char* reason) {
+    qWarning() << "[Sequence]" << path << reason;
+    if (data)
+      m_file.unmap(data);
+    m_file.close();
+    return false;
+  };
+  if (!data)
+    return fail("cannot be mapped");
+
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, sequenceMagic, sizeof(sequenceMagic)) != 0)
+    return fail("is not a point cloud sequence");
+  if (header.version != sequenceVersion)
+    return fail("has an unsupported version");
+  if (header.frameCount == 0 || !(header.fps > 0.f))
+    return fail("is empty");
+  if (header.frameCount > maxSequenceFrames || header.maxPoints > maxSequencePoints)
+    return fail("is too large");
+  const uint64_t tableBytes = uint64_t(header.frameCount) * sizeof(Entry);
+  if (header.tableOffset % alignof(Entry) != 0 || header.tableOffset > uint64_t(size)
+      || tableBytes > uint64_t(size) - header.tableOffset)
+    return fail("is truncated");
+
+  std::vector<Entry> entries(header.frameCount);
+  std::memcpy(entries.data(), data + header.tableOffset, tableBytes);
+  uint64_t largest = 0;
+  for (const Entry& e : entries)
+  {
+    // the writer aligns frames for the copies of the workers. Frames hold
+    // the bounds of every chunk, or none and decode() computes them.
+    if (e.offset % 16 != 0 || e.pointCount > header.maxPoints
+        || (e.chunkCount != 0 && e.chunkCount != chunksOf(e.pointCount))
+        || e.offset > uint64_t(size)
+        || frameBytes(e.pointCount, e.chunkCount, e.flags) > uint64_t(size) - e.offset)
+      return fail("has an invalid frame table");
+    largest = std::max(largest, e.pointCount);
+  }
+  // sizes the scene buffers of the renderers: no larger than needed
+  if (header.maxPoints != largest)
+    return fail("has an invalid frame table");
+
+  m_data = data;
+  m_entries = std::move(entries);
+  m_fps = header.fps;
+  m_maxPoints = std::size_t(header.maxPoints);
+  m_generation++;
+  m_current = -1;
+  qDebug() << "[Sequence]" << path << m_entries.size() << "frames at" << m_fps << "fps,"
+           << m_maxPoints << "points at most";
+  return true;
+}
+
+void PointCloudSequence::close()
+{
+  std::unique_lock lock{m_mutex};
+  if (!m_data)
+    return;
+
+  // the running decodes read the mapping
+  m_generation++;
+  m_wanted.clear();
+  m_idleCondition.wait(lock, [this] { return m_decoding.empty(); });
+
+  m_file.unmap(m_data);
+  m_file.close();
+  m_data = nullptr;
+  m_entries.clear();
+  m_frames.clear();
+  m_current = -1;
+  // m_shown stays published: the renderers switch back to their own cloud
+}
+
+bool PointCloudSequence::inWindow(int frame) const noexcept
+{
+  if (m_current < 0)
+    return false;
+  const int count = int(m_entries.size());
+  const int ahead = (frame - m_current + count) % count;
+  return ahead < std::min(prefetchFrames, count);
+}
+
+void PointCloudSequence::seek(double seconds)
+{
+  std::unique_lock lock{m_mutex};
+  if (!m_data)
+    return;
+
+  const int count = int(m_entries.size());
+  const double position = std::floor(std::max(0., seconds) * m_fps);
+  const int frame = int(std::fmod(position, double(count)));
+  if (frame == m_current)
+    return;
+  m_current = frame;
+
+  // outside of the window after a jump or a loop: their memory goes first
+  for (auto it = m_frames.begin(); it != m_frames.end();)
+  {
+    if (inWindow(it->first))
+      ++it;
+    else
+      it = m_frames.erase(it);
+  }
+
+  // nearest first, the current frame ahead of everything
+  m_wanted.clear();
+  for (int k = 0; k < std::min(prefetchFrames, count); ++k)
+  {
+    const int f = (frame + k) % count;
+    if (!m_frames.count(f)
+        && std::find(m_decoding.begin(), m_decoding.end(), f) == m_decoding.end())
+      m_wanted.push_back(f);
+  }
+
+  if (auto it = m_frames.find(frame); it != m_frames.end())
+    publish(it->second);
+  // otherwise published by the worker decoding it
+
+  const bool work = !m_wanted.empty();
+  lock.unlock();
+  if (work)
+    m_taskCondition.notify_all();
+}
+
+const std::shared_ptr<const PointCloud>& PointCloudSequence::latest() noexcept
+{
+  m_published.acquire();
+  return m_published.front();
+}
+
+void PointCloudSequence::publish(const std::shared_ptr<const PointCloud>& cloud)
+{
+  if (cloud == m_shown)
+    return;
+  m_shown = cloud;
+  m_published.back() = cloud;
+  m_published.publish();
+}
+
+void PointCloudSequence::workerLoop()
+{
+  for (;;)
+  {
+    Task task;
+    {
+      std::unique_lock lock{m_mutex};
+      m_taskCondition.wait(lock, [this] { return m_quit || !m_wanted.empty(); });
+      if (m_quit)
+        return;
+      task.frame = m_wanted.front();
+      m_wanted.pop_front();
+      task.generation = m_generation;
+      task.data = m_data;
+      task.entry = m_entries[task.frame];
+      task.capacity = m_maxPoints;
+      m_decoding.push_back(task.frame);
+    }
+
+    std::shared_ptr<const PointCloud> cloud = decode(task);
+
+    {
+      std::lock_guard lock{m_mutex};
+      m_decoding.erase(std::find(m_decoding.begin(), m_decoding.end(), task.frame));
+      // dropped when the file changed or the timeline moved past it
+      if (task.generation == m_generation && inWindow(task.frame))
+      {
+        m_frames[task.frame] = cloud;
+        if (task.frame == m_current)
+          publish(cloud);
+      }
+    }
+    m_idleCondition.notify_all();
+  }
+}
+
+std::shared_ptr<PointCloud> PointCloudSequence::decode(const Task& task) const
+{
+  const Entry& e = task.entry;
+  const uchar* p = task.data + e.offset;
+
+  auto cloud = std::make_shared<PointCloud>();
+  cloud->source = this;
+  // unique across the frames of every file opened by this player
+  cloud->revision = int64_t((task.generation << 32) | uint32_t(task.frame));
+  cloud->sequenceCapacity = task.capacity;
+
+  cloud->positions.resize(e.pointCount);
+  std::memcpy(cloud->positions.data(), p, e.pointCount * sizeof(QVector4D));
+  p += e.pointCount * sizeof(QVector4D);
+  if (e.flags & frameHasColors)
+  {
+    cloud->colors.resize(e.pointCount);
+    std::memcpy(cloud->colors.data(), p, e.pointCount * sizeof(QVector4D));
+    p += e.pointCount * sizeof(QVector4D);
+  }
+  if (e.chunkCount == 0)
+  {
+    cloud->chunks = chunkBounds(cloud->positions);
+    return cloud;
+  }
+  cloud->chunks.resize(e.chunkCount);
+  std::memcpy(cloud->chunks.data(), p, e.chunkCount * sizeof(PointCloud::ChunkBounds));
+  return cloud;
+}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <fulldome_voxel/PointCloud.hpp>
+#include <fulldome_voxel/TripleBuffer.hpp>
+
+#include <QFile>
+#include <QString>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkfrt
+{
+// Preprocessed point cloud sequence (volumetric video), laid out so that a
+// frame is read with a few copies out of the mapped file:
+//
+//   header       "VKFRTSEQ", version, frame count, fps, points of the
+//                largest frame, offset of the frame table
+//   frames       positions, colors (when present) and chunk bounds of each
+//                frame, as in PointCloud, 16-byte aligned
+//   frame table  offset, point count, chunk count and flags of each frame
+//
+// Written from clouds prepared by PointCloudIngest, whose Morton ordering
+// keeps consecutive frames close enough for the tlas refits.
+class PointCloudSequenceWriter
+{
+public:
+  bool open(const QString& path, float fps);
+  // chunk bounds are computed when the frame has none
+  bool append(const PointCloud& frame);
+  // writes the frame table; the file is unusable until then
+  bool finish();
+
+private:
+  struct Entry
+  {
+    uint64_t offset;
+    uint64_t pointCount;
+    uint64_t chunkCount;
+    uint64_t flags;
+  };
+
+  QFile m_file;
+  float m_fps{};
+  uint64_t m_maxPoints{};
+  std::vector<Entry> m_entries;
+};
+
+// Plays a sequence file along the timeline. seek() is called by the node
+// with the timeline position; the frames from there to prefetchFrames ahead
+// are decoded from the mapped file on worker threads, and each one is
+// published once it is the current frame. The renderers pick it up with
+// latest(), like the clouds of PointCloudIngest, and stream it into their
+// scene (see PointCloud::sequenceCapacity). Memory stays bounded by the
+// prefetch window; a frame not decoded in time leaves the previous one on
+// screen.
+class PointCloudSequence
+{
+public:
+  explicit PointCloudSequence(int workerCount = 2);
+  PointCloudSequence(const PointCloudSequence&) = delete;
+  PointCloudSequence& operator=(const PointCloudSequence&) = delete;
+  ~PointCloudSequence();
+
+  // graph thread
+  bool open(const QString& path);
+  void close();
+  bool isOpen() const noexcept { return m_data != nullptr; }
+  // timeline position in seconds, looping over the sequence
+  void seek(double seconds);
+
+  // last published frame, null until there is one. Lock-free, to be called
+  // from a single thread (the render thread)
+  const std::shared_ptr<const PointCloud>& latest() noexcept;
+
+  static constexpr int prefetchFrames = 8;
+
+private:
+  struct Entry
+  {
+    uint64_t offset;
+    uint64_t pointCount;
+    uint64_t chunkCount;
+    uint64_t flags;
+  };
+  struct Task
+  {
+    int frame{};
+    uint64_t generation{};
+    const uchar* data{};
+    Entry entry{};
+    std::size_t capacity{};
+  };
+
+  void workerLoop();
+  std::shared_ptr<PointCloud> decode(const Task& task) const;
+  // the frames of the prefetch window, starting at the current one
+  bool inWindow(int frame) const noexcept;
+  // with m_mutex held: the triple buffer has a single producer
+  void publish(const std::shared_ptr<const PointCloud>& cloud);
+
+  // graph thread state and worker queue, under m_mutex
+  std::mutex m_mutex;
+  std::condition_variable m_taskCondition;
+  std::condition_variable m_idleCondition;
+  QFile m_file;
+  uchar* m_data{};
+  std::vector<Entry> m_entries;
+  float m_fps{30.f};
+  std::size_t m_maxPoints{};
+  // bumped by every open / close, frames of an older file are dropped
+  uint64_t m_generation{};
+  int m_current{-1};
+  std::deque<int> m_wanted;
+  std::vector<int> m_decoding;
+  std::map<int, std::shared_ptr<const PointCloud>> m_frames;
+  std::shared_ptr<const PointCloud> m_shown;
+  bool m_quit{false};
+  std::vector<std::thread> m_workers;
+
+  TripleBuffer<std::shared_ptr<const PointCloud>> m_published;
+};
+}
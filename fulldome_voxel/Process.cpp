@@ -45,10 +45,137 @@ void Model::init(){
     std::vector<std::pair<QString, ossia::value>> projmodes{
               {"Perspective", 0},
               {"Fulldome (1-pass)", 1},
+              {"Fulldome (cubemap)", 2},
+              {"Equirectangular (cubemap)", 3},
           };
     m_inlets.push_back(
         new Process::ComboBox{projmodes, 0, "Camera", Id<Process::Port>(4), this});
   }
+
+  if (m_inlets.size() <= 5)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{true, "Dome mask", Id<Process::Port>(5), this});
+  }
+
+  if (m_inlets.size() <= 6)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{false, "Foveation", Id<Process::Port>(6), this});
+    m_inlets.push_back(new Process::XYZSpinboxes{
+        ossia::vec3f{-1., -1., -1.}, ossia::vec3f{1., 1., 1.},
+        ossia::vec3f{0., 0., -1.}, "Focus direction", Id<Process::Port>(7), this});
+    m_inlets.push_back(new Process::FloatSlider{
+        0., 180., 60., "Full-rate angle", Id<Process::Port>(8), this});
+    m_inlets.push_back(new Process::FloatSlider{
+        1., 90., 30., "Fall-off angle", Id<Process::Port>(9), this});
+  }
+
+  if (m_inlets.size() <= 10)
+  {
+    std::vector<std::pair<QString, ossia::value>> interleaves{
+              {"Off", 1},
+              {"1/2 (checkerboard)", 2},
+              {"1/4", 4},
+          };
+    m_inlets.push_back(
+        new Process::ComboBox{interleaves, 1, "Temporal interleave", Id<Process::Port>(10), this});
+  }
+
+  if (m_inlets.size() <= 11)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{true, "Cache static frames", Id<Process::Port>(11), this});
+    m_inlets.push_back(
+        new Process::ImpulseButton{"Refresh", Id<Process::Port>(12), this});
+  }
+
+  if (m_inlets.size() <= 13)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{false, "Dynamic resolution", Id<Process::Port>(13), this});
+    m_inlets.push_back(new Process::FloatSlider{
+        4., 100., 16.6, "Target frame time", Id<Process::Port>(14), this});
+    m_inlets.push_back(new Process::FloatSlider{
+        0.25, 1., 0.5, "Minimum scale", Id<Process::Port>(15), this});
+  }
+
+  if (m_inlets.size() <= 16)
+  {
+    std::vector<std::pair<QString, ossia::value>> refinements{
+              {"Off", 1},
+              {"From 1/4", 4},
+              {"From 1/8", 8},
+          };
+    m_inlets.push_back(
+        new Process::ComboBox{refinements, 1, "Progressive refinement", Id<Process::Port>(16), this});
+  }
+
+  if (m_inlets.size() <= 17)
+  {
+    m_inlets.push_back(new Process::FloatSlider{
+        0., 50., 0., "Trace budget (ms)", Id<Process::Port>(17), this});
+  }
+
+  if (m_inlets.size() <= 18)
+  {
+    std::vector<std::pair<QString, ossia::value>> formats{
+              {"RGBA8", 0},
+              {"RGB10A2", 1},
+              {"RGBA16F", 2},
+          };
+    m_inlets.push_back(
+        new Process::ComboBox{formats, 0, "Output format", Id<Process::Port>(18), this});
+  }
+
+  if (m_inlets.size() <= 19)
+  {
+    m_inlets.push_back(
+        new Process::LineEdit{"", "Calibration map", Id<Process::Port>(19), this});
+  }
+
+  if (m_inlets.size() <= 20)
+  {
+    std::vector<std::pair<QString, ossia::value>> backends{
+              {"Ray tracing pipeline", 0},
+              {"Ray query 8x8", 1},
+              {"Ray query 16x8", 2},
+              {"Ray query 16x16", 3},
+              {"Ray query 32x4", 4},
+          };
+    m_inlets.push_back(
+        new Process::ComboBox{backends, 0, "Trace backend", Id<Process::Port>(20), this});
+    m_inlets.push_back(
+        new Process::Toggle{false, "Benchmark backends", Id<Process::Port>(21), this});
+  }
+
+  if (m_inlets.size() <= 22)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{false, "Late latch", Id<Process::Port>(22), this});
+    m_inlets.push_back(new Process::FloatSlider{
+        0., 50., 0., "Prediction (ms)", Id<Process::Port>(23), this});
+  }
+
+  if (m_inlets.size() <= 24)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{false, "Visibility culling", Id<Process::Port>(24), this});
+  }
+
+  if (m_inlets.size() <= 25)
+  {
+    m_inlets.push_back(
+        new Process::Toggle{false, "Record", Id<Process::Port>(25), this});
+    m_inlets.push_back(
+        new Process::LineEdit{"", "Record folder", Id<Process::Port>(26), this});
+  }
+
+  if (m_inlets.size() <= 27)
+  {
+    m_inlets.push_back(
+        new Process::LineEdit{"", "Point cloud sequence", Id<Process::Port>(27), this});
+  }
 }
 
 QString Model::prettyName() const noexcept
@@ -0,0 +1,192 @@
+#pragma once
+#include <QMatrix4x4>
+#include <QPointF>
+#include <QSize>
+#include <QString>
+#include <QVector3D>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace vkfrt
+{
+// Values of the "Camera" combobox, also read by raygen.rgen
+enum ProjectionMode : int
+{
+  Perspective = 0,
+  Fulldome = 1,
+  // traced as a cubemap around the camera position, then resampled: only
+  // moving the camera or changing the scene re-traces the faces
+  FulldomeCubemap = 2,
+  EquirectCubemap = 3,
+};
+
+inline bool usesCubemap(int projectionMode)
+{
+  return projectionMode == FulldomeCubemap || projectionMode == EquirectCubemap;
+}
+
+// Scene as traced by VkRayTracer and ReferenceTracer
+// half extent of the cube instanced for each point
+constexpr float voxelHalfExtent = 0.01f;
+// positions are multiplied by this factor when building instances
+constexpr float sceneScale = 5.f;
+// background color written by miss.rmiss
+constexpr float missColor = 0.1f;
+
+// Camera parameters as set on the node
+struct CameraState
+{
+  QVector3D position{-15.0f, 6.0f, -35.75f};
+  QVector3D center{20.0f, 0.0f, -36.75f};
+  float fov{60.f};
+  int projectionMode{Perspective};
+  // fulldome only: pixels outside the inscribed disc are not traced
+  // and left transparent
+  bool domeMask{true};
+
+  // fulldome only: ray density falls off with the angle to focusDirection
+  // (camera space, -z is the dome center), halving every falloffAngle
+  // degrees past fullRateAngle. Skipped pixels are upsampled.
+  bool foveation{false};
+  QVector3D focusDirection{0.f, 0.f, -1.f};
+  float fullRateAngle{60.f};
+  float falloffAngle{30.f};
+
+  // direct modes only: 1 pixel out of temporalInterleave (1, 2 or 4) is
+  // traced per frame, the others are reprojected from the previous frames.
+  // Replaces foveation when enabled.
+  int temporalInterleave{1};
+
+  // custom projector mapping: image of the camera-space ray direction of
+  // every output pixel, see VkRayDirections. Replaces the projection.
+  QString calibrationMap;
+};
+
+inline bool operator==(const CameraState& a, const CameraState& b)
+{
+  return a.position == b.position && a.center == b.center && a.fov == b.fov
+         && a.projectionMode == b.projectionMode && a.domeMask == b.domeMask
+         && a.foveation == b.foveation && a.focusDirection == b.focusDirection
+         && a.fullRateAngle == b.fullRateAngle && a.falloffAngle == b.falloffAngle
+         && a.temporalInterleave == b.temporalInterleave
+         && a.calibrationMap == b.calibrationMap;
+}
+
+inline bool operator!=(const CameraState& a, const CameraState& b)
+{
+  return !(a == b);
+}
+
+// Eye and target of the camera as sampled at timestamp, with their
+// velocity, for the late latch (see VkRayTracer::latchPose)
+struct CameraPose
+{
+  using Clock = std::chrono::steady_clock;
+
+  QVector3D position;
+  QVector3D center;
+  // units per second, 0 when the camera stands still
+  QVector3D positionVelocity;
+  QVector3D centerVelocity;
+  // default while no pose was sampled
+  Clock::time_point timestamp{};
+
+  bool isValid() const noexcept { return timestamp != Clock::time_point{}; }
+};
+
+// Pose at time t, extrapolated from the velocities. A pose not followed by
+// a newer one within staleAfter is taken as the camera having stopped there,
+// and predictions are cut at maxPrediction where they overshoot more than
+// they help.
+inline CameraPose extrapolatedPose(const CameraPose& pose, CameraPose::Clock::time_point t)
+{
+  constexpr std::chrono::milliseconds staleAfter{50};
+  constexpr float maxPrediction = 0.05f;
+
+  if (t - pose.timestamp > staleAfter)
+    return pose;
+
+  const float dt = std::clamp(
+      std::chrono::duration<float>(t - pose.timestamp).count(), 0.f, maxPrediction);
+  CameraPose p = pose;
+  p.position += pose.positionVelocity * dt;
+  p.center += pose.centerVelocity * dt;
+  p.timestamp = t;
+  return p;
+}
+
+inline QMatrix4x4 viewMatrix(const CameraState& cam)
+{
+  QMatrix4x4 view;
+  view.lookAt(cam.position, cam.center, QVector3D(0.0f, 1.0f, 0.0f));
+  return view;
+}
+
+inline QMatrix4x4 projectionMatrix(const CameraState& cam, QSize pixelSize)
+{
+  QMatrix4x4 proj;
+  proj.perspective(
+      cam.fov, float(pixelSize.width()) / pixelSize.height(), 0.1f, 512.0f);
+  return proj;
+}
+
+// True when uv (in [0; 1]²) falls outside the dome disc and gets no ray.
+inline bool outsideDomeDisc(const CameraState& cam, QPointF uv, float aspect)
+{
+  if (!cam.domeMask)
+    return false;
+  if (cam.projectionMode != Fulldome && cam.projectionMode != FulldomeCubemap)
+    return false;
+
+  const float x = (float(uv.x()) * 2.f - 1.f) * aspect;
+  const float y = float(uv.y()) * 2.f - 1.f;
+  return x * x + y * y > 1.f;
+}
+
+// Camera-space direction of the primary ray going through uv (in [0; 1]²).
+// This is the CPU twin of the projection code in raygen.rgen: both must be
+// kept in sync.
+inline QVector3D viewRayDirection(
+    const CameraState& cam,
+    const QMatrix4x4& projInv,
+    QPointF uv,
+    float aspect)
+{
+  const float dx = float(uv.x()) * 2.f - 1.f;
+  const float dy = float(uv.y()) * 2.f - 1.f;
+
+  if (cam.projectionMode == Perspective)
+  {
+    const QVector4D target = projInv * QVector4D(dx, dy, 1.f, 1.f);
+    return target.toVector3D().normalized();
+  }
+  else if (cam.projectionMode == EquirectCubemap)
+  {
+    // fov is the horizontal coverage, pixels are square in angle
+    const float halfFov = float(M_PI / 180.) * (cam.fov / 2.f);
+    const float lon = dx * halfFov;
+    const float lat = std::clamp(
+        dy * halfFov / aspect, float(-M_PI / 2.), float(M_PI / 2.));
+    return QVector3D(
+               std::cos(lat) * std::sin(lon),
+               std::sin(lat),
+               -std::cos(lat) * std::cos(lon))
+        .normalized();
+  }
+  else
+  {
+    const float x = dx * aspect;
+    const float r = std::sqrt(x * x + dy * dy);
+    const float theta = r * float(M_PI / 180.) * (cam.fov / 2.f);
+    const float phi = std::atan2(dy, x);
+
+    return QVector3D(
+               std::sin(theta) * std::cos(phi),
+               std::sin(theta) * std::sin(phi),
+               -std::cos(theta))
+        .normalized();
+  }
+}
+}
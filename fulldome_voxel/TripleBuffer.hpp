@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace vkfrt
+{
+// Hands values from one producer thread to one consumer thread without
+// locks: the producer fills back() and publishes it, the consumer swaps in
+// the last published slot with acquire() and reads front(). Neither side
+// waits on the other; values published in between are skipped.
+//
+// Slots are reused: back() still holds an older value after publish(), the
+// producer overwrites it as a whole. Several consumers are fine as long as
+// they share the consumer thread (e.g. the renderers of one node); they
+// then tell new values apart by a version of their own in T.
+template <typename T>
+class TripleBuffer
+{
+public:
+  // producer side
+  T& back() noexcept { return m_slots[m_back]; }
+  void publish() noexcept
+  {
+    const uint8_t previous
+        = m_middle.exchange(uint8_t(m_back | freshBit), std::memory_order_acq_rel);
+    m_back = previous & indexMask;
+  }
+
+  // consumer side: true when front() changed
+  bool acquire() noexcept
+  {
+    if (!(m_middle.load(std::memory_order_relaxed) & freshBit))
+      return false;
+    const uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+    m_front = previous & indexMask;
+    return true;
+  }
+  const T& front() const noexcept { return m_slots[m_front]; }
+
+private:
+  static constexpr uint8_t indexMask = 0x3;
+  // set on the middle index by publish(), cleared by acquire()
+  static constexpr uint8_t freshBit = 0x4;
+
+  std::array<T, 3> m_slots{};
+  std::atomic<uint8_t> m_middle{1};
+  uint8_t m_back{0};
+  uint8_t m_front{2};
+};
+}
@@ -0,0 +1,579 @@
+#include "BatchRender.hpp"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSysInfo>
+
+#include <algorithm>
+
+namespace vkfrt::batch
+{
+namespace
+{
+// cloud.bin header: "VKFC", then the format version
+constexpr quint32 cloudMagic = 0x564b4643;
+constexpr quint32 cloudVersion = 1;
+static_assert(sizeof(QVector4D) == 4 * sizeof(float));
+
+// a queued or claimed range of frames [first, end)
+struct Range
+{
+  int first{};
+  int end{};
+  QString owner;
+
+  QString fileName() const
+  {
+    const QString name = QStringLiteral("%1-%2").arg(first).arg(end);
+    return owner.isEmpty() ? name : name + QLatin1Char('.') + owner;
+  }
+};
+
+bool parseRange(const QString& name, Range& r)
+{
+  static const QRegularExpression re(
+      QStringLiteral("^(\\d+)-(\\d+)(?:\\.(.+))?$"));
+  const auto m = re.match(name);
+  if (!m.hasMatch())
+    return false;
+  r.first = m.captured(1).toInt();
+  r.end = m.captured(2).toInt();
+  r.owner = m.captured(3);
+  return r.first < r.end;
+}
+
+std::vector<std::pair<Range, QFileInfo>> listRanges(const QDir& dir)
+{
+  std::vector<std::pair<Range, QFileInfo>> ranges;
+  for (const QFileInfo& fi : dir.entryInfoList(QDir::Files))
+  {
+    Range r;
+    if (parseRange(fi.fileName(), r))
+      ranges.emplace_back(r, fi);
+  }
+  std::sort(ranges.begin(), ranges.end(), [](const auto& a, const auto& b) {
+    return a.first.first < b.first.first;
+  });
+  return ranges;
+}
+
+QDir queueDir(const QString& directory)
+{
+  return QDir(QDir(directory).filePath(QStringLiteral("queue")));
+}
+
+QDir claimsDir(const QString& directory)
+{
+  return QDir(QDir(directory).filePath(QStringLiteral("claims")));
+}
+
+bool frameDone(const QString& directory, int frame)
+{
+  return QFileInfo::exists(framePath(directory, frame));
+}
+
+// first frame of the range not rendered yet, r.end when there is none
+int nextFrame(const QString& directory, const Range& r)
+{
+  int f = r.first;
+  while (f < r.end && frameDone(directory, f))
+    ++f;
+  return f;
+}
+
+bool createEmpty(const QString& path)
+{
+  QFile f(path);
+  return f.open(QIODevice::WriteOnly | QIODevice::NewOnly);
+}
+
+QJsonArray toJson(const QVector3D& v)
+{
+  return QJsonArray{v.x(), v.y(), v.z()};
+}
+
+QVector3D vec3FromJson(const QJsonValue& v)
+{
+  const QJsonArray a = v.toArray();
+  return QVector3D(a[0].toDouble(), a[1].toDouble(), a[2].toDouble());
+}
+
+QJsonObject toJson(const CameraState& cam)
+{
+  return QJsonObject{
+      {QStringLiteral("position"), toJson(cam.position)},
+      {QStringLiteral("center"), toJson(cam.center)},
+      {QStringLiteral("fov"), cam.fov},
+      {QStringLiteral("projectionMode"), cam.projectionMode},
+      {QStringLiteral("domeMask"), cam.domeMask},
+      {QStringLiteral("calibrationMap"), cam.calibrationMap}};
+}
+
+CameraState cameraFromJson(const QJsonObject& obj)
+{
+  CameraState cam;
+  cam.position = vec3FromJson(obj[QStringLiteral("position")]);
+  cam.center = vec3FromJson(obj[QStringLiteral("center")]);
+  cam.fov = obj[QStringLiteral("fov")].toDouble(cam.fov);
+  cam.projectionMode
+      = obj[QStringLiteral("projectionMode")].toInt(cam.projectionMode);
+  cam.domeMask = obj[QStringLiteral("domeMask")].toBool(cam.domeMask);
+  cam.calibrationMap = obj[QStringLiteral("calibrationMap")].toString();
+  return cam;
+}
+
+QString jobFile(const QString& directory)
+{
+  return QDir(directory).filePath(QStringLiteral("job.json"));
+}
+
+bool readJob(const QString& directory, Job& job)
+{
+  return readJobFile(jobFile(directory), job);
+}
+
+bool writeJob(const QString& directory, const Job& job)
+{
+  QJsonArray path;
+  for (const Keyframe& k : job.path)
+    path.append(QJsonObject{
+        {QStringLiteral("frame"), k.frame},
+        {QStringLiteral("camera"), toJson(k.camera)}});
+
+  const QJsonObject obj{
+      {QStringLiteral("frameCount"), job.frameCount},
+      {QStringLiteral("width"), job.pixelSize.width()},
+      {QStringLiteral("height"), job.pixelSize.height()},
+      {QStringLiteral("rangeSize"), job.rangeSize},
+      {QStringLiteral("path"), path}};
+
+  QFile f(jobFile(directory));
+  if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  return f.write(QJsonDocument(obj).toJson()) > 0;
+}
+
+// raw floats: the workers are expected to share the byte order
+bool writeCloud(
+    const QString& directory,
+    const std::vector<QVector4D>& positions,
+    const std::vector<QVector4D>& colors)
+{
+  QFile f(QDir(directory).filePath(QStringLiteral("cloud.bin")));
+  if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  QDataStream out(&f);
+  out << cloudMagic << cloudVersion << quint64(positions.size());
+  // large clouds go past the int sizes of QDataStream
+  const qint64 bytes = qint64(positions.size() * sizeof(QVector4D));
+  return out.status() == QDataStream::Ok
+         && f.write(reinterpret_cast<const char*>(positions.data()), bytes) == bytes
+         && f.write(reinterpret_cast<const char*>(colors.data()), bytes) == bytes;
+}
+
+bool readCloud(
+    const QString& directory,
+    std::vector<QVector4D>& positions,
+    std::vector<QVector4D>& colors)
+{
+  QFile f(QDir(directory).filePath(QStringLiteral("cloud.bin")));
+  if (!f.open(QIODevice::ReadOnly))
+    return false;
+  QDataStream in(&f);
+  quint32 magic{}, version{};
+  quint64 count{};
+  in >> magic >> version >> count;
+  if (in.status() != QDataStream::Ok || magic != cloudMagic || version != cloudVersion
+      || count * 2 * sizeof(QVector4D) > quint64(f.size()))
+    return false;
+
+  positions.resize(count);
+  colors.resize(count);
+  const qint64 bytes = qint64(count * sizeof(QVector4D));
+  return f.read(reinterpret_cast<char*>(positions.data()), bytes) == bytes
+         && f.read(reinterpret_cast<char*>(colors.data()), bytes) == bytes;
+}
+
+// Queues the unfinished frames that no queued range or claim covers, in
+// ranges of rangeSize. Returns whether anything was queued.
+bool queueUncovered(const QString& directory, int frameCount, int rangeSize)
+{
+  std::vector<bool> covered(frameCount, false);
+  for (const QDir& d : {queueDir(directory), claimsDir(directory)})
+    for (const auto& [r, fi] : listRanges(d))
+      for (int f = r.first; f < std::min(r.end, frameCount); ++f)
+        covered[f] = true;
+
+  bool queued = false;
+  int f = 0;
+  while (f < frameCount)
+  {
+    if (covered[f] || frameDone(directory, f))
+    {
+      ++f;
+      continue;
+    }
+    Range r{f, f + 1, {}};
+    while (r.end < frameCount && r.end - r.first < rangeSize && !covered[r.end]
+           && !frameDone(directory, r.end))
+      ++r.end;
+    queued |= createEmpty(queueDir(directory).filePath(r.fileName()));
+    f = r.end;
+  }
+  return queued;
+}
+
+bool claimQueued(const QString& directory, const QString& id, Range& claim)
+{
+  const QDir queue = queueDir(directory);
+  const QDir claims = claimsDir(directory);
+  for (const auto& [r, fi] : listRanges(queue))
+  {
+    Range mine{r.first, r.end, id};
+    if (QDir().rename(fi.absoluteFilePath(), claims.filePath(mine.fileName())))
+    {
+      claim = mine;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool steal(
+    const QString& directory,
+    const WorkerSettings& settings,
+    const QString& id,
+    Range& claim)
+{
+  struct Candidate
+  {
+    Range range;
+    QString path;
+    int next{};
+    bool stale{};
+  };
+
+  const QDir claims = claimsDir(directory);
+  const QDateTime now = QDateTime::currentDateTimeUtc();
+  std::vector<Candidate> candidates;
+  for (const auto& [r, fi] : listRanges(claims))
+  {
+    const int next = nextFrame(directory, r);
+    if (next >= r.end)
+      continue;
+    // a claim of our own id left by a previous run of this worker
+    if (r.owner == id)
+    {
+      claim = r;
+      return true;
+    }
+    const bool stale
+        = fi.lastModified().toUTC().secsTo(now) > settings.staleSeconds;
+    candidates.push_back({r, fi.absoluteFilePath(), next, stale});
+  }
+
+  // abandoned claims first, then the largest unfinished parts
+  std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+    if (a.stale != b.stale)
+      return a.stale;
+    return a.range.end - a.next > b.range.end - b.next;
+  });
+
+  for (const Candidate& c : candidates)
+  {
+    if (c.stale)
+    {
+      Range mine{c.range.first, c.range.end, id};
+      if (QDir().rename(c.path, claims.filePath(mine.fileName())))
+      {
+        qDebug() << "[Batch]" << id << "takes over" << c.range.fileName();
+        claim = mine;
+        return true;
+      }
+      continue;
+    }
+
+    // the owner keeps the frame it is rendering and half of the rest
+    const int remaining = c.range.end - c.next;
+    if (remaining < std::max(2, settings.minStealFrames))
+      continue;
+    const int mid = c.next + (remaining + 1) / 2;
+
+    Range shortened{c.range.first, mid, c.range.owner};
+    if (!QDir().rename(c.path, claims.filePath(shortened.fileName())))
+      continue;
+
+    Range mine{mid, c.range.end, id};
+    if (!createEmpty(claims.filePath(mine.fileName())))
+    {
+      // cannot happen short of a write error: give the frames back
+      createEmpty(queueDir(directory).filePath(Range{mid, c.range.end, {}}.fileName()));
+      continue;
+    }
+    claim = mine;
+    return true;
+  }
+  return false;
+}
+
+// A stealer may have shortened the claim, or taken it over when we were too
+// slow to touch it: false once it is not ours anymore
+bool refreshClaim(const QString& directory, Range& claim)
+{
+  const QDir claims = claimsDir(directory);
+  if (QFileInfo::exists(claims.filePath(claim.fileName())))
+    return true;
+  for (const auto& [r, fi] : listRanges(claims))
+  {
+    if (r.first == claim.first && r.owner == claim.owner)
+    {
+      claim = r;
+      return true;
+    }
+  }
+  return false;
+}
+
+void touch(const QString& path)
+{
+  // not created when missing: the claim may just have been renamed
+  QFile f(path);
+  if (f.open(QIODevice::ReadOnly))
+    f.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+}
+
+// written aside and renamed, so that a frame on disk is always complete
+bool saveFrame(const QString& directory, int frame, const QImage& img, const QString& id)
+{
+  const QString target = framePath(directory, frame);
+  const QString tmp = target + QLatin1Char('.') + id + QStringLiteral(".tmp");
+  if (img.isNull() || !img.save(tmp, "PNG"))
+  {
+    QFile::remove(tmp);
+    return false;
+  }
+  if (QDir().rename(tmp, target))
+    return true;
+
+  // rendered twice, the other copy is as good
+  QFile::remove(tmp);
+  return QFileInfo::exists(target);
+}
+
+// frames rendered, -1 when one could not be written
+int renderClaim(
+    const QString& directory,
+    const Job& job,
+    const regression::Backend& backend,
+    Range claim)
+{
+  const QDir claims = claimsDir(directory);
+  int rendered = 0;
+  for (;;)
+  {
+    if (!refreshClaim(directory, claim))
+      break;
+
+    const QString path = claims.filePath(claim.fileName());
+    const int f = nextFrame(directory, claim);
+    if (f >= claim.end)
+    {
+      // renamed by a stealer in the meantime: look again
+      if (QFile::remove(path) || QFileInfo::exists(path))
+        break;
+      continue;
+    }
+
+    touch(path);
+    const QImage img = backend.render(cameraAt(job.path, f), job.pixelSize);
+    if (!saveFrame(directory, f, img, claim.owner))
+    {
+      qWarning() << "[Batch] cannot write" << framePath(directory, f);
+      return -1;
+    }
+    rendered++;
+  }
+  return rendered;
+}
+}
+
+bool readJobFile(const QString& path, Job& job)
+{
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly))
+    return false;
+  const QJsonObject obj = QJsonDocument::fromJson(f.readAll()).object();
+
+  job.frameCount = obj[QStringLiteral("frameCount")].toInt();
+  job.pixelSize = QSize(
+      obj[QStringLiteral("width")].toInt(), obj[QStringLiteral("height")].toInt());
+  job.rangeSize = obj[QStringLiteral("rangeSize")].toInt(job.rangeSize);
+  job.path.clear();
+  for (const QJsonValue& v : obj[QStringLiteral("path")].toArray())
+  {
+    const QJsonObject k = v.toObject();
+    job.path.push_back(
+        {k[QStringLiteral("frame")].toInt(),
+         cameraFromJson(k[QStringLiteral("camera")].toObject())});
+  }
+  // hand-written paths may list the keyframes in any order
+  std::stable_sort(
+      job.path.begin(), job.path.end(),
+      [](const Keyframe& a, const Keyframe& b) { return a.frame < b.frame; });
+  return job.frameCount > 0 && !job.pixelSize.isEmpty() && !job.path.empty();
+}
+
+CameraState cameraAt(const std::vector<Keyframe>& path, int frame)
+{
+  Q_ASSERT(!path.empty());
+  if (frame <= path.front().frame)
+    return path.front().camera;
+  if (frame >= path.back().frame)
+    return path.back().camera;
+
+  const auto next = std::upper_bound(
+      path.begin(), path.end(), frame,
+      [](int f, const Keyframe& k) { return f < k.frame; });
+  const Keyframe& b = *next;
+  const Keyframe& a = *(next - 1);
+
+  const float t = float(frame - a.frame) / float(b.frame - a.frame);
+  CameraState cam = a.camera;
+  cam.position = a.camera.position + (b.camera.position - a.camera.position) * t;
+  cam.center = a.camera.center + (b.camera.center - a.camera.center) * t;
+  cam.fov = a.camera.fov + (b.camera.fov - a.camera.fov) * t;
+  return cam;
+}
+
+bool createJob(
+    const QString& directory,
+    const Job& job,
+    const std::vector<QVector4D>& positions,
+    const std::vector<QVector4D>& colors)
+{
+  Q_ASSERT(positions.size() == colors.size());
+  QDir dir(directory);
+  if (dir.exists()
+      && !dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot).isEmpty())
+  {
+    qWarning() << "[Batch] job directory is not empty" << directory;
+    return false;
+  }
+  if (job.frameCount <= 0 || job.path.empty() || job.pixelSize.isEmpty())
+  {
+    qWarning() << "[Batch] invalid job";
+    return false;
+  }
+
+  for (const char* sub : {"queue", "claims", "frames"})
+  {
+    if (!QDir().mkpath(dir.filePath(QLatin1String(sub))))
+    {
+      qWarning() << "[Batch] cannot create" << dir.filePath(QLatin1String(sub));
+      return false;
+    }
+  }
+
+  if (!writeCloud(directory, positions, colors) || !writeJob(directory, job))
+  {
+    qWarning() << "[Batch] cannot write the job into" << directory;
+    return false;
+  }
+
+  queueUncovered(directory, job.frameCount, std::max(1, job.rangeSize));
+  return true;
+}
+
+int runWorker(
+    const QString& directory,
+    const regression::Backend& backend,
+    const WorkerSettings& settings)
+{
+  Job job;
+  std::vector<QVector4D> positions, colors;
+  if (!readJob(directory, job) || !readCloud(directory, positions, colors))
+  {
+    qWarning() << "[Batch] cannot read the job in" << directory;
+    return -1;
+  }
+
+  const QString id = !settings.id.isEmpty()
+                         ? settings.id
+                         : QStringLiteral("%1-%2").arg(
+                               QSysInfo::machineHostName(),
+                               QString::number(QCoreApplication::applicationPid()));
+  Q_ASSERT(!id.contains(QLatin1Char('/')));
+
+  backend.load(positions, colors);
+
+  int rendered = 0;
+  for (;;)
+  {
+    Range claim;
+    if (!claimQueued(directory, id, claim) && !steal(directory, settings, id, claim))
+    {
+      // frames given up by a stealer that stopped halfway are queued again;
+      // anything else still claimed is being rendered by someone
+      if (queueUncovered(directory, job.frameCount, std::max(1, job.rangeSize)))
+        continue;
+      break;
+    }
+
+    const int n = renderClaim(directory, job, backend, claim);
+    if (n < 0)
+      break;
+    rendered += n;
+  }
+
+  qDebug() << "[Batch]" << id << "rendered" << rendered << "frames with"
+           << backend.name;
+  return rendered;
+}
+
+bool requeue(const QString& directory, int rangeSize)
+{
+  Job job;
+  if (!readJob(directory, job))
+  {
+    qWarning() << "[Batch] cannot read the job in" << directory;
+    return false;
+  }
+
+  for (const QDir& d : {queueDir(directory), claimsDir(directory)})
+    for (const auto& [r, fi] : listRanges(d))
+      QFile::remove(fi.absoluteFilePath());
+
+  queueUncovered(directory, job.frameCount, std::max(1, rangeSize));
+  return true;
+}
+
+Progress progress(const QString& directory)
+{
+  Progress p;
+  Job job;
+  if (!readJob(directory, job))
+    return p;
+
+  p.frameCount = job.frameCount;
+  for (int f = 0; f < job.frameCount; ++f)
+    p.finished += frameDone(directory, f);
+  p.claimed = int(listRanges(claimsDir(directory)).size());
+  return p;
+}
+
+QString framePath(const QString& directory, int frame)
+{
+  return QDir(directory).filePath(
+      QStringLiteral("frames/%1.png").arg(frame, 6, 10, QLatin1Char('0')));
+}
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <QSize>
+#include <QString>
+#include <QVector4D>
+
+#include <fulldome_voxel/Projection.hpp>
+#include <fulldome_voxel/reference/RegressionSuite.hpp>
+
+#include <vector>
+
+// Offline rendering of a camera path into an image sequence, shared between
+// any number of worker processes, on one machine or several mounting the
+// same directory. There is no coordinator: the job directory is the queue.
+//
+//   job.json             camera path, frame count, image size
+//   cloud.bin            the point cloud
+//   queue/<a>-<b>        frame ranges [a, b) nobody took yet
+//   claims/<a>-<b>.<id>  range being rendered by worker <id>
+//   frames/<n>.png       finished frames
+//
+// Ranges are taken by renaming them from queue/ to claims/, which only one
+// worker can do. A worker with nothing left steals the second half of the
+// largest unfinished claim by renaming it to its shortened range; the owner
+// notices before its next frame. Claims not touched for staleSeconds are
+// taken over whole. A frame exists once renamed into frames/, so a worker
+// stopped at any point loses at most the frame it was rendering, and a
+// frame is rendered twice at worst.
+namespace vkfrt::batch
+{
+struct Keyframe
+{
+  int frame{};
+  CameraState camera;
+};
+
+struct Job
+{
+  // sorted by frame. Position, look-at point and fov are interpolated, the
+  // other fields are those of the previous keyframe.
+  std::vector<Keyframe> path;
+  int frameCount{};
+  QSize pixelSize{4096, 4096};
+  // frames per queued range, the unit of work before any stealing
+  int rangeSize{16};
+};
+
+// Reads a job laid out like the job.json of a job directory, e.g. a camera
+// path written by hand for vkfrt_batch create:
+//
+//   {"frameCount": 240, "width": 4096, "height": 4096, "rangeSize": 16,
+//    "path": [{"frame": 0, "camera": {"position": [x, y, z],
+//              "center": [x, y, z], "fov": 210, "projectionMode": 1}}, ...]}
+//
+// The keyframes are sorted by frame.
+bool readJobFile(const QString& path, Job& job);
+
+CameraState cameraAt(const std::vector<Keyframe>& path, int frame);
+
+// Writes the job, the cloud and the initial queue into an empty directory
+bool createJob(
+    const QString& directory,
+    const Job& job,
+    const std::vector<QVector4D>& positions,
+    const std::vector<QVector4D>& colors);
+
+struct WorkerSettings
+{
+  // unique among the workers of the job; host name and pid when empty
+  QString id;
+  // claims older than this belong to a worker that stopped
+  int staleSeconds{600};
+  // smallest unfinished part of a claim worth splitting
+  int minStealFrames{2};
+};
+
+// Renders frames of the job until none is left; returns how many this
+// worker rendered, -1 if the job could not be read
+int runWorker(
+    const QString& directory,
+    const regression::Backend& backend,
+    const WorkerSettings& settings = {});
+
+// For resuming once every worker stopped: drops the claims and queues the
+// unfinished frames again, instead of waiting for the claims to go stale
+bool requeue(const QString& directory, int rangeSize = 16);
+
+struct Progress
+{
+  int frameCount{};
+  int finished{};
+  int claimed{};
+};
+Progress progress(const QString& directory);
+
+QString framePath(const QString& directory, int frame);
+}
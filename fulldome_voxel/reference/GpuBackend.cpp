@@ -0,0 +1,311 @@
+#include "GpuBackend.hpp"
+
+#include <fulldome_voxel/vk_raytracing/vk_voxel_raytracing.hpp>
+
+#include <QDebug>
+#include <QVulkanInstance>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace vkfrt::regression
+{
+namespace
+{
+bool hasExtensions(
+    QVulkanFunctions* f, VkPhysicalDevice physDev, const std::vector<const char*>& names)
+{
+  uint32_t count = 0;
+  f->vkEnumerateDeviceExtensionProperties(physDev, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> extensions(count);
+  f->vkEnumerateDeviceExtensionProperties(physDev, nullptr, &count, extensions.data());
+  for (const char* name : names)
+  {
+    if (std::none_of(extensions.begin(), extensions.end(), [name](const VkExtensionProperties& e) {
+          return std::strcmp(e.extensionName, name) == 0;
+        }))
+      return false;
+  }
+  return true;
+}
+
+// The device score would hand to the node: one queue doing graphics and
+// compute, with the ray tracing extensions and the features they need
+class HeadlessTracer
+{
+public:
+  HeadlessTracer() = default;
+  HeadlessTracer(const HeadlessTracer&) = delete;
+  HeadlessTracer& operator=(const HeadlessTracer&) = delete;
+
+  ~HeadlessTracer()
+  {
+    if (!m_dev)
+      return;
+    m_df->vkDeviceWaitIdle(m_dev);
+    m_raytracing.release();
+    freeTarget();
+    if (m_fence)
+      m_df->vkDestroyFence(m_dev, m_fence, nullptr);
+    if (m_pool)
+      m_df->vkDestroyCommandPool(m_dev, m_pool, nullptr);
+    m_df->vkDestroyDevice(m_dev, nullptr);
+    m_inst.resetDeviceFunctions(m_dev);
+  }
+
+  bool create()
+  {
+    m_inst.setApiVersion(QVersionNumber(1, 2));
+    if (!m_inst.create())
+    {
+      qWarning() << "[Regression] no Vulkan instance:" << m_inst.errorCode();
+      return false;
+    }
+    m_f = m_inst.functions();
+
+    uint32_t count = 0;
+    m_f->vkEnumeratePhysicalDevices(m_inst.vkInstance(), &count, nullptr);
+    std::vector<VkPhysicalDevice> devices(count);
+    m_f->vkEnumeratePhysicalDevices(m_inst.vkInstance(), &count, devices.data());
+
+    std::vector<const char*> extensions{
+        VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+        VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
+        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME};
+    for (VkPhysicalDevice physDev : devices)
+    {
+      if (!hasExtensions(m_f, physDev, extensions))
+        continue;
+      uint32_t familyCount = 0;
+      m_f->vkGetPhysicalDeviceQueueFamilyProperties(physDev, &familyCount, nullptr);
+      std::vector<VkQueueFamilyProperties> families(familyCount);
+      m_f->vkGetPhysicalDeviceQueueFamilyProperties(physDev, &familyCount, families.data());
+      for (uint32_t i = 0; i < familyCount && !m_physDev; ++i)
+      {
+        const VkQueueFlags wanted = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+        if ((families[i].queueFlags & wanted) == wanted)
+        {
+          m_physDev = physDev;
+          m_queueFamily = i;
+        }
+      }
+      if (m_physDev)
+        break;
+    }
+    if (!m_physDev)
+    {
+      qWarning() << "[Regression] no device supports ray tracing";
+      return false;
+    }
+    // optional: the ray query backend falls back to the pipeline without it
+    const bool rayQuerySupported
+        = hasExtensions(m_f, m_physDev, {VK_KHR_RAY_QUERY_EXTENSION_NAME});
+    if (rayQuerySupported)
+      extensions.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+
+    // every supported feature of these structures is enabled, as the
+    // tracer checks them itself
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQuery = {};
+    rayQuery.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    VkPhysicalDeviceRayTracingPipelineFeaturesKHR pipeline = {};
+    pipeline.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
+    pipeline.pNext = rayQuerySupported ? &rayQuery : nullptr;
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR as = {};
+    as.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    as.pNext = &pipeline;
+    VkPhysicalDeviceVulkan12Features vk12 = {};
+    vk12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vk12.pNext = &as;
+    VkPhysicalDeviceFeatures2 features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &vk12;
+    m_f->vkGetPhysicalDeviceFeatures2(m_physDev, &features);
+    if (!as.accelerationStructure || !pipeline.rayTracingPipeline || !vk12.bufferDeviceAddress)
+    {
+      qWarning() << "[Regression] ray tracing features missing";
+      return false;
+    }
+
+    const float priority = 1.f;
+    VkDeviceQueueCreateInfo queueInfo = {};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = m_queueFamily;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &priority;
+
+    VkDeviceCreateInfo deviceInfo = {};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = &features;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos = &queueInfo;
+    deviceInfo.enabledExtensionCount = uint32_t(extensions.size());
+    deviceInfo.ppEnabledExtensionNames = extensions.data();
+    if (m_f->vkCreateDevice(m_physDev, &deviceInfo, nullptr, &m_dev) != VK_SUCCESS)
+    {
+      qWarning() << "[Regression] cannot create the device";
+      m_dev = VK_NULL_HANDLE;
+      return false;
+    }
+    m_df = m_inst.deviceFunctions(m_dev);
+    m_df->vkGetDeviceQueue(m_dev, m_queueFamily, 0, &m_queue);
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = m_queueFamily;
+    m_df->vkCreateCommandPool(m_dev, &poolInfo, nullptr, &m_pool);
+
+    VkCommandBufferAllocateInfo cbInfo = {};
+    cbInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cbInfo.commandPool = m_pool;
+    cbInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cbInfo.commandBufferCount = 1;
+    m_df->vkAllocateCommandBuffers(m_dev, &cbInfo, &m_cb);
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    m_df->vkCreateFence(m_dev, &fenceInfo, nullptr, &m_fence);
+
+    m_raytracing.init(m_physDev, m_dev, m_f, m_df);
+    // every render is a new trace of the whole image
+    m_raytracing.setCaching(false);
+    return true;
+  }
+
+  void load(const std::vector<QVector4D>& positions, const std::vector<QVector4D>& colors)
+  {
+    auto cloud = std::make_shared<PointCloud>();
+    cloud->source = this;
+    cloud->revision = ++m_revision;
+    cloud->positions = positions;
+    cloud->colors = colors;
+    m_raytracing.setPointCloud(std::move(cloud));
+
+    // the acceleration structures are built by the first trace: part of
+    // the load, not of the first case
+    render(CameraState{}, QSize(1, 1));
+  }
+
+  QImage render(const CameraState& cam, QSize size)
+  {
+    if (size != m_target.size)
+      createTarget(size);
+
+    m_raytracing.setCamera(cam);
+    m_raytracing.invalidate();
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    m_df->vkResetCommandBuffer(m_cb, 0);
+    m_df->vkBeginCommandBuffer(m_cb, &beginInfo);
+
+    // the fence below retires the frame: any slot is free
+    m_target.layout = m_raytracing.render(
+        &m_inst, m_physDev, m_dev, m_df, m_f, m_cb, m_target.image, m_target.layout,
+        m_target.view, 0, size);
+    vkrt::transitionImage(
+        m_df, m_cb, m_target, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {uint32_t(size.width()), uint32_t(size.height()), 1};
+    m_df->vkCmdCopyImageToBuffer(
+        m_cb, m_target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_readback.buf, 1, &region);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_readback.buf;
+    barrier.size = VK_WHOLE_SIZE;
+    m_df->vkCmdPipelineBarrier(
+        m_cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+        &barrier, 0, nullptr);
+    m_df->vkEndCommandBuffer(m_cb);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &m_cb;
+    m_df->vkResetFences(m_dev, 1, &m_fence);
+    m_df->vkQueueSubmit(m_queue, 1, &submitInfo, m_fence);
+    m_df->vkWaitForFences(m_dev, 1, &m_fence, VK_TRUE, UINT64_MAX);
+
+    // the readback buffer is host coherent
+    QImage img(size, QImage::Format_RGBA8888);
+    void* p = nullptr;
+    m_df->vkMapMemory(m_dev, m_readback.mem, 0, VK_WHOLE_SIZE, 0, &p);
+    for (int y = 0; y < size.height(); ++y)
+      std::memcpy(
+          img.scanLine(y), static_cast<const uchar*>(p) + qsizetype(y) * size.width() * 4,
+          size_t(size.width()) * 4);
+    m_df->vkUnmapMemory(m_dev, m_readback.mem);
+    return img;
+  }
+
+private:
+  void createTarget(QSize size)
+  {
+    m_df->vkDeviceWaitIdle(m_dev);
+    freeTarget();
+    m_target = vkrt::createImage(
+        m_physDev, m_dev, m_f, m_df, VK_FORMAT_R8G8B8A8_UNORM, size, 1,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+            | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    m_readback = vkrt::createHostVisibleBuffer(
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_physDev, m_dev, m_f, m_df,
+        VkDeviceSize(size.width()) * size.height() * 4);
+  }
+
+  void freeTarget()
+  {
+    if (m_target.image)
+      vkrt::freeImage(m_target, m_dev, m_df);
+    m_target = {};
+    vkrt::freeBuffer(m_readback, m_dev, m_df);
+    m_readback = {};
+  }
+
+  QVulkanInstance m_inst;
+  QVulkanFunctions* m_f{};
+  QVulkanDeviceFunctions* m_df{};
+  VkPhysicalDevice m_physDev{VK_NULL_HANDLE};
+  uint32_t m_queueFamily{};
+  VkDevice m_dev{VK_NULL_HANDLE};
+  VkQueue m_queue{VK_NULL_HANDLE};
+  VkCommandPool m_pool{VK_NULL_HANDLE};
+  VkCommandBuffer m_cb{VK_NULL_HANDLE};
+  VkFence m_fence{VK_NULL_HANDLE};
+
+  VkRayTracer m_raytracing;
+  int64_t m_revision{};
+  vkrt::Image m_target;
+  vkrt::Buffer m_readback;
+};
+}
+
+Backend gpuBackend()
+{
+  auto tracer = std::make_shared<HeadlessTracer>();
+  if (!tracer->create())
+    return {};
+
+  Backend b;
+  b.name = QStringLiteral("gpu-vulkan");
+  b.load = [tracer](const auto& positions, const auto& colors) {
+    tracer->load(positions, colors);
+  };
+  b.render = [tracer](const CameraState& cam, QSize sz) {
+    return tracer->render(cam, sz);
+  };
+  return b;
+}
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <fulldome_voxel/reference/RegressionSuite.hpp>
+
+namespace vkfrt::regression
+{
+// VkRayTracer on a Vulkan device of its own, without score or a window:
+// each render() records the trace and a copy of the output into host
+// memory, submits it and waits. Needs a QGuiApplication. Returns an invalid
+// backend (see Backend::isValid) when no device supports ray tracing.
+Backend gpuBackend();
+}
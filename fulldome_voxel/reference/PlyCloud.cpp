@@ -0,0 +1,63 @@
+#include "PlyCloud.hpp"
+
+#include <QDebug>
+#include <QFile>
+
+#include <miniply.h>
+
+namespace vkfrt
+{
+bool readPlyCloud(
+    const QString& path,
+    std::vector<QVector4D>& positions,
+    std::vector<QVector4D>& colors)
+{
+  positions.clear();
+  colors.clear();
+
+  miniply::PLYReader reader(QFile::encodeName(path).constData());
+  if (!reader.valid())
+  {
+    qWarning() << "[Ply] cannot read" << path;
+    return false;
+  }
+
+  for (; reader.has_element(); reader.next_element())
+  {
+    if (!reader.element_is(miniply::kPLYVertexElement))
+      continue;
+
+    uint32_t pos[3];
+    if (!reader.load_element() || !reader.find_pos(pos))
+      break;
+
+    const std::size_t count = reader.num_rows();
+    std::vector<float> xyz(count * 3);
+    if (!reader.extract_properties(pos, 3, miniply::PLYPropertyType::Float, xyz.data()))
+      break;
+    positions.resize(count);
+    for (std::size_t i = 0; i < count; ++i)
+      positions[i] = QVector4D(xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2], 1.f);
+
+    uint32_t rgb[3];
+    if (reader.find_properties(rgb, 3, "red", "green", "blue"))
+    {
+      const bool bytes = reader.element()->properties[rgb[0]].type
+                         == miniply::PLYPropertyType::UChar;
+      const float scale = bytes ? 1.f / 255.f : 1.f;
+      if (reader.extract_properties(rgb, 3, miniply::PLYPropertyType::Float, xyz.data()))
+      {
+        colors.resize(count);
+        for (std::size_t i = 0; i < count; ++i)
+          colors[i] = QVector4D(
+              xyz[i * 3] * scale, xyz[i * 3 + 1] * scale, xyz[i * 3 + 2] * scale, 1.f);
+      }
+    }
+    return true;
+  }
+
+  qWarning() << "[Ply] no vertex positions in" << path;
+  positions.clear();
+  return false;
+}
+}
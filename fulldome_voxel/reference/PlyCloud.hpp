@@ -0,0 +1,17 @@
+#pragma once
+#include <QString>
+#include <QVector4D>
+
+#include <vector>
+
+namespace vkfrt
+{
+// Reads the vertices of a PLY file as a point cloud, for the command line
+// tools (in score, the Object Loader node does this). Positions get w = 1;
+// colors are read from red / green / blue, 8-bit ones normalized, and left
+// empty when the file has none.
+bool readPlyCloud(
+    const QString& path,
+    std::vector<QVector4D>& positions,
+    std::vector<QVector4D>& colors);
+}
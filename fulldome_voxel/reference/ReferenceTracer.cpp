@@ -0,0 +1,303 @@
+#include "ReferenceTracer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace vkfrt
+{
+namespace
+{
+// same ray extents as raygen.rgen
+constexpr float rayTMin = 0.001f;
+constexpr float rayTMax = 10000.0f;
+
+// slab test against an axis-aligned box; returns the entry / exit distances
+bool intersectBox(
+    const QVector3D& origin,
+    const QVector3D& invDir,
+    const QVector3D& bmin,
+    const QVector3D& bmax,
+    float& tnear,
+    float& tfar)
+{
+  tnear = -std::numeric_limits<float>::infinity();
+  tfar = std::numeric_limits<float>::infinity();
+  for (int a = 0; a < 3; ++a)
+  {
+    float t0 = (bmin[a] - origin[a]) * invDir[a];
+    float t1 = (bmax[a] - origin[a]) * invDir[a];
+    if (std::isnan(t0) || std::isnan(t1))
+    {
+      // ray parallel to the slab and starting on its boundary
+      if (origin[a] < bmin[a] || origin[a] > bmax[a])
+        return false;
+      continue;
+    }
+    if (t0 > t1)
+      std::swap(t0, t1);
+    tnear = std::max(tnear, t0);
+    tfar = std::min(tfar, t1);
+    if (tnear > tfar)
+      return false;
+  }
+  return true;
+}
+
+uint8_t toUnorm8(float v)
+{
+  return uint8_t(std::lround(std::clamp(v, 0.f, 1.f) * 255.f));
+}
+}
+
+void ReferenceTracer::setPointCloud(
+    const std::vector<QVector4D>& positions,
+    const std::vector<QVector4D>& colors)
+{
+  const float scale = sceneScale;
+
+  m_centers.clear();
+  m_colors.clear();
+  m_centers.reserve(positions.size());
+  m_colors.reserve(positions.size());
+
+  for (std::size_t i = 0; i < positions.size(); ++i)
+  {
+    m_centers.push_back(positions[i].toVector3D() * scale);
+    // points without color are white, as in VkRtScene
+    m_colors.push_back(
+        i < colors.size() ? colors[i].toVector3D() : QVector3D{1.f, 1.f, 1.f});
+  }
+
+  buildGrid();
+}
+
+void ReferenceTracer::buildGrid()
+{
+  m_cellStart.clear();
+  m_cellItems.clear();
+  m_dims[0] = m_dims[1] = m_dims[2] = 0;
+  if (m_centers.empty())
+    return;
+
+  const float h = voxelHalfExtent;
+  const QVector3D ext{h, h, h};
+
+  m_gridMin = m_centers[0] - ext;
+  m_gridMax = m_centers[0] + ext;
+  for (const auto& c : m_centers)
+  {
+    for (int a = 0; a < 3; ++a)
+    {
+      m_gridMin[a] = std::min(m_gridMin[a], c[a] - h);
+      m_gridMax[a] = std::max(m_gridMax[a], c[a] + h);
+    }
+  }
+
+  // aim for roughly two voxels per cell, with a bounded cell count
+  const QVector3D size = m_gridMax - m_gridMin;
+  const double volume = std::max(
+      double(size.x()) * size.y() * size.z(), double(h * h * h * 8.));
+  m_cellSize = float(std::cbrt(volume * 2. / double(m_centers.size())));
+  m_cellSize = std::max(m_cellSize, 2.f * h);
+
+  constexpr int maxDim = 512;
+  for (int a = 0; a < 3; ++a)
+    m_cellSize = std::max(m_cellSize, size[a] / maxDim);
+
+  for (int a = 0; a < 3; ++a)
+    m_dims[a] = std::clamp(int(std::ceil(size[a] / m_cellSize)), 1, maxDim);
+
+  const std::size_t cellCount
+      = std::size_t(m_dims[0]) * std::size_t(m_dims[1]) * std::size_t(m_dims[2]);
+
+  auto cellRange = [&](const QVector3D& c, int lo[3], int hi[3]) {
+    for (int a = 0; a < 3; ++a)
+    {
+      lo[a] = std::clamp(
+          int((c[a] - h - m_gridMin[a]) / m_cellSize), 0, m_dims[a] - 1);
+      hi[a] = std::clamp(
+          int((c[a] + h - m_gridMin[a]) / m_cellSize), 0, m_dims[a] - 1);
+    }
+  };
+  auto cellIndex = [&](int x, int y, int z) {
+    return (std::size_t(z) * m_dims[1] + y) * m_dims[0] + x;
+  };
+
+  // counting sort of voxel indices into the cells they overlap
+  m_cellStart.assign(cellCount + 1, 0);
+  int lo[3], hi[3];
+  for (const auto& c : m_centers)
+  {
+    cellRange(c, lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z)
+      for (int y = lo[1]; y <= hi[1]; ++y)
+        for (int x = lo[0]; x <= hi[0]; ++x)
+          m_cellStart[cellIndex(x, y, z) + 1]++;
+  }
+  for (std::size_t i = 0; i < cellCount; ++i)
+    m_cellStart[i + 1] += m_cellStart[i];
+
+  m_cellItems.resize(m_cellStart[cellCount]);
+  std::vector<uint32_t> cursor(m_cellStart.begin(), m_cellStart.end() - 1);
+  for (std::size_t i = 0; i < m_centers.size(); ++i)
+  {
+    cellRange(m_centers[i], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z)
+      for (int y = lo[1]; y <= hi[1]; ++y)
+        for (int x = lo[0]; x <= hi[0]; ++x)
+          m_cellItems[cursor[cellIndex(x, y, z)]++] = uint32_t(i);
+  }
+}
+
+bool ReferenceTracer::trace(
+    const QVector3D& origin,
+    const QVector3D& direction,
+    float tmin,
+    float tmax,
+    QVector3D& color) const
+{
+  if (m_cellStart.empty())
+    return false;
+
+  const QVector3D invDir{
+      1.f / direction.x(), 1.f / direction.y(), 1.f / direction.z()};
+
+  float t0, t1;
+  if (!intersectBox(origin, invDir, m_gridMin, m_gridMax, t0, t1))
+    return false;
+  t0 = std::max(t0, tmin);
+  t1 = std::min(t1, tmax);
+  if (t0 > t1)
+    return false;
+
+  // 3D-DDA (Amanatides & Woo) through the grid
+  const QVector3D entry = origin + direction * t0;
+  int cell[3], step[3];
+  float tNext[3], tDelta[3];
+  for (int a = 0; a < 3; ++a)
+  {
+    cell[a] = std::clamp(
+        int((entry[a] - m_gridMin[a]) / m_cellSize), 0, m_dims[a] - 1);
+    if (direction[a] > 0.f)
+    {
+      step[a] = 1;
+      tNext[a] = (m_gridMin[a] + (cell[a] + 1) * m_cellSize - origin[a]) * invDir[a];
+      tDelta[a] = m_cellSize * invDir[a];
+    }
+    else if (direction[a] < 0.f)
+    {
+      step[a] = -1;
+      tNext[a] = (m_gridMin[a] + cell[a] * m_cellSize - origin[a]) * invDir[a];
+      tDelta[a] = -m_cellSize * invDir[a];
+    }
+    else
+    {
+      step[a] = 0;
+      tNext[a] = std::numeric_limits<float>::infinity();
+      tDelta[a] = std::numeric_limits<float>::infinity();
+    }
+  }
+
+  const float h = voxelHalfExtent;
+  const QVector3D ext{h, h, h};
+  float best = t1;
+  int64_t hit = -1;
+
+  for (;;)
+  {
+    const std::size_t idx
+        = (std::size_t(cell[2]) * m_dims[1] + cell[1]) * m_dims[0] + cell[0];
+    for (uint32_t k = m_cellStart[idx]; k < m_cellStart[idx + 1]; ++k)
+    {
+      const uint32_t i = m_cellItems[k];
+      float tn, tf;
+      if (!intersectBox(origin, invDir, m_centers[i] - ext, m_centers[i] + ext, tn, tf))
+        continue;
+
+      // culling is disabled on the instances: a ray starting inside a voxel
+      // hits its back faces
+      const float th = tn >= tmin ? tn : tf;
+      if (th >= tmin && th < best)
+      {
+        best = th;
+        hit = i;
+      }
+    }
+
+    const int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+                                         : (tNext[1] < tNext[2] ? 1 : 2);
+    if (best <= tNext[axis] || tNext[axis] > t1)
+      break;
+
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= m_dims[axis])
+      break;
+    tNext[axis] += tDelta[axis];
+  }
+
+  if (hit < 0)
+    return false;
+
+  color = m_colors[hit];
+  return true;
+}
+
+QImage ReferenceTracer::render(const CameraState& cam, QSize pixelSize) const
+{
+  QImage img(pixelSize, QImage::Format_RGBA8888);
+  if (img.isNull())
+    return img;
+
+  const QMatrix4x4 projInv = projectionMatrix(cam, pixelSize).inverted();
+  const QMatrix4x4 viewInv = viewMatrix(cam).inverted();
+  const QVector3D origin = viewInv.map(QVector3D{});
+  const float aspect = float(pixelSize.width()) / pixelSize.height();
+  const int w = pixelSize.width();
+  const int h = pixelSize.height();
+
+  std::atomic_int nextRow{0};
+  auto worker = [&] {
+    for (int y = nextRow++; y < h; y = nextRow++)
+    {
+      uchar* line = img.scanLine(y);
+      for (int x = 0; x < w; ++x)
+      {
+        const QPointF uv{(x + 0.5) / w, (y + 0.5) / h};
+        if (outsideDomeDisc(cam, uv, aspect))
+        {
+          std::fill_n(line + x * 4, 4, uchar(0));
+          continue;
+        }
+
+        const QVector3D dir
+            = viewInv.mapVector(viewRayDirection(cam, projInv, uv, aspect));
+
+        QVector3D c{missColor, missColor, missColor};
+        trace(origin, dir, rayTMin, rayTMax, c);
+
+        line[x * 4 + 0] = toUnorm8(c.x());
+        line[x * 4 + 1] = toUnorm8(c.y());
+        line[x * 4 + 2] = toUnorm8(c.z());
+        line[x * 4 + 3] = 255;
+      }
+    }
+  };
+
+  const int threadCount
+      = m_threadCount > 0
+            ? m_threadCount
+            : int(std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount - 1);
+  for (int i = 1; i < threadCount; ++i)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& t : threads)
+    t.join();
+
+  return img;
+}
+}
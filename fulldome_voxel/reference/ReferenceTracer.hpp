@@ -0,0 +1,56 @@
+#pragma once
+#include <QImage>
+#include <QSize>
+#include <QVector3D>
+#include <QVector4D>
+
+#include <fulldome_voxel/Projection.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace vkfrt
+{
+// CPU implementation of the voxel ray tracer.
+// Renders the same scene as VkRayTracer (one cube per point, same cameras,
+// same miss color) without needing a Vulkan device, so that results can be
+// checked on machines without ray tracing support.
+class ReferenceTracer
+{
+public:
+  void setPointCloud(
+      const std::vector<QVector4D>& positions,
+      const std::vector<QVector4D>& colors);
+
+  // Returns a RGBA8888 image laid out like the storage image written by raygen
+  QImage render(const CameraState& cam, QSize pixelSize) const;
+
+  std::size_t pointCount() const noexcept { return m_centers.size(); }
+
+  // threads used by render(); 0 uses every hardware thread. Lowered when
+  // several renderers share a machine.
+  void setThreadCount(int count) noexcept { m_threadCount = count; }
+
+private:
+  void buildGrid();
+  bool trace(
+      const QVector3D& origin,
+      const QVector3D& direction,
+      float tmin,
+      float tmax,
+      QVector3D& color) const;
+
+  std::vector<QVector3D> m_centers;
+  std::vector<QVector3D> m_colors;
+
+  // uniform grid over the voxels, cells store indices into m_centers
+  QVector3D m_gridMin;
+  QVector3D m_gridMax;
+  float m_cellSize{1.f};
+  int m_dims[3]{0, 0, 0};
+  std::vector<uint32_t> m_cellStart;
+  std::vector<uint32_t> m_cellItems;
+
+  int m_threadCount{0};
+};
+}
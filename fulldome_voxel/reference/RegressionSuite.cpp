@@ -0,0 +1,327 @@
+#include "RegressionSuite.hpp"
+
+#include <fulldome_voxel/reference/ReferenceTracer.hpp>
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSysInfo>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+namespace vkfrt::regression
+{
+std::vector<Case> standardCases()
+{
+  // camera in the middle of the reference room, looking at the +x wall
+  CameraState cam;
+  cam.position = {0.f, 0.f, 0.f};
+  cam.center = {1.f, 0.f, 0.f};
+
+  std::vector<Case> cases;
+
+  cam.projectionMode = Perspective;
+  cam.fov = 90.f;
+  cases.push_back({QStringLiteral("perspective_90"), cam});
+
+  cam.projectionMode = Fulldome;
+  for (float fov : {110.f, 180.f, 210.f, 300.f})
+  {
+    cam.fov = fov;
+    cases.push_back({QStringLiteral("fulldome_%1").arg(int(fov)), cam});
+  }
+  return cases;
+}
+
+void makeReferenceCloud(
+    std::vector<QVector4D>& positions,
+    std::vector<QVector4D>& colors)
+{
+  positions.clear();
+  colors.clear();
+
+  // point spacing equal to the voxel size after scaling, so walls are solid
+  const float spacing = 2.f * voxelHalfExtent / sceneScale;
+  const float halfRoom = 0.2f;
+  const int n = int(std::lround(2.f * halfRoom / spacing));
+
+  const QVector3D wallColors[6]
+      = {{0.9f, 0.2f, 0.2f},
+         {0.2f, 0.9f, 0.2f},
+         {0.2f, 0.2f, 0.9f},
+         {0.9f, 0.9f, 0.2f},
+         {0.2f, 0.9f, 0.9f},
+         {0.9f, 0.2f, 0.9f}};
+
+  // six walls of a room around the origin, with a checker pattern
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    for (int side = 0; side < 2; ++side)
+    {
+      const QVector3D base = wallColors[axis * 2 + side];
+      for (int i = 0; i <= n; ++i)
+      {
+        for (int j = 0; j <= n; ++j)
+        {
+          float p[3];
+          p[axis] = side ? halfRoom : -halfRoom;
+          p[(axis + 1) % 3] = -halfRoom + i * spacing;
+          p[(axis + 2) % 3] = -halfRoom + j * spacing;
+          positions.emplace_back(p[0], p[1], p[2], 1.f);
+
+          const bool dark = ((i / 10) + (j / 10)) % 2;
+          const QVector3D c = dark ? base * 0.5f : base;
+          colors.emplace_back(c, 1.f);
+        }
+      }
+    }
+  }
+
+  // a sphere in front of the camera, for depth discontinuities
+  const QVector3D sphereCenter{0.1f, -0.04f, 0.06f};
+  const float sphereRadius = 0.04f;
+  const int sphereCount = 3000;
+  const float golden = float(M_PI * (3. - std::sqrt(5.)));
+  for (int i = 0; i < sphereCount; ++i)
+  {
+    const float y = 1.f - 2.f * (i + 0.5f) / sphereCount;
+    const float rad = std::sqrt(1.f - y * y);
+    const float theta = golden * i;
+    const QVector3D d{std::cos(theta) * rad, y, std::sin(theta) * rad};
+    positions.emplace_back(sphereCenter + d * sphereRadius, 1.f);
+    colors.emplace_back(d * 0.5f + QVector3D{0.5f, 0.5f, 0.5f}, 1.f);
+  }
+}
+
+ImageDiff
+compareImages(const QImage& reference, const QImage& image, int channelTolerance)
+{
+  ImageDiff diff;
+  if (reference.size() != image.size())
+  {
+    diff.sizeMismatch = true;
+    return diff;
+  }
+
+  const QImage a = reference.convertToFormat(QImage::Format_RGBA8888);
+  const QImage b = image.convertToFormat(QImage::Format_RGBA8888);
+
+  qint64 total = 0;
+  for (int y = 0; y < a.height(); ++y)
+  {
+    const uchar* la = a.constScanLine(y);
+    const uchar* lb = b.constScanLine(y);
+    for (int x = 0; x < a.width(); ++x)
+    {
+      int pixelError = 0;
+      for (int c = 0; c < 4; ++c)
+      {
+        const int e = std::abs(int(la[x * 4 + c]) - int(lb[x * 4 + c]));
+        pixelError = std::max(pixelError, e);
+        total += e;
+      }
+      diff.maxChannelError = std::max(diff.maxChannelError, pixelError);
+      if (pixelError > channelTolerance)
+        diff.mismatchedPixels++;
+    }
+  }
+
+  const qint64 channels = qint64(a.width()) * a.height() * 4;
+  diff.meanChannelError = channels > 0 ? double(total) / channels : 0.;
+  return diff;
+}
+
+Backend referenceBackend(int threadCount)
+{
+  auto tracer = std::make_shared<ReferenceTracer>();
+  tracer->setThreadCount(threadCount);
+
+  Backend b;
+  b.name = QStringLiteral("cpu-reference");
+  b.load = [tracer](const auto& positions, const auto& colors) {
+    tracer->setPointCloud(positions, colors);
+  };
+  b.render = [tracer](const CameraState& cam, QSize sz) {
+    return tracer->render(cam, sz);
+  };
+  return b;
+}
+
+namespace
+{
+QJsonObject readJson(const QString& path)
+{
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly))
+    return {};
+  return QJsonDocument::fromJson(f.readAll()).object();
+}
+
+void writeJson(const QString& path, const QJsonObject& obj)
+{
+  QFile f(path);
+  if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    qWarning() << "[Regression] cannot write" << path;
+    return;
+  }
+  f.write(QJsonDocument(obj).toJson());
+}
+}
+
+QString machineId()
+{
+  return QStringLiteral("%1 %2, %3 threads")
+      .arg(QSysInfo::machineHostName(), QSysInfo::currentCpuArchitecture())
+      .arg(std::thread::hardware_concurrency());
+}
+
+Report run(const Settings& settings, const Backend& backend)
+{
+  Report report;
+
+  QDir dir(settings.referenceDirectory);
+  if (!dir.exists() && !QDir().mkpath(settings.referenceDirectory))
+  {
+    qWarning() << "[Regression] invalid reference directory"
+               << settings.referenceDirectory;
+    return report;
+  }
+  const QString outputPath = settings.outputDirectory.isEmpty()
+                                 ? settings.referenceDirectory
+                                 : settings.outputDirectory;
+  if (!QDir().mkpath(outputPath))
+  {
+    qWarning() << "[Regression] invalid output directory" << outputPath;
+    return report;
+  }
+  const QDir output(outputPath);
+
+  // timings are keyed by backend, as CPU and GPU numbers are not comparable
+  const QString timingsPath = dir.filePath(QStringLiteral("timings.json"));
+  QJsonObject allBaselines = readJson(timingsPath);
+  const QJsonObject baseline = allBaselines[backend.name].toObject();
+  const QJsonObject baselineTraces = baseline[QStringLiteral("trace")].toObject();
+  const QString baselineMachine = baseline[QStringLiteral("machine")].toString();
+  const bool recording = settings.updateReferences || settings.updateTimings;
+  report.timingsChecked
+      = !recording && settings.timingThreshold > 0. && baselineMachine == machineId();
+  if (!recording && settings.timingThreshold > 0. && !report.timingsChecked)
+    qDebug() << "[Regression] timings of" << backend.name << "recorded on"
+             << baselineMachine << "are only reported on" << machineId();
+  const auto regressed = [&](double ms, double baselineMs) {
+    return report.timingsChecked && baselineMs > 0.
+           && ms > baselineMs * settings.timingThreshold;
+  };
+
+  std::vector<QVector4D> positions, colors;
+  makeReferenceCloud(positions, colors);
+
+  // median of the runs; each measurement follows an untimed load or render
+  // of the same work, so the first use of caches, allocations and pipelines
+  // is left out
+  const int runs = std::max(1, settings.timingRuns);
+  QElapsedTimer timer;
+  const auto median = [&](const auto& fn) {
+    std::vector<double> samples;
+    for (int i = 0; i < runs; ++i)
+    {
+      timer.start();
+      fn();
+      samples.push_back(timer.nsecsElapsed() / 1e6);
+    }
+    std::nth_element(samples.begin(), samples.begin() + runs / 2, samples.end());
+    return samples[runs / 2];
+  };
+
+  backend.load(positions, colors);
+  report.buildMs = median([&] { backend.load(positions, colors); });
+  report.baselineBuildMs = baseline[QStringLiteral("build")].toDouble(-1.);
+  report.buildTimingOk = !regressed(report.buildMs, report.baselineBuildMs);
+  qDebug() << "[Regression]" << backend.name << "build" << report.buildMs
+           << "ms (baseline" << report.baselineBuildMs << ")"
+           << (report.buildTimingOk ? "timing ok" : "TIMING REGRESSION");
+
+  QJsonObject measuredTraces;
+  for (const Case& c : standardCases())
+  {
+    Result r;
+    r.name = c.name;
+
+    const QImage img = backend.render(c.camera, settings.pixelSize);
+    r.traceMs = median([&] { backend.render(c.camera, settings.pixelSize); });
+
+    const QString goldenPath = dir.filePath(c.name + QStringLiteral(".png"));
+    if (settings.updateReferences)
+    {
+      img.save(goldenPath);
+    }
+    else
+    {
+      const QImage golden(goldenPath);
+      if (golden.isNull())
+      {
+        qWarning() << "[Regression] missing golden image" << goldenPath;
+        r.imageOk = false;
+      }
+      else
+      {
+        r.diff = compareImages(golden, img, settings.channelTolerance);
+        const double pixels
+            = double(settings.pixelSize.width()) * settings.pixelSize.height();
+        r.imageOk = !r.diff.sizeMismatch
+                    && r.diff.mismatchedPixels
+                           <= qint64(settings.maxMismatchRatio * pixels);
+        if (!r.imageOk)
+          img.save(output.filePath(c.name + QStringLiteral(".failed.png")));
+      }
+
+      r.baselineTraceMs = baselineTraces[c.name].toDouble(-1.);
+      r.timingOk = !regressed(r.traceMs, r.baselineTraceMs);
+    }
+
+    measuredTraces[c.name] = r.traceMs;
+
+    qDebug() << "[Regression]" << backend.name << c.name
+             << (r.imageOk ? "image ok" : "IMAGE MISMATCH")
+             << (r.timingOk ? "timing ok" : "TIMING REGRESSION")
+             << "max error" << r.diff.maxChannelError << "mismatched"
+             << r.diff.mismatchedPixels << "trace" << r.traceMs << "ms (baseline"
+             << r.baselineTraceMs << ")";
+
+    report.cases.push_back(r);
+  }
+
+  const QJsonObject measured{
+      {QStringLiteral("machine"), machineId()},
+      {QStringLiteral("build"), report.buildMs},
+      {QStringLiteral("trace"), measuredTraces}};
+  writeJson(
+      output.filePath(QStringLiteral("timings.last.json")),
+      QJsonObject{{backend.name, measured}});
+
+  if (recording)
+  {
+    allBaselines[backend.name] = measured;
+    writeJson(timingsPath, allBaselines);
+  }
+
+  return report;
+}
+
+bool passed(const Report& report) noexcept
+{
+  if (report.cases.empty() || !report.buildTimingOk)
+    return false;
+  for (const auto& r : report.cases)
+    if (!r.imageOk || !r.timingOk)
+      return false;
+  return true;
+}
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QVector4D>
+
+#include <fulldome_voxel/Projection.hpp>
+
+#include <functional>
+#include <vector>
+
+namespace vkfrt::regression
+{
+// One fixed camera of the golden-image suite
+struct Case
+{
+  QString name;
+  CameraState camera;
+};
+
+// Perspective, plus fulldome at 110°, 180°, 210° and 300°
+std::vector<Case> standardCases();
+
+// Deterministic cloud used by the suite: the six checkered walls of a room
+// around the camera of the cases and a sphere in front of it, so that every
+// case sees geometry and depth discontinuities.
+void makeReferenceCloud(
+    std::vector<QVector4D>& positions,
+    std::vector<QVector4D>& colors);
+
+struct ImageDiff
+{
+  int maxChannelError{};
+  double meanChannelError{};
+  qint64 mismatchedPixels{};
+  bool sizeMismatch{};
+};
+
+// Compares two images, pixels count as mismatched when one channel differs
+// by more than channelTolerance
+ImageDiff
+compareImages(const QImage& reference, const QImage& image, int channelTolerance);
+
+// Something able to render the suite: the CPU reference tracer or a GPU
+// path. render() must only return once the image is complete, as it is
+// timed from the caller's side.
+struct Backend
+{
+  QString name;
+  std::function<void(const std::vector<QVector4D>&, const std::vector<QVector4D>&)>
+      load;
+  std::function<QImage(const CameraState&, QSize)> render;
+
+  bool isValid() const noexcept { return load && render; }
+};
+
+// threadCount: see ReferenceTracer::setThreadCount
+Backend referenceBackend(int threadCount = 0);
+
+struct Settings
+{
+  // Contains <case>.png golden images and timings.json
+  QString referenceDirectory;
+  // Receives timings.last.json and the <case>.failed.png images;
+  // referenceDirectory when empty
+  QString outputDirectory;
+  QSize pixelSize{512, 512};
+
+  int channelTolerance{2};
+  // fraction of the pixels allowed over the channel tolerance
+  double maxMismatchRatio{0.001};
+
+  // timings are the median of timingRuns measurements, taken after an
+  // untimed load and render of each case
+  int timingRuns{5};
+  // a timing regresses when it exceeds baseline * timingThreshold, 0 only
+  // reports them. Wall-clock times only compare on one machine: baselines
+  // recorded elsewhere (see machineId) are reported, never enforced.
+  double timingThreshold{0.};
+
+  // Write the rendered images and timings as the new references
+  bool updateReferences{false};
+  // Only record the timings of this machine as the new baseline
+  bool updateTimings{false};
+};
+
+struct Result
+{
+  QString name;
+  ImageDiff diff;
+  double traceMs{};
+  double baselineTraceMs{-1.};
+  bool imageOk{true};
+  bool timingOk{true};
+};
+
+// The build of the scene is timed once per backend, the trace per case
+struct Report
+{
+  double buildMs{};
+  double baselineBuildMs{-1.};
+  bool buildTimingOk{true};
+  // the baseline was recorded on this machine and the threshold enforced
+  bool timingsChecked{false};
+  std::vector<Result> cases;
+};
+
+// Host, CPU architecture and thread count, stored with the timings
+QString machineId();
+
+// Renders every case, compares against the golden images and checks the
+// timings against the baseline. The measured timings are always written to
+// timings.last.json in the output directory. No cases when the directories
+// cannot be used.
+Report run(const Settings& settings, const Backend& backend);
+
+bool passed(const Report& report) noexcept;
+}
@@ -0,0 +1,87 @@
+// primary rays of the views traced directly, shared by the two trace
+// backends: raygen.rgen (ray tracing pipeline) and trace.comp (ray query).
+// Both use the descriptor set layout of VkRtPipeline.
+
+// camera-space ray directions, one layer per view
+#define RAY_DIRECTIONS_BINDING 5
+#include "projection.glsl"
+
+layout(binding = 0) uniform accelerationStructureEXT topLevelAS;
+// one layer per view
+layout(binding = 1, OUTPUT_FORMAT) uniform image2DArray image;
+
+layout(binding = 2) uniform CameraProperties {
+    Camera cams[MAX_VIEWS];
+};
+
+// hit distance per pixel, written in temporal mode for the reprojection
+layout(binding = 4, r32f) uniform image2DArray depthImage;
+
+// launches may cover a tile of the image, see VkRtPipeline::TilePushConstants
+layout(push_constant) uniform Tile {
+    ivec2 tileOffset;
+};
+
+#define PRIMARY_TMIN 0.001
+
+// color of the rays that miss, as in miss.rmiss
+#define BACKGROUND_COLOR vec3(0.1)
+
+// world-space ray of a pixel; false when the pixel is not traced by this
+// launch (written already, or left to the compute passes)
+bool primaryRay(uint view, ivec2 pos, out vec3 origin, out vec3 direction)
+{
+    const Camera cam = cams[view];
+    const ivec2 size = imageSize(image).xy;
+    if(any(greaterThanEqual(pos, size)))
+        return false;
+    const vec2 inUV = pixelUV(pos, size);
+
+    // cubemap modes are resampled by cubemap_resample.comp
+    if(usesCubemap(cam))
+        return false;
+
+    // outside of the dome disc: no ray, transparent pixel
+    if(outsideDomeDisc(cam, inUV, size))
+    {
+        imageStore(image, ivec3(pos, view), vec4(0.0));
+        return false;
+    }
+
+    // foveated fulldome or progressive refinement: pixels off the lattice
+    // are filled by foveation_fill.comp, the coarser ones are already done
+    const int foveation = foveationStride(cam, view, pos, size);
+    if(!isTraced(cam, pos, foveation) || tracedEarlier(cam, pos, foveation))
+        return false;
+
+    // temporal mode: the other pixels are reprojected by temporal_resolve.comp
+    if(!tracedThisFrame(cam, pos))
+        return false;
+
+    vec3 cameraDirection;
+    if(featureEnabled(FEATURE_DIRECTION_LUT) && cam.directionLut != DIRECTIONS_NONE)
+    {
+        const vec4 lut = imageLoad(rayDirections, ivec3(pos, view));
+        if(lut.w == 0.0) // not covered by the projector
+        {
+            imageStore(image, ivec3(pos, view), vec4(0.0));
+            return false;
+        }
+        cameraDirection = normalize(lut.xyz);
+    }
+    else
+    {
+        cameraDirection = cameraRayDirection(cam, inUV, size);
+    }
+    origin = (cam.viewInverse * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+    direction = (cam.viewInverse * vec4(cameraDirection, 0.0)).xyz;
+    return true;
+}
+
+// rgb + hit distance of a traced pixel
+void storePrimaryHit(uint view, ivec2 pos, vec4 hit)
+{
+    imageStore(image, ivec3(pos, view), vec4(hit.rgb, 1.0));
+    if(featureEnabled(FEATURE_INTERLEAVE) && cams[view].interleave > 0)
+        imageStore(depthImage, ivec3(pos, view), vec4(hit.w));
+}
@@ -0,0 +1,266 @@
+// camera layout and projection code shared by the trace shaders and the
+// compute passes. The CPU twin lives in fulldome_voxel/Projection.hpp: both must be
+// kept in sync.
+
+// must match VkRayTracer::MAX_VIEWS
+#define MAX_VIEWS 8
+
+// projection modes, see vkfrt::ProjectionMode
+#define PROJECTION_PERSPECTIVE 0
+#define PROJECTION_FULLDOME 1
+#define PROJECTION_FULLDOME_CUBEMAP 2
+#define PROJECTION_EQUIRECT_CUBEMAP 3
+
+// storage format of the color images, one shader variant per
+// vkrt::ColorFormat is built with -DOUTPUT_FORMAT=...
+#ifndef OUTPUT_FORMAT
+#define OUTPUT_FORMAT rgba8
+#endif
+
+// hit distance of the rays that miss, also their tmax
+#define SKY_DEPTH 10000.0
+
+// trace specialization, see VkRtPipeline::Variant: the projection mode of
+// every view of the launch (-1 reads it per view) and the features they may
+// use; the compute passes keep the defaults. Ids 2 and 3 are the workgroup
+// size of trace.comp
+layout(constant_id = 0) const int SPECIALIZED_PROJECTION = -1;
+layout(constant_id = 1) const int ENABLED_FEATURES = 31;
+#define FEATURE_DOME_MASK 1
+#define FEATURE_FOVEATION 2
+#define FEATURE_INTERLEAVE 4
+#define FEATURE_REFINEMENT 8
+#define FEATURE_DIRECTION_LUT 16
+
+// where raygen gets the ray directions, see VkRayDirections::Mode
+#define DIRECTIONS_NONE 0
+#define DIRECTIONS_COMPUTED 1
+#define DIRECTIONS_CALIBRATED 2
+
+// side of the pixel blocks sharing a foveation rate, also the largest stride
+#define FOVEATION_BLOCK 8
+
+struct Camera {
+    mat4 projInverse;
+    mat4 viewInverse;
+    float fov;
+    int projectionMode;
+    int domeMask;
+    int foveation;
+    vec4 focusDirection;   // camera space, xyz
+    float fullRateAngle;   // degrees
+    float falloffAngle;    // degrees per halving of the ray density
+    int interleave;        // temporal mode: 0 off, else 1 pixel out of N traced per frame
+    int interleavePhase;   // which of the N subsets is traced this frame
+    int refinementStride;  // progressive refinement: lattice traced this frame, 1 when off
+    int refinedStride;     // lattice traced by the previous frames, 0 if none
+    int directionLut;      // DIRECTIONS_*: projection per pixel or lookup
+};
+
+int projectionMode(Camera cam)
+{
+    return SPECIALIZED_PROJECTION >= 0 ? SPECIALIZED_PROJECTION : cam.projectionMode;
+}
+
+bool featureEnabled(int feature)
+{
+    return (ENABLED_FEATURES & feature) != 0;
+}
+
+// pixel center in [0; 1]², as used for the primary rays
+vec2 pixelUV(ivec2 pixel, ivec2 size)
+{
+    return (vec2(pixel) + vec2(0.5)) / vec2(size);
+}
+
+// fisheye coordinates: centered, x scaled by the aspect ratio so that the
+// dome disc is the unit circle
+vec2 fisheyeCoords(vec2 inUV, ivec2 size)
+{
+    vec2 c = inUV * 2.0 - 1.0;
+    c.x *= float(size.x) / float(size.y);
+    return c;
+}
+
+// modes resampled from the cubemap instead of being traced directly
+bool usesCubemap(Camera cam)
+{
+    const int mode = projectionMode(cam);
+    return mode == PROJECTION_FULLDOME_CUBEMAP || mode == PROJECTION_EQUIRECT_CUBEMAP;
+}
+
+bool outsideDomeDisc(Camera cam, vec2 inUV, ivec2 size)
+{
+    if(!featureEnabled(FEATURE_DOME_MASK) || cam.domeMask == 0)
+        return false;
+    const int mode = projectionMode(cam);
+    if(mode != PROJECTION_FULLDOME && mode != PROJECTION_FULLDOME_CUBEMAP)
+        return false;
+    return length(fisheyeCoords(inUV, size)) > 1.0;
+}
+
+// camera-space direction of the primary ray going through inUV
+vec3 cameraRayDirection(Camera cam, vec2 inUV, ivec2 size)
+{
+    const int mode = projectionMode(cam);
+    if(mode == PROJECTION_PERSPECTIVE) // Standard Perspective Projection
+    {
+        vec2 d = inUV * 2.0 - 1.0;
+        vec4 target = cam.projInverse * vec4(d.x, d.y, 1.0, 1.0);
+        return normalize(target.xyz);
+    }
+    else if(mode == PROJECTION_EQUIRECT_CUBEMAP) // Equirectangular
+    {
+        // fov is the horizontal coverage, pixels are square in angle
+        vec2 d = inUV * 2.0 - 1.0;
+        float halfFov = radians(cam.fov / 2.0);
+        float lon = d.x * halfFov;
+        float lat = clamp(d.y * halfFov * float(size.y) / float(size.x), -radians(90.0), radians(90.0));
+        return normalize(vec3(cos(lat) * sin(lon), sin(lat), -cos(lat) * cos(lon)));
+    }
+    else // Fulldome (Fisheye) Projection
+    {
+        vec2 uv_centered = fisheyeCoords(inUV, size);
+
+        float r = length(uv_centered);
+        float theta = r * radians(cam.fov / 2.0);
+        float phi = atan(uv_centered.y, uv_centered.x);
+
+        vec3 viewDir;
+        viewDir.x = sin(theta) * cos(phi);
+        viewDir.y = sin(theta) * sin(phi);
+        viewDir.z = -cos(theta);
+        return normalize(viewDir);
+    }
+}
+
+// camera-space ray directions (w: covered), see VkRayDirections. Declared
+// by the shaders defining its binding, for foveationStride
+#ifdef RAY_DIRECTIONS_BINDING
+layout(binding = RAY_DIRECTIONS_BINDING, rgba16f) uniform readonly image2DArray rayDirections;
+#endif
+
+// distance between traced pixels around this one: 1 near the focus
+// direction, doubling every falloffAngle past fullRateAngle. The rate is
+// constant over FOVEATION_BLOCK² blocks so that each block holds a full
+// lattice of traced pixels. The direction of the block comes from the
+// lookup when the view has one, so that it follows the calibration map.
+int foveationStride(Camera cam, uint view, ivec2 pixel, ivec2 size)
+{
+    if(!featureEnabled(FEATURE_FOVEATION) || cam.foveation == 0 || projectionMode(cam) != PROJECTION_FULLDOME)
+        return 1;
+
+    ivec2 blockCenter = (pixel / FOVEATION_BLOCK) * FOVEATION_BLOCK + FOVEATION_BLOCK / 2;
+    blockCenter = min(blockCenter, size - 1);
+
+    vec3 dir;
+#ifdef RAY_DIRECTIONS_BINDING
+    if(featureEnabled(FEATURE_DIRECTION_LUT) && cam.directionLut != DIRECTIONS_NONE)
+    {
+        const vec4 lut = imageLoad(rayDirections, ivec3(blockCenter, view));
+        if(lut.w == 0.0) // edge of the projector: every covered pixel is traced
+            return 1;
+        dir = normalize(lut.xyz);
+    }
+    else
+#endif
+    {
+        dir = cameraRayDirection(cam, pixelUV(blockCenter, size), size);
+    }
+    float angle = degrees(acos(clamp(dot(dir, normalize(cam.focusDirection.xyz)), -1.0, 1.0)));
+    if(angle <= cam.fullRateAngle)
+        return 1;
+
+    int level = 1 + int((angle - cam.fullRateAngle) / max(cam.falloffAngle, 0.001));
+    return FOVEATION_BLOCK >> max(3 - level, 0);
+}
+
+// distance between the pixels traced so far around this one: foveation,
+// the foveationStride of the pixel, or the coarse lattice of a progressive
+// refinement
+int traceStride(Camera cam, int foveation)
+{
+    if(!featureEnabled(FEATURE_REFINEMENT))
+        return foveation;
+    return max(foveation, cam.refinementStride);
+}
+
+bool isTraced(Camera cam, ivec2 pixel, int foveation)
+{
+    int stride = traceStride(cam, foveation);
+    return pixel.x % stride == 0 && pixel.y % stride == 0;
+}
+
+// progressive refinement: pixels of the coarser lattices were traced by
+// the previous frames and kept in the output
+bool tracedEarlier(Camera cam, ivec2 pixel, int foveation)
+{
+    if(!featureEnabled(FEATURE_REFINEMENT) || cam.refinedStride == 0)
+        return false;
+    int stride = max(foveation, cam.refinedStride);
+    return pixel.x % stride == 0 && pixel.y % stride == 0;
+}
+
+// temporal interleave: checkerboard for 1/2, one pixel of each 2x2 block
+// (diagonals first) for 1/4; the others are reprojected from the history
+bool tracedThisFrame(Camera cam, ivec2 pixel)
+{
+    if(!featureEnabled(FEATURE_INTERLEAVE) || cam.interleave <= 1)
+        return true;
+    if(cam.interleave == 2)
+        return ((pixel.x + pixel.y + cam.interleavePhase) & 1) == 0;
+
+    const int order[4] = int[4](0, 3, 1, 2);
+    return (pixel.x & 1) + 2 * (pixel.y & 1) == order[cam.interleavePhase & 3];
+}
+
+vec3 cameraOrigin(Camera cam)
+{
+    return cam.viewInverse[3].xyz;
+}
+
+vec3 worldRayDirection(Camera cam, vec2 inUV, ivec2 size)
+{
+    return mat3(cam.viewInverse) * cameraRayDirection(cam, inUV, size);
+}
+
+// inverse of cameraRayDirection; false when the direction is not seen by
+// the camera
+bool cameraDirectionToUV(Camera cam, vec3 dir, ivec2 size, out vec2 inUV)
+{
+    dir = normalize(dir);
+    const float aspect = float(size.x) / float(size.y);
+    vec2 d;
+    const int mode = projectionMode(cam);
+    if(mode == PROJECTION_PERSPECTIVE)
+    {
+        if(dir.z >= 0.0)
+            return false;
+        // QMatrix4x4::perspective
+        const float cotan = 1.0 / tan(radians(cam.fov / 2.0));
+        d = vec2(cotan / aspect * dir.x, cotan * dir.y) / -dir.z;
+    }
+    else if(mode == PROJECTION_EQUIRECT_CUBEMAP)
+    {
+        const float halfFov = radians(cam.fov / 2.0);
+        const float lon = atan(dir.x, -dir.z);
+        const float lat = asin(clamp(dir.y, -1.0, 1.0));
+        d = vec2(lon / halfFov, lat / (halfFov / aspect));
+    }
+    else
+    {
+        const float theta = acos(clamp(-dir.z, -1.0, 1.0));
+        const float phi = atan(dir.y, dir.x);
+        const vec2 c = theta / radians(cam.fov / 2.0) * vec2(cos(phi), sin(phi));
+        d = vec2(c.x / aspect, c.y);
+    }
+
+    inUV = d * 0.5 + 0.5;
+    return all(greaterThanEqual(inUV, vec2(0.0))) && all(lessThanEqual(inUV, vec2(1.0)));
+}
+
+bool worldDirectionToUV(Camera cam, vec3 dir, ivec2 size, out vec2 inUV)
+{
+    // view matrices are rigid: the inverse rotation is the transpose
+    return cameraDirectionToUV(cam, transpose(mat3(cam.viewInverse)) * dir, size, inUV);
+}
@@ -0,0 +1,134 @@
+#include "vk_buffer.hpp"
+
+#include <QDebug>
+
+#include <climits>
+#include <cstring>
+
+namespace vkrt
+{
+// ------------------------------------------------------------
+// buffer helpers (as / host-visible / update / free / address)
+// ------------------------------------------------------------
+Buffer createASBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, VkDeviceSize size)
+{
+    // usage = storage buffer or acceleration structure storage
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VkBuffer buf = VK_NULL_HANDLE;
+    df->vkCreateBuffer(dev, &bufferCreateInfo, nullptr, &buf);
+
+    VkMemoryRequirements memReq = {};
+    df->vkGetBufferMemoryRequirements(dev, buf, &memReq);
+
+    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {};
+    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
+    memoryAllocateInfo.allocationSize = memReq.size;
+
+    quint32 memIndex = UINT_MAX;
+    VkPhysicalDeviceMemoryProperties physDevMemProps;
+    f->vkGetPhysicalDeviceMemoryProperties(physDev, &physDevMemProps);
+    for (uint32_t i = 0; i < physDevMemProps.memoryTypeCount; ++i) {
+        if (!(memReq.memoryTypeBits & (1 << i))) continue;
+        if (physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+            memIndex = i;
+            break;
+        }
+    }
+    if (memIndex == UINT_MAX)
+        qFatal("No suitable memory type");
+
+    memoryAllocateInfo.memoryTypeIndex = memIndex;
+
+    VkDeviceMemory bufMem = VK_NULL_HANDLE;
+    df->vkAllocateMemory(dev, &memoryAllocateInfo, nullptr, &bufMem);
+    df->vkBindBufferMemory(dev, buf, bufMem, 0);
+
+    Buffer result { buf, bufMem, 0, size };
+    result.addr = getBufferDeviceAddress(dev, f, result);
+    return result;
+}
+
+Buffer createHostVisibleBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, VkDeviceSize size)
+{
+    // usage = build-read-only / sbt / ubo / etc., mapped on host for uploads
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VkBuffer buf = VK_NULL_HANDLE;
+    df->vkCreateBuffer(dev, &bufferCreateInfo, nullptr, &buf);
+
+    VkMemoryRequirements memReq = {};
+    df->vkGetBufferMemoryRequirements(dev, buf, &memReq);
+
+    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {};
+    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
+    memoryAllocateInfo.allocationSize = memReq.size;
+
+    quint32 memIndex = UINT_MAX;
+    VkPhysicalDeviceMemoryProperties physDevMemProps;
+    f->vkGetPhysicalDeviceMemoryProperties(physDev, &physDevMemProps);
+    for (uint32_t i = 0; i < physDevMemProps.memoryTypeCount; ++i) {
+        if (!(memReq.memoryTypeBits & (1 << i))) continue;
+        if ((physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+            (physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        {
+            memIndex = i;
+            break;
+        }
+    }
+    if (memIndex == UINT_MAX)
+        qFatal("No suitable memory type");
+
+    memoryAllocateInfo.memoryTypeIndex = memIndex;
+
+    VkDeviceMemory bufMem = VK_NULL_HANDLE;
+    auto res = df->vkAllocateMemory(dev, &memoryAllocateInfo, nullptr, &bufMem);
+    Q_ASSERT(res == VK_SUCCESS);
+    df->vkBindBufferMemory(dev, buf, bufMem, 0);
+
+    Buffer result { buf, bufMem, 0, size };
+    result.addr = getBufferDeviceAddress(dev, f, result);
+    return result;
+}
+
+void updateHostData(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df, const void *data, size_t dataLen)
+{
+    // note: assumes b.size >= dataLen
+    void *p = nullptr;
+    df->vkMapMemory(dev, b.mem, 0, b.size, 0, &p);
+    memcpy(p, data, dataLen);
+    df->vkUnmapMemory(dev, b.mem);
+}
+
+void freeBuffer(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df)
+{
+    // release buffer + memory
+    df->vkDestroyBuffer(dev, b.buf, nullptr);
+    df->vkFreeMemory(dev, b.mem, nullptr);
+}
+
+VkDeviceAddress getBufferDeviceAddress(VkDevice dev, QVulkanFunctions *f, const Buffer &b)
+{
+    VkBufferDeviceAddressInfoKHR info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    info.buffer = b.buf;
+    const auto vkGetBufferDeviceAddressKHR = reinterpret_cast<PFN_vkGetBufferDeviceAddressKHR>(f->vkGetDeviceProcAddr(dev, "vkGetBufferDeviceAddressKHR"));
+    return vkGetBufferDeviceAddressKHR(dev, &info);
+}
+}
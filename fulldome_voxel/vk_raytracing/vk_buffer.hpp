@@ -0,0 +1,27 @@
+#ifndef VK_BUFFER_H
+#define VK_BUFFER_H
+
+#include <QVulkanFunctions>
+
+// ------------------------------------------------------------
+// buffer helpers shared by the ray tracer, its pipeline and passes
+// ------------------------------------------------------------
+namespace vkrt
+{
+struct Buffer {
+    VkBuffer buf = VK_NULL_HANDLE;
+    VkDeviceMemory mem = VK_NULL_HANDLE;
+    VkDeviceAddress addr = 0;
+    VkDeviceSize size = 0;
+};
+
+// device-local buffer (acceleration structures, scratch, storage)
+Buffer createASBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, VkDeviceSize size);
+// host-visible + coherent buffer (build inputs, sbt, ubos)
+Buffer createHostVisibleBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, VkDeviceSize size);
+void updateHostData(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df, const void *data, size_t dataLen);
+void freeBuffer(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df);
+VkDeviceAddress getBufferDeviceAddress(VkDevice dev, QVulkanFunctions *f, const Buffer &b);
+}
+
+#endif
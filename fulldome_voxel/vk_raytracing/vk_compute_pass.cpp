@@ -0,0 +1,165 @@
+#include "vk_compute_pass.hpp"
+
+#include <QDebug>
+#include <QFile>
+
+#include <map>
+
+// ------------------------------------------------------------
+// layout, pipeline and descriptor sets, all created up front
+// ------------------------------------------------------------
+VkComputePass::VkComputePass(VkDevice dev, QVulkanDeviceFunctions *df, VkPipelineCache cache,
+                             const QString &shaderPath,
+                             const std::vector<VkDescriptorType> &bindings,
+                             uint32_t pushConstantSize,
+                             uint32_t setCount)
+    : m_dev(dev)
+    , m_df(df)
+    , m_bindings(bindings)
+    , m_pushConstantSize(pushConstantSize)
+{
+    // descriptor set layout: binding i has type bindings[i]
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings.size());
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = bindings[i];
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descSetLayoutInfo = {};
+    descSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descSetLayoutInfo.bindingCount = uint32_t(layoutBindings.size());
+    descSetLayoutInfo.pBindings = layoutBindings.data();
+    df->vkCreateDescriptorSetLayout(dev, &descSetLayoutInfo, nullptr, &m_descSetLayout);
+
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+    df->vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &m_pipelineLayout);
+
+    // shader + pipeline
+    QFile f(shaderPath);
+    if (!f.open(QIODevice::ReadOnly))
+        qFatal("Failed to open %s", qPrintable(shaderPath));
+    const QByteArray code = f.readAll();
+
+    VkShaderModuleCreateInfo shaderInfo = {};
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = code.size();
+    shaderInfo.pCode = reinterpret_cast<const quint32 *>(code.constData());
+    VkShaderModule module = VK_NULL_HANDLE;
+    df->vkCreateShaderModule(dev, &shaderInfo, nullptr, &module);
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_pipelineLayout;
+    if (df->vkCreateComputePipelines(dev, cache, 1, &pipelineInfo, nullptr, &m_pipeline) != VK_SUCCESS)
+        qWarning() << "[ComputePass] failed to create pipeline for" << shaderPath;
+
+    df->vkDestroyShaderModule(dev, module, nullptr);
+
+    // descriptor pool sized for setCount copies of the layout
+    std::map<VkDescriptorType, uint32_t> typeCounts;
+    for (VkDescriptorType type : bindings)
+        typeCounts[type] += setCount;
+
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const auto &[type, count] : typeCounts)
+        poolSizes.push_back({ type, count });
+
+    VkDescriptorPoolCreateInfo poolCreateInfo = {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.maxSets = setCount;
+    poolCreateInfo.poolSizeCount = uint32_t(poolSizes.size());
+    poolCreateInfo.pPoolSizes = poolSizes.data();
+    df->vkCreateDescriptorPool(dev, &poolCreateInfo, nullptr, &m_descPool);
+
+    m_descSets.resize(setCount);
+    std::vector<VkDescriptorSetLayout> layouts(setCount, m_descSetLayout);
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {};
+    descSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descSetAllocInfo.descriptorPool = m_descPool;
+    descSetAllocInfo.descriptorSetCount = setCount;
+    descSetAllocInfo.pSetLayouts = layouts.data();
+    df->vkAllocateDescriptorSets(dev, &descSetAllocInfo, m_descSets.data());
+}
+
+VkComputePass::~VkComputePass()
+{
+    // descriptor sets are freed with their pool
+    m_df->vkDestroyDescriptorPool(m_dev, m_descPool, nullptr);
+    m_df->vkDestroyPipeline(m_dev, m_pipeline, nullptr);
+    m_df->vkDestroyPipelineLayout(m_dev, m_pipelineLayout, nullptr);
+    m_df->vkDestroyDescriptorSetLayout(m_dev, m_descSetLayout, nullptr);
+}
+
+// ------------------------------------------------------------
+// descriptor updates; the set must not be in use by the gpu
+// ------------------------------------------------------------
+void VkComputePass::writeImage(uint32_t set, uint32_t binding, VkImageView view,
+                               VkImageLayout layout, VkSampler sampler)
+{
+    Q_ASSERT(binding < m_bindings.size());
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = sampler;
+    imageInfo.imageView = view;
+    imageInfo.imageLayout = layout;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = m_descSets[set];
+    write.dstBinding = binding;
+    write.descriptorCount = 1;
+    write.descriptorType = m_bindings[binding];
+    write.pImageInfo = &imageInfo;
+    m_df->vkUpdateDescriptorSets(m_dev, 1, &write, 0, nullptr);
+}
+
+void VkComputePass::writeBuffer(uint32_t set, uint32_t binding, const vkrt::Buffer &buffer)
+{
+    Q_ASSERT(binding < m_bindings.size());
+
+    VkDescriptorBufferInfo bufferInfo = { buffer.buf, 0, VK_WHOLE_SIZE };
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = m_descSets[set];
+    write.dstBinding = binding;
+    write.descriptorCount = 1;
+    write.descriptorType = m_bindings[binding];
+    write.pBufferInfo = &bufferInfo;
+    m_df->vkUpdateDescriptorSets(m_dev, 1, &write, 0, nullptr);
+}
+
+// ------------------------------------------------------------
+// record the dispatch; barriers around it are up to the caller
+// ------------------------------------------------------------
+void VkComputePass::dispatch(VkCommandBuffer cb, uint32_t set,
+                             uint32_t width, uint32_t height, uint32_t depth,
+                             const void *pushConstants)
+{
+    m_df->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    m_df->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout,
+                                  0, 1, &m_descSets[set], 0, nullptr);
+    if (pushConstants && m_pushConstantSize > 0)
+        m_df->vkCmdPushConstants(cb, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                 0, m_pushConstantSize, pushConstants);
+
+    m_df->vkCmdDispatch(cb,
+                        (width + groupSize - 1) / groupSize,
+                        (height + groupSize - 1) / groupSize,
+                        depth);
+}
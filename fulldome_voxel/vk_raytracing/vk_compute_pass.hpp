@@ -0,0 +1,57 @@
+#ifndef VK_COMPUTE_PASS_H
+#define VK_COMPUTE_PASS_H
+
+#include <QString>
+#include <QVulkanFunctions>
+
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+
+#include <vector>
+
+// ------------------------------------------------------------
+// a compute shader with its own descriptor set layout, pipeline and one
+// descriptor set per frame slot. used for the post passes run after the
+// trace (upsampling, reprojection, ...).
+// ------------------------------------------------------------
+class VkComputePass
+{
+public:
+    // bindings[i] is the descriptor type of binding i
+    VkComputePass(VkDevice dev, QVulkanDeviceFunctions *df, VkPipelineCache cache,
+                  const QString &shaderPath,
+                  const std::vector<VkDescriptorType> &bindings,
+                  uint32_t pushConstantSize = 0,
+                  uint32_t setCount = 2);
+    VkComputePass(const VkComputePass&) = delete;
+    VkComputePass& operator=(const VkComputePass&) = delete;
+    ~VkComputePass();
+
+    void writeImage(uint32_t set, uint32_t binding, VkImageView view,
+                    VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL,
+                    VkSampler sampler = VK_NULL_HANDLE);
+    void writeBuffer(uint32_t set, uint32_t binding, const vkrt::Buffer &buffer);
+
+    // binds the pipeline and set, then dispatches enough groups to cover
+    // width x height x depth invocations
+    void dispatch(VkCommandBuffer cb, uint32_t set,
+                  uint32_t width, uint32_t height, uint32_t depth,
+                  const void *pushConstants = nullptr);
+
+    // local size of every compute shader of the project
+    static constexpr uint32_t groupSize = 8;
+
+private:
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanDeviceFunctions *m_df = nullptr;
+
+    std::vector<VkDescriptorType> m_bindings;
+    uint32_t m_pushConstantSize = 0;
+
+    VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool m_descPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> m_descSets;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "vk_gpu_timer.hpp"
+
+#include <QDebug>
+
+// ------------------------------------------------------------
+// query pool, unless the device cannot timestamp on every queue
+// ------------------------------------------------------------
+VkGpuTimer::VkGpuTimer(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                       uint32_t slotCount, uint32_t marksPerSlot)
+    : m_dev(dev)
+    , m_df(df)
+    , m_marksPerSlot(marksPerSlot)
+    , m_marks(slotCount, 0)
+{
+    VkPhysicalDeviceProperties props;
+    f->vkGetPhysicalDeviceProperties(physDev, &props);
+    if (!props.limits.timestampComputeAndGraphics) {
+        qWarning() << "[GpuTimer] timestamp queries not supported, gpu time is not measured";
+        return;
+    }
+    m_period = props.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = marksPerSlot * slotCount;
+    df->vkCreateQueryPool(dev, &poolInfo, nullptr, &m_pool);
+}
+
+VkGpuTimer::~VkGpuTimer()
+{
+    m_df->vkDestroyQueryPool(m_dev, m_pool, nullptr);
+}
+
+// ------------------------------------------------------------
+// results of the slot: the frame is complete once qrhi hands the slot
+// back, so this does not wait
+// ------------------------------------------------------------
+std::vector<double> VkGpuTimer::collectIntervals(uint32_t slot)
+{
+    const uint32_t marks = m_marks[slot];
+    if (!m_pool || marks < 2)
+        return {};
+
+    std::vector<quint64> ticks(marks);
+    const VkResult res = m_df->vkGetQueryPoolResults(m_dev, m_pool, slot * m_marksPerSlot, marks,
+                                                     ticks.size() * sizeof(quint64), ticks.data(),
+                                                     sizeof(quint64), VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS)
+        return {};
+
+    m_marks[slot] = 0;
+    std::vector<double> intervals(marks - 1);
+    for (uint32_t i = 0; i + 1 < marks; ++i)
+        intervals[i] = double(ticks[i + 1] - ticks[i]) * m_period / 1e6;
+    return intervals;
+}
+
+double VkGpuTimer::collect(uint32_t slot)
+{
+    const std::vector<double> intervals = collectIntervals(slot);
+    if (intervals.empty())
+        return -1.;
+
+    double total = 0.;
+    for (double ms : intervals)
+        total += ms;
+    return total;
+}
+
+void VkGpuTimer::begin(VkCommandBuffer cb, uint32_t slot)
+{
+    if (!m_pool)
+        return;
+
+    m_df->vkCmdResetQueryPool(cb, m_pool, slot * m_marksPerSlot, m_marksPerSlot);
+    m_df->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_pool, slot * m_marksPerSlot);
+    m_marks[slot] = 1;
+}
+
+void VkGpuTimer::mark(VkCommandBuffer cb, uint32_t slot)
+{
+    if (!m_pool || m_marks[slot] == 0 || m_marks[slot] >= m_marksPerSlot)
+        return;
+
+    m_df->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_pool, slot * m_marksPerSlot + m_marks[slot]);
+    ++m_marks[slot];
+}
@@ -0,0 +1,52 @@
+#ifndef VK_GPU_TIMER_H
+#define VK_GPU_TIMER_H
+
+#include <QVulkanFunctions>
+
+#include <vector>
+
+// ------------------------------------------------------------
+// gpu time between points of a command buffer, measured with timestamp
+// queries: up to marksPerSlot timestamps per frame slot, read back when
+// the slot comes back
+// ------------------------------------------------------------
+class VkGpuTimer
+{
+public:
+    VkGpuTimer(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+               uint32_t slotCount = 2, uint32_t marksPerSlot = 2);
+    VkGpuTimer(const VkGpuTimer&) = delete;
+    VkGpuTimer& operator=(const VkGpuTimer&) = delete;
+    ~VkGpuTimer();
+
+    bool isSupported() const noexcept { return m_pool != VK_NULL_HANDLE; }
+    uint32_t marksPerSlot() const noexcept { return m_marksPerSlot; }
+
+    // milliseconds between the first and last marks of the last frame
+    // recorded in this slot, or a negative value when there is none (not
+    // recorded, not supported)
+    double collect(uint32_t slot);
+    // milliseconds between each pair of consecutive marks, empty when
+    // there is none
+    std::vector<double> collectIntervals(uint32_t slot);
+
+    // resets the slot and marks the start of the recorded commands
+    void begin(VkCommandBuffer cb, uint32_t slot);
+    // timestamp once the commands recorded so far have completed; ignored
+    // past marksPerSlot
+    void mark(VkCommandBuffer cb, uint32_t slot);
+    void end(VkCommandBuffer cb, uint32_t slot) { mark(cb, slot); }
+
+private:
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanDeviceFunctions *m_df = nullptr;
+
+    VkQueryPool m_pool = VK_NULL_HANDLE;
+    uint32_t m_marksPerSlot = 2;
+    // nanoseconds per timestamp tick
+    double m_period = 1.;
+    // marks recorded by the last frame of each slot
+    std::vector<uint32_t> m_marks;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include "vk_image.hpp"
+
+#include <QDebug>
+
+#include <climits>
+
+namespace vkrt
+{
+// ------------------------------------------------------------
+// color formats
+// ------------------------------------------------------------
+VkFormat vkFormat(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::RGB10A2:
+        return VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+    case ColorFormat::RGBA16F:
+        return VK_FORMAT_R16G16B16A16_SFLOAT;
+    case ColorFormat::RGBA8:
+    default:
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+const char *shaderVariant(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::RGB10A2:
+        return ".rgb10a2";
+    case ColorFormat::RGBA16F:
+        return ".rgba16f";
+    case ColorFormat::RGBA8:
+    default:
+        return "";
+    }
+}
+
+bool supportsColorFormat(VkPhysicalDevice physDev, QVulkanFunctions *f, ColorFormat format)
+{
+    VkFormatProperties props;
+    f->vkGetPhysicalDeviceFormatProperties(physDev, vkFormat(format), &props);
+    const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT
+                                      | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (props.optimalTilingFeatures & needed) == needed;
+}
+
+// ------------------------------------------------------------
+// image + memory + views
+// ------------------------------------------------------------
+Image createImage(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                  VkFormat format, QSize size, uint32_t layers, VkImageUsageFlags usage, bool cube)
+{
+    Q_ASSERT(!cube || layers == 6);
+
+    Image img;
+    img.format = format;
+    img.size = size;
+    img.layers = layers;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.flags = cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent.width = uint32_t(size.width());
+    imageInfo.extent.height = uint32_t(size.height());
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = layers;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    df->vkCreateImage(dev, &imageInfo, nullptr, &img.image);
+
+    VkMemoryRequirements memReq;
+    df->vkGetImageMemoryRequirements(dev, img.image, &memReq);
+
+    quint32 memIndex = UINT_MAX;
+    VkPhysicalDeviceMemoryProperties physDevMemProps;
+    f->vkGetPhysicalDeviceMemoryProperties(physDev, &physDevMemProps);
+    for (uint32_t i = 0; i < physDevMemProps.memoryTypeCount; ++i) {
+        if (!(memReq.memoryTypeBits & (1 << i))) continue;
+        if (physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+            memIndex = i;
+            break;
+        }
+    }
+    if (memIndex == UINT_MAX)
+        qFatal("No suitable memory type");
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memReq.size;
+    allocInfo.memoryTypeIndex = memIndex;
+    df->vkAllocateMemory(dev, &allocInfo, nullptr, &img.mem);
+    df->vkBindImageMemory(dev, img.image, img.mem, 0);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = img.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = layers;
+    df->vkCreateImageView(dev, &viewInfo, nullptr, &img.view);
+
+    if (cube) {
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+        df->vkCreateImageView(dev, &viewInfo, nullptr, &img.cubeView);
+    }
+
+    return img;
+}
+
+void freeImage(const Image &img, VkDevice dev, QVulkanDeviceFunctions *df)
+{
+    df->vkDestroyImageView(dev, img.cubeView, nullptr);
+    df->vkDestroyImageView(dev, img.view, nullptr);
+    df->vkDestroyImage(dev, img.image, nullptr);
+    df->vkFreeMemory(dev, img.mem, nullptr);
+}
+
+// ------------------------------------------------------------
+// barriers
+// ------------------------------------------------------------
+void transitionImage(QVulkanDeviceFunctions *df, VkCommandBuffer cb, VkImage image, uint32_t layers,
+                     VkImageLayout oldLayout, VkImageLayout newLayout,
+                     VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                     VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = layers;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+
+    df->vkCmdPipelineBarrier(cb, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void transitionImage(QVulkanDeviceFunctions *df, VkCommandBuffer cb, Image &img, VkImageLayout newLayout,
+                     VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                     VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+{
+    transitionImage(df, cb, img.image, img.layers, img.layout, newLayout, srcAccess, dstAccess, srcStage, dstStage);
+    img.layout = newLayout;
+}
+}
@@ -0,0 +1,57 @@
+#ifndef VK_IMAGE_H
+#define VK_IMAGE_H
+
+#include <QSize>
+#include <QVulkanFunctions>
+
+// ------------------------------------------------------------
+// image helpers for the intermediate targets owned by the tracer
+// (cubemap faces, history, ...)
+// ------------------------------------------------------------
+namespace vkrt
+{
+struct Image {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory mem = VK_NULL_HANDLE;
+    // 2D array view over every layer (storage / sampled access)
+    VkImageView view = VK_NULL_HANDLE;
+    // cube view, only for cube compatible images
+    VkImageView cubeView = VK_NULL_HANDLE;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    QSize size;
+    uint32_t layers = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+// format of the traced color images (output, cubemap, history...). The
+// shaders writing them are built once per format, see OUTPUT_FORMAT in
+// projection.glsl
+enum class ColorFormat {
+    RGBA8,
+    RGB10A2,
+    RGBA16F
+};
+
+VkFormat vkFormat(ColorFormat format);
+// suffix of the shader variants: raygen.rgen<suffix>.spv
+const char *shaderVariant(ColorFormat format);
+// storage writes and linear sampling are both needed
+bool supportsColorFormat(VkPhysicalDevice physDev, QVulkanFunctions *f, ColorFormat format);
+
+// device-local optimal image; cube requires 6 layers
+Image createImage(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                  VkFormat format, QSize size, uint32_t layers, VkImageUsageFlags usage, bool cube = false);
+void freeImage(const Image &img, VkDevice dev, QVulkanDeviceFunctions *df);
+
+// layout transition over every layer of the image
+void transitionImage(QVulkanDeviceFunctions *df, VkCommandBuffer cb, VkImage image, uint32_t layers,
+                     VkImageLayout oldLayout, VkImageLayout newLayout,
+                     VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                     VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
+// same, keeping track of the current layout
+void transitionImage(QVulkanDeviceFunctions *df, VkCommandBuffer cb, Image &img, VkImageLayout newLayout,
+                     VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                     VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include "vk_ray_directions.hpp"
+
+#include <fulldome_voxel/vk_raytracing/vk_rt_pipeline.hpp>
+
+#include <QDebug>
+#include <QFloat16>
+#include <QImage>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace vkrt;
+
+namespace
+{
+// rgba16f: 8 bytes per texel
+constexpr VkFormat directionFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+constexpr VkDeviceSize texelSize = 4 * sizeof(quint16);
+
+void appendTexel(std::vector<quint16> &out, const QVector3D &dir, float valid)
+{
+    const qfloat16 texel[4] = { qfloat16(dir.x()), qfloat16(dir.y()), qfloat16(dir.z()), qfloat16(valid) };
+    for (const qfloat16 &h : texel) {
+        quint16 bits;
+        memcpy(&bits, &h, sizeof(bits));
+        out.push_back(bits);
+    }
+}
+}
+
+VkRayDirections::Mode VkRayDirections::mode(const vkfrt::CameraState &cam)
+{
+    if (vkfrt::usesCubemap(cam.projectionMode))
+        return None;
+    if (!cam.calibrationMap.isEmpty())
+        return Calibrated;
+    // the fisheye mapping is the one with trigonometry per pixel
+    return cam.projectionMode == vkfrt::Fulldome ? Computed : None;
+}
+
+VkRayDirections::LayerKey VkRayDirections::layerKey(const vkfrt::CameraState &cam)
+{
+    LayerKey key;
+    key.mode = mode(cam);
+    if (key.mode == Computed) {
+        key.projectionMode = cam.projectionMode;
+        key.fov = cam.fov;
+        key.domeMask = cam.domeMask;
+    } else if (key.mode == Calibrated) {
+        key.calibrationMap = cam.calibrationMap;
+    }
+    return key;
+}
+
+VkRayDirections::VkRayDirections(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                                 VkPipelineCache cache, uint32_t setCount, uint32_t framesInFlight)
+    : m_physDev{physDev}
+    , m_dev{dev}
+    , m_f{f}
+    , m_df{df}
+    , m_framesInFlight{framesInFlight}
+{
+    m_compute = std::make_unique<VkComputePass>(
+        dev, df, cache, QStringLiteral(":/shaders/ray_directions.comp.spv"),
+        std::vector<VkDescriptorType>{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
+        0, setCount);
+    m_placeholder = createImage(physDev, dev, f, df, directionFormat, QSize(1, 1), 1, VK_IMAGE_USAGE_STORAGE_BIT);
+}
+
+VkRayDirections::~VkRayDirections()
+{
+    // the owner waited for the device
+    for (auto &retired : m_retiredImages)
+        freeImage(retired.first, m_dev, m_df);
+    for (auto &retired : m_retiredBuffers)
+        freeBuffer(retired.first, m_dev, m_df);
+    if (m_image.image)
+        freeImage(m_image, m_dev, m_df);
+    freeImage(m_placeholder, m_dev, m_df);
+}
+
+void VkRayDirections::retire(uint64_t frame)
+{
+    while (!m_retiredImages.empty() && frame - m_retiredImages.front().second > m_framesInFlight) {
+        freeImage(m_retiredImages.front().first, m_dev, m_df);
+        m_retiredImages.pop_front();
+    }
+    while (!m_retiredBuffers.empty() && frame - m_retiredBuffers.front().second > m_framesInFlight) {
+        freeBuffer(m_retiredBuffers.front().first, m_dev, m_df);
+        m_retiredBuffers.pop_front();
+    }
+}
+
+// ------------------------------------------------------------
+// one layer per view at the trace size, only while a view uses them
+// ------------------------------------------------------------
+bool VkRayDirections::ensure(const std::vector<vkfrt::CameraState> &cameras, const QSize &traceSize, uint64_t frame)
+{
+    retire(frame);
+
+    std::vector<LayerKey> layers;
+    bool used = false;
+    for (const vkfrt::CameraState &cam : cameras) {
+        layers.push_back(layerKey(cam));
+        used |= layers.back().mode != None;
+    }
+
+    const uint32_t layerCount = uint32_t(cameras.size());
+    const bool exists = m_image.image != VK_NULL_HANDLE;
+    const bool reallocate = exists != used
+                            || (used && (m_image.size != traceSize || m_image.layers != layerCount));
+
+    if (reallocate) {
+        if (exists)
+            m_retiredImages.emplace_back(m_image, frame);
+        m_image = {};
+        if (used)
+            m_image = createImage(m_physDev, m_dev, m_f, m_df, directionFormat, traceSize, layerCount,
+                                  VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        m_layers.assign(layerCount, LayerKey{});
+        m_dirtyLayers.assign(layerCount, true);
+    }
+
+    for (uint32_t i = 0; i < layerCount; ++i) {
+        if (m_layers[i] != layers[i]) {
+            m_layers[i] = layers[i];
+            m_dirtyLayers[i] = true;
+        }
+    }
+    return reallocate;
+}
+
+// ------------------------------------------------------------
+// rebuild of the changed layers: computed ones on the gpu, calibrated
+// ones resampled on the cpu and copied
+// ------------------------------------------------------------
+void VkRayDirections::record(VkCommandBuffer cb, uint32_t slot, const std::vector<vkfrt::CameraState> &cameras,
+                             const vkrt::Buffer &cameraBuffer, uint64_t frame)
+{
+    if (m_placeholder.layout != VK_IMAGE_LAYOUT_GENERAL)
+        transitionImage(m_df, cb, m_placeholder, VK_IMAGE_LAYOUT_GENERAL, 0, 0,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VkRtPipeline::traceStages);
+    if (!m_image.image)
+        return;
+
+    bool computed = false;
+    std::vector<uint32_t> calibrated;
+    for (uint32_t i = 0; i < m_dirtyLayers.size(); ++i) {
+        if (!m_dirtyLayers[i])
+            continue;
+        computed |= m_layers[i].mode == Computed;
+        if (m_layers[i].mode == Calibrated)
+            calibrated.push_back(i);
+        m_dirtyLayers[i] = false;
+    }
+    if (!computed && calibrated.empty())
+        return;
+
+    // previous frames may still read the directions
+    transitionImage(m_df, cb, m_image, VK_IMAGE_LAYOUT_GENERAL,
+                    VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VkRtPipeline::traceStages,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    // the shader skips the layers of the other modes; rewriting the
+    // unchanged computed ones is cheaper than a dispatch per layer
+    if (computed) {
+        m_compute->writeImage(slot, 0, m_image.view);
+        m_compute->writeBuffer(slot, 1, cameraBuffer);
+        m_compute->dispatch(cb, slot, m_image.size.width(), m_image.size.height(), m_image.layers);
+    }
+
+    if (!calibrated.empty()) {
+        const VkDeviceSize layerSize = VkDeviceSize(m_image.size.width()) * m_image.size.height() * texelSize;
+        std::vector<quint16> texels;
+        std::vector<VkBufferImageCopy> regions;
+        for (std::size_t i = 0; i < calibrated.size(); ++i) {
+            const std::vector<quint16> layer = calibratedLayer(cameras[calibrated[i]], m_image.size);
+            texels.insert(texels.end(), layer.begin(), layer.end());
+
+            VkBufferImageCopy region = {};
+            region.bufferOffset = i * layerSize;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.baseArrayLayer = calibrated[i];
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent = { uint32_t(m_image.size.width()), uint32_t(m_image.size.height()), 1 };
+            regions.push_back(region);
+        }
+
+        Buffer staging = createHostVisibleBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_physDev, m_dev, m_f, m_df,
+                                                 layerSize * calibrated.size());
+        updateHostData(staging, m_dev, m_df, texels.data(), texels.size() * sizeof(quint16));
+        m_df->vkCmdCopyBufferToImage(cb, staging.buf, m_image.image, VK_IMAGE_LAYOUT_GENERAL,
+                                     uint32_t(regions.size()), regions.data());
+        m_retiredBuffers.emplace_back(staging, frame);
+    }
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    m_df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VkRtPipeline::traceStages,
+                               0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// ------------------------------------------------------------
+// calibration maps: images readable by QImage (16 bit png or tiff for
+// precision), rgb = camera-space direction mapped from [-1; 1] to [0; 1],
+// alpha = 0 where the projector has no ray
+// ------------------------------------------------------------
+const VkRayDirections::CalibrationMap &VkRayDirections::calibrationMap(const QString &path)
+{
+    auto it = m_calibrationMaps.find(path);
+    if (it != m_calibrationMaps.end())
+        return it->second;
+
+    CalibrationMap map;
+    const QImage img = QImage(path).convertToFormat(QImage::Format_RGBA64);
+    if (img.isNull()) {
+        qWarning() << "cannot read calibration map" << path << ", using the analytic projection";
+    } else {
+        map.size = img.size();
+        map.texels.reserve(std::size_t(img.width()) * img.height());
+        for (int y = 0; y < img.height(); ++y) {
+            const QRgba64 *line = reinterpret_cast<const QRgba64 *>(img.constScanLine(y));
+            for (int x = 0; x < img.width(); ++x) {
+                const QRgba64 c = line[x];
+                map.texels.emplace_back(c.red() / 65535.f * 2.f - 1.f,
+                                        c.green() / 65535.f * 2.f - 1.f,
+                                        c.blue() / 65535.f * 2.f - 1.f,
+                                        c.alpha() >= 32768 ? 1.f : 0.f);
+            }
+        }
+        qDebug() << "calibration map" << path << map.size;
+    }
+    return m_calibrationMaps.emplace(path, std::move(map)).first->second;
+}
+
+std::vector<quint16> VkRayDirections::calibratedLayer(const vkfrt::CameraState &cam, const QSize &size)
+{
+    std::vector<quint16> out;
+    out.reserve(std::size_t(size.width()) * size.height() * 4);
+
+    const CalibrationMap &map = calibrationMap(cam.calibrationMap);
+    if (map.texels.empty()) {
+        // unreadable map: the analytic projection, through its cpu twin
+        vkfrt::CameraState analytic = cam;
+        analytic.calibrationMap.clear();
+        const QMatrix4x4 projInv = vkfrt::projectionMatrix(analytic, size).inverted();
+        const float aspect = float(size.width()) / size.height();
+        for (int y = 0; y < size.height(); ++y) {
+            for (int x = 0; x < size.width(); ++x) {
+                const QPointF uv((x + 0.5) / size.width(), (y + 0.5) / size.height());
+                const bool outside = vkfrt::outsideDomeDisc(analytic, uv, aspect);
+                appendTexel(out, vkfrt::viewRayDirection(analytic, projInv, uv, aspect), outside ? 0.f : 1.f);
+            }
+        }
+        return out;
+    }
+
+    // bilinear over the directions, nearest for the coverage
+    const int w = map.size.width();
+    const int h = map.size.height();
+    const auto texel = [&] (int x, int y) -> const QVector4D & {
+        return map.texels[std::size_t(std::clamp(y, 0, h - 1)) * w + std::clamp(x, 0, w - 1)];
+    };
+    for (int y = 0; y < size.height(); ++y) {
+        const float sy = (y + 0.5f) * h / size.height() - 0.5f;
+        const int y0 = int(std::floor(sy));
+        const float fy = sy - y0;
+        for (int x = 0; x < size.width(); ++x) {
+            const float sx = (x + 0.5f) * w / size.width() - 0.5f;
+            const int x0 = int(std::floor(sx));
+            const float fx = sx - x0;
+
+            const QVector4D d = (texel(x0, y0) * (1.f - fx) + texel(x0 + 1, y0) * fx) * (1.f - fy)
+                              + (texel(x0, y0 + 1) * (1.f - fx) + texel(x0 + 1, y0 + 1) * fx) * fy;
+            const float valid = texel(int(std::lround(sx)), int(std::lround(sy))).w();
+            appendTexel(out, d.toVector3D().normalized(), valid);
+        }
+    }
+    return out;
+}
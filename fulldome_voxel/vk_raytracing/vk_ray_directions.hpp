@@ -0,0 +1,104 @@
+#ifndef VK_RAY_DIRECTIONS_H
+#define VK_RAY_DIRECTIONS_H
+
+#include <QSize>
+#include <QString>
+#include <QVector4D>
+#include <QVulkanFunctions>
+
+#include <fulldome_voxel/Projection.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_compute_pass.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_image.hpp>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+// ------------------------------------------------------------
+// camera-space ray directions of the views traced directly, one layer per
+// view at the trace size (xyz direction, w 0 where the view has no ray).
+// raygen reads them instead of evaluating the projection per pixel.
+// fulldome views get them from ray_directions.comp when their projection
+// or the trace size changes; views with a calibration map get the map
+// resampled to the trace size and uploaded.
+// ------------------------------------------------------------
+class VkRayDirections
+{
+public:
+    // how a view gets its directions, written in its ubo entry
+    enum Mode : int32_t {
+        None = 0,
+        Computed = 1,
+        Calibrated = 2
+    };
+    static Mode mode(const vkfrt::CameraState &cam);
+
+    VkRayDirections(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                    VkPipelineCache cache, uint32_t setCount, uint32_t framesInFlight);
+    VkRayDirections(const VkRayDirections&) = delete;
+    VkRayDirections& operator=(const VkRayDirections&) = delete;
+    ~VkRayDirections();
+
+    // storage view over every layer; a placeholder while no view uses them
+    VkImageView view() const noexcept { return m_image.image ? m_image.view : m_placeholder.view; }
+
+    // (re)allocates the directions for these views; true when view()
+    // changed and descriptor sets must be rewritten. frame is the tracer
+    // frame counter, for freeing the replaced images.
+    bool ensure(const std::vector<vkfrt::CameraState> &cameras, const QSize &traceSize, uint64_t frame);
+
+    // records the rebuild of the layers whose view changed. cameraBuffer
+    // holds the ubo entries of this frame, as read by raygen.
+    void record(VkCommandBuffer cb, uint32_t slot, const std::vector<vkfrt::CameraState> &cameras,
+                const vkrt::Buffer &cameraBuffer, uint64_t frame);
+
+private:
+    // what a layer was built from
+    struct LayerKey {
+        Mode mode = None;
+        int projectionMode = 0;
+        float fov = 0.f;
+        bool domeMask = false;
+        QString calibrationMap;
+
+        bool operator==(const LayerKey &other) const noexcept
+        {
+            return mode == other.mode && projectionMode == other.projectionMode && fov == other.fov
+                   && domeMask == other.domeMask && calibrationMap == other.calibrationMap;
+        }
+        bool operator!=(const LayerKey &other) const noexcept { return !(*this == other); }
+    };
+    static LayerKey layerKey(const vkfrt::CameraState &cam);
+
+    // decoded map, empty when the file could not be read
+    struct CalibrationMap {
+        QSize size;
+        std::vector<QVector4D> texels;
+    };
+    const CalibrationMap &calibrationMap(const QString &path);
+    // directions of a calibrated view at the trace size, as half floats
+    std::vector<quint16> calibratedLayer(const vkfrt::CameraState &cam, const QSize &size);
+
+    void retire(uint64_t frame);
+
+    VkPhysicalDevice m_physDev = VK_NULL_HANDLE;
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanFunctions *m_f = nullptr;
+    QVulkanDeviceFunctions *m_df = nullptr;
+    uint32_t m_framesInFlight = 2;
+
+    std::unique_ptr<VkComputePass> m_compute;
+    vkrt::Image m_image;
+    vkrt::Image m_placeholder;
+    std::vector<LayerKey> m_layers;
+    // layers to rebuild by the next record()
+    std::vector<bool> m_dirtyLayers;
+
+    std::map<QString, CalibrationMap> m_calibrationMaps;
+    std::deque<std::pair<vkrt::Image, uint64_t>> m_retiredImages;
+    std::deque<std::pair<vkrt::Buffer, uint64_t>> m_retiredBuffers;
+};
+
+#endif
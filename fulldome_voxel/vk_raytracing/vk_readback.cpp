@@ -0,0 +1,268 @@
+#include "vk_readback.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <climits>
+#include <numeric>
+
+namespace
+{
+VkDeviceSize bytesPerPixel(vkrt::ColorFormat format)
+{
+    return format == vkrt::ColorFormat::RGBA16F ? 8 : 4;
+}
+}
+
+VkReadback::VkReadback(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                       uint32_t slotCount, uint32_t bufferCount, Consumer consumer)
+    : m_physDev(physDev)
+    , m_dev(dev)
+    , m_f(f)
+    , m_df(df)
+    , m_slots(slotCount)
+    , m_buffers(std::max(bufferCount, slotCount + 1))
+    , m_consumer(std::move(consumer))
+{
+    Q_ASSERT(m_consumer);
+    m_free.resize(m_buffers.size());
+    std::iota(m_free.begin(), m_free.end(), 0);
+    m_delivery = std::thread([this] { deliveryLoop(); });
+}
+
+VkReadback::~VkReadback()
+{
+    // the copies of the last frames are complete with the device idle
+    std::vector<uint32_t> slots(m_slots.size());
+    std::iota(slots.begin(), slots.end(), 0u);
+    std::sort(slots.begin(), slots.end(),
+              [this](uint32_t a, uint32_t b) { return m_slots[a].index < m_slots[b].index; });
+    for (uint32_t slot : slots)
+        collect(slot);
+
+    {
+        std::lock_guard lock{m_queueMutex};
+        m_quit = true;
+    }
+    m_queueCondition.notify_one();
+    m_delivery.join();
+
+    std::unique_lock lock{m_poolMutex};
+    m_poolCondition.wait(lock, [this] { return m_held == 0; });
+    for (Staging &s : m_buffers)
+        free(s);
+
+    if (const uint64_t dropped = m_dropped.load())
+        qDebug() << "[Readback]" << dropped << "of" << m_frameIndex << "frames dropped";
+}
+
+// ------------------------------------------------------------
+// host-visible buffers, cached when possible: the consumer reads them
+// with the cpu
+// ------------------------------------------------------------
+VkReadback::Staging VkReadback::allocate(VkDeviceSize size)
+{
+    Staging s;
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    m_df->vkCreateBuffer(m_dev, &bufferCreateInfo, nullptr, &s.buffer.buf);
+
+    VkMemoryRequirements memReq = {};
+    m_df->vkGetBufferMemoryRequirements(m_dev, s.buffer.buf, &memReq);
+
+    VkPhysicalDeviceMemoryProperties physDevMemProps;
+    m_f->vkGetPhysicalDeviceMemoryProperties(m_physDev, &physDevMemProps);
+    quint32 memIndex = UINT_MAX;
+    for (VkMemoryPropertyFlags wanted : {VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT),
+                                         VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)}) {
+        for (uint32_t i = 0; i < physDevMemProps.memoryTypeCount && memIndex == UINT_MAX; ++i) {
+            if (!(memReq.memoryTypeBits & (1 << i))) continue;
+            if ((physDevMemProps.memoryTypes[i].propertyFlags & wanted) == wanted)
+                memIndex = i;
+        }
+    }
+    if (memIndex == UINT_MAX)
+        qFatal("No suitable memory type");
+    s.coherent = physDevMemProps.memoryTypes[memIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.allocationSize = memReq.size;
+    memoryAllocateInfo.memoryTypeIndex = memIndex;
+    m_df->vkAllocateMemory(m_dev, &memoryAllocateInfo, nullptr, &s.buffer.mem);
+    m_df->vkBindBufferMemory(m_dev, s.buffer.buf, s.buffer.mem, 0);
+    s.buffer.size = size;
+
+    void *p = nullptr;
+    m_df->vkMapMemory(m_dev, s.buffer.mem, 0, VK_WHOLE_SIZE, 0, &p);
+    s.mapped = static_cast<uchar *>(p);
+    return s;
+}
+
+void VkReadback::free(Staging &s)
+{
+    if (!s.buffer.buf)
+        return;
+    m_df->vkUnmapMemory(m_dev, s.buffer.mem);
+    vkrt::freeBuffer(s.buffer, m_dev, m_df);
+    s = {};
+}
+
+int VkReadback::acquire(VkDeviceSize size)
+{
+    int staging = -1;
+    {
+        std::lock_guard lock{m_poolMutex};
+        if (m_free.empty())
+            return -1;
+        auto it = std::find_if(m_free.begin(), m_free.end(),
+                               [&](int i) { return m_buffers[i].buffer.size == size; });
+        if (it == m_free.end())
+            it = m_free.begin();
+        staging = *it;
+        m_free.erase(it);
+    }
+
+    // first use or new size: nothing else refers to a buffer off the free list
+    Staging &s = m_buffers[staging];
+    if (s.buffer.size != size) {
+        free(s);
+        s = allocate(size);
+    }
+    return staging;
+}
+
+void VkReadback::giveBack(int staging)
+{
+    {
+        std::lock_guard lock{m_poolMutex};
+        m_free.push_back(staging);
+        m_held--;
+    }
+    m_poolCondition.notify_all();
+}
+
+// ------------------------------------------------------------
+// last copy of the slot: complete once qrhi hands the slot back, so this
+// does not wait
+// ------------------------------------------------------------
+void VkReadback::collect(uint32_t slot)
+{
+    Pending &pending = m_slots[slot];
+    if (pending.staging < 0)
+        return;
+
+    const int staging = pending.staging;
+    const Staging &s = m_buffers[staging];
+    if (!s.coherent) {
+        VkMappedMemoryRange range = {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = s.buffer.mem;
+        range.size = VK_WHOLE_SIZE;
+        m_df->vkInvalidateMappedMemoryRanges(m_dev, 1, &range);
+    }
+
+    Frame frame;
+    frame.data = s.mapped;
+    frame.size = pending.size;
+    frame.bytesPerLine = qsizetype(pending.size.width() * bytesPerPixel(pending.format));
+    frame.format = pending.format;
+    frame.index = pending.index;
+    {
+        std::lock_guard lock{m_poolMutex};
+        m_held++;
+    }
+    frame.lease = std::shared_ptr<const void>(s.mapped, [this, staging](const void *) { giveBack(staging); });
+    pending = {};
+
+    {
+        std::lock_guard lock{m_queueMutex};
+        m_queue.push_back(std::move(frame));
+    }
+    m_queueCondition.notify_one();
+}
+
+void VkReadback::deliveryLoop()
+{
+    for (;;) {
+        Frame frame;
+        {
+            std::unique_lock lock{m_queueMutex};
+            m_queueCondition.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+            if (m_queue.empty())
+                return;
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_consumer(std::move(frame));
+    }
+}
+
+// ------------------------------------------------------------
+// per-frame: copy of the first layer into a free buffer, between barriers
+// restoring the layout the image was left in
+// ------------------------------------------------------------
+void VkReadback::record(VkCommandBuffer cb, uint32_t slot, VkImage image, VkImageLayout layout, const QSize &size,
+                        vkrt::ColorFormat format)
+{
+    Q_ASSERT(slot < m_slots.size());
+    collect(slot);
+
+    if (!image || layout == VK_IMAGE_LAYOUT_UNDEFINED || size.isEmpty())
+        return;
+
+    const uint64_t index = m_frameIndex++;
+    const VkDeviceSize bytes = VkDeviceSize(size.width()) * size.height() * bytesPerPixel(format);
+    const int staging = acquire(bytes);
+    if (staging < 0) {
+        // the consumer holds every buffer: it is too slow, not the renderer
+        if (m_dropped.fetch_add(1, std::memory_order_relaxed) % 60 == 0)
+            qWarning() << "[Readback] consumer behind, frame" << index << "dropped";
+        return;
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.oldLayout = layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    m_df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                   | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { uint32_t(size.width()), uint32_t(size.height()), 1 };
+    m_df->vkCmdCopyImageToBuffer(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_buffers[staging].buffer.buf,
+                                 1, &region);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = layout;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    VkBufferMemoryBarrier bufferBarrier = {};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = m_buffers[staging].buffer.buf;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+    m_df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                               0, 0, nullptr, 1, &bufferBarrier, 1, &barrier);
+
+    m_slots[slot] = { staging, size, format, index };
+}
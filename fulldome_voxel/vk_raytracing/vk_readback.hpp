@@ -0,0 +1,109 @@
+#ifndef VK_READBACK_H
+#define VK_READBACK_H
+
+#include <QSize>
+#include <QVulkanFunctions>
+
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_image.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ------------------------------------------------------------
+// copies of a rendered image back to host memory, without waiting on the
+// gpu: each frame copies the image into a host-visible buffer, which is
+// complete once qrhi hands its frame slot back, slotCount frames later.
+// The finished copies are passed in order to a consumer on a thread of
+// their own. A frame holds its buffer until the consumer drops every copy
+// of it; when every buffer is held the frame is not recorded and counted
+// as dropped, the rendering never waits for the consumer.
+// ------------------------------------------------------------
+class VkReadback
+{
+public:
+    struct Frame {
+        // rows of the image, tightly packed, valid while lease is held
+        const uchar *data = nullptr;
+        QSize size;
+        qsizetype bytesPerLine = 0;
+        vkrt::ColorFormat format = vkrt::ColorFormat::RGBA8;
+        // frames passed to record(), dropped ones included
+        uint64_t index = 0;
+        // the buffer goes back to the ring once the last copy is destroyed
+        std::shared_ptr<const void> lease;
+    };
+    using Consumer = std::function<void(Frame)>;
+
+    // bufferCount: copies either in flight or held by the consumer, at
+    // least slotCount + 1
+    VkReadback(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+               uint32_t slotCount, uint32_t bufferCount, Consumer consumer);
+    VkReadback(const VkReadback&) = delete;
+    VkReadback& operator=(const VkReadback&) = delete;
+    // the device must be idle: the copies in flight are delivered, then
+    // this waits for the consumer to release every frame
+    ~VkReadback();
+
+    // collects the copy of the last frame of the slot, then records the
+    // copy of the first layer of image, in layout after the trace
+    // (left in that layout)
+    void record(VkCommandBuffer cb, uint32_t slot, VkImage image, VkImageLayout layout, const QSize &size,
+                vkrt::ColorFormat format);
+
+    uint64_t droppedFrames() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Staging {
+        vkrt::Buffer buffer;
+        uchar *mapped = nullptr;
+        bool coherent = true;
+    };
+    // copy recorded by the last frame of a slot
+    struct Pending {
+        int staging = -1;
+        QSize size;
+        vkrt::ColorFormat format = vkrt::ColorFormat::RGBA8;
+        uint64_t index = 0;
+    };
+
+    Staging allocate(VkDeviceSize size);
+    void free(Staging &s);
+    // a free buffer of this size, -1 when every buffer is held
+    int acquire(VkDeviceSize size);
+    void giveBack(int staging);
+    void collect(uint32_t slot);
+    void deliveryLoop();
+
+    VkPhysicalDevice m_physDev = VK_NULL_HANDLE;
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanFunctions *m_f = nullptr;
+    QVulkanDeviceFunctions *m_df = nullptr;
+
+    std::vector<Pending> m_slots;
+    uint64_t m_frameIndex = 0;
+    std::atomic<uint64_t> m_dropped{0};
+
+    // buffers are allocated on first use and when the size changes; the
+    // free list is shared with the threads releasing frames
+    std::vector<Staging> m_buffers;
+    std::mutex m_poolMutex;
+    std::condition_variable m_poolCondition;
+    std::vector<int> m_free;
+    int m_held = 0;
+
+    Consumer m_consumer;
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueCondition;
+    std::deque<Frame> m_queue;
+    bool m_quit = false;
+    std::thread m_delivery;
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "vk_rt_culling.hpp"
+
+#include <fulldome_voxel/vk_raytracing/vk_voxel_raytracing.hpp>
+
+#include <QDebug>
+#include <QVector4D>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vkrt;
+
+namespace
+{
+constexpr float degrees = float(M_PI / 180.);
+
+// tlas rebuilt whenever the view moves: build speed over trace speed
+constexpr VkBuildAccelerationStructureFlagsKHR culledBuildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
+
+// what a camera sees, tested against the bounding sphere of each chunk
+struct ViewVolume {
+    QVector3D eye;
+    // cone: fisheyes, and perspectives widened by a margin
+    QVector3D axis;
+    float halfAngle = 0.f;
+    // frustum side planes, xyz inwards; the near and far planes do not
+    // bound the rays
+    bool frustum = false;
+    QVector4D planes[4];
+
+    bool sees(const QVector3D &center, float radius) const
+    {
+        if (frustum) {
+            for (const QVector4D &plane : planes) {
+                if (QVector3D::dotProduct(plane.toVector3D(), center) + plane.w() < -radius * plane.toVector3D().length())
+                    return false;
+            }
+            return true;
+        }
+
+        const QVector3D d = center - eye;
+        const float distance = d.length();
+        if (distance <= radius)
+            return true;
+        const float angle = std::acos(std::clamp(QVector3D::dotProduct(d, axis) / distance, -1.f, 1.f));
+        return angle <= halfAngle + std::asin(radius / distance);
+    }
+};
+
+// false when the camera sees every direction or has no analytic mapping
+bool viewVolume(const vkfrt::CameraState &cam, const QSize &traceSize, float marginDegrees, ViewVolume &volume)
+{
+    if (vkfrt::usesCubemap(cam.projectionMode) || !cam.calibrationMap.isEmpty())
+        return false;
+
+    const float aspect = float(traceSize.width()) / std::max(traceSize.height(), 1);
+    volume.eye = cam.position;
+    volume.axis = (cam.center - cam.position).normalized();
+
+    if (cam.projectionMode == vkfrt::Fulldome) {
+        // without the dome mask the image corners go past the dome edge
+        const float reach = cam.domeMask ? 1.f : std::sqrt(aspect * aspect + 1.f);
+        volume.halfAngle = (cam.fov / 2.f * reach + marginDegrees) * degrees;
+        return volume.halfAngle < float(M_PI);
+    }
+
+    if (marginDegrees > 0.f) {
+        // cone around the frustum corners
+        const float tanY = std::tan(cam.fov / 2.f * degrees);
+        const float tanX = tanY * aspect;
+        volume.halfAngle = std::atan(std::sqrt(tanX * tanX + tanY * tanY)) + marginDegrees * degrees;
+        return volume.halfAngle < float(M_PI);
+    }
+
+    const QMatrix4x4 clip = vkfrt::projectionMatrix(cam, traceSize) * vkfrt::viewMatrix(cam);
+    volume.frustum = true;
+    volume.planes[0] = clip.row(3) + clip.row(0);
+    volume.planes[1] = clip.row(3) - clip.row(0);
+    volume.planes[2] = clip.row(3) + clip.row(1);
+    volume.planes[3] = clip.row(3) - clip.row(1);
+    return true;
+}
+}
+
+VkRtCulling::VkRtCulling(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                         VkPipelineCache cache, uint32_t setCount, uint32_t framesInFlight)
+    : m_physDev{physDev}
+    , m_dev{dev}
+    , m_f{f}
+    , m_df{df}
+    , m_framesInFlight{framesInFlight}
+    , m_slots(setCount)
+{
+    vkGetAccelerationStructureBuildSizesKHR = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(f->vkGetDeviceProcAddr(dev, "vkGetAccelerationStructureBuildSizesKHR"));
+    vkCreateAccelerationStructureKHR = reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(f->vkGetDeviceProcAddr(dev, "vkCreateAccelerationStructureKHR"));
+    vkDestroyAccelerationStructureKHR = reinterpret_cast<PFN_vkDestroyAccelerationStructureKHR>(f->vkGetDeviceProcAddr(dev, "vkDestroyAccelerationStructureKHR"));
+    vkCmdBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(f->vkGetDeviceProcAddr(dev, "vkCmdBuildAccelerationStructuresKHR"));
+
+    m_instancePass = std::make_unique<VkComputePass>(
+        dev, df, cache, QStringLiteral(":/shaders/tlas_instances.comp.culled.spv"),
+        std::vector<VkDescriptorType>{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        sizeof(VkRtScene::InstanceParams), setCount);
+}
+
+VkRtCulling::~VkRtCulling()
+{
+    // the owner waited for the device
+    for (auto &retired : m_retired)
+        destroy(retired.first);
+    for (Slot &slot : m_slots)
+        destroy(slot);
+}
+
+void VkRtCulling::destroy(Slot &slot)
+{
+    if (slot.tlas)
+        vkDestroyAccelerationStructureKHR(m_dev, slot.tlas, nullptr);
+    for (const Buffer &b : { slot.chunkBuffer, slot.instanceBuffer, slot.tlasBuffer, slot.scratch }) {
+        if (b.buf)
+            freeBuffer(b, m_dev, m_df);
+    }
+    slot = {};
+}
+
+void VkRtCulling::retire(uint64_t frame)
+{
+    while (!m_retired.empty() && frame - m_retired.front().second > m_framesInFlight) {
+        destroy(m_retired.front().first);
+        m_retired.pop_front();
+    }
+}
+
+// ------------------------------------------------------------
+// chunks whose bounding sphere meets the volume of one of the cameras
+// ------------------------------------------------------------
+bool VkRtCulling::visibleChunks(const VkRtScene &scene, const std::vector<vkfrt::CameraState> &cameras,
+                                const QSize &traceSize, float marginDegrees, std::vector<uint32_t> &visible)
+{
+    visible.clear();
+    const auto &chunks = scene.chunks();
+    if (chunks.empty())
+        return false;
+
+    std::vector<ViewVolume> volumes(cameras.size());
+    for (std::size_t i = 0; i < cameras.size(); ++i) {
+        if (!viewVolume(cameras[i], traceSize, marginDegrees, volumes[i]))
+            return false;
+    }
+
+    // points are scaled into the scene and drawn as cubes
+    const float voxelRadius = VkRayTracer::voxelHalfExtent * std::sqrt(3.f);
+    for (uint32_t c = 0; c < uint32_t(chunks.size()); ++c) {
+        const QVector3D lo = chunks[c].lo * VkRayTracer::sceneScale;
+        const QVector3D hi = chunks[c].hi * VkRayTracer::sceneScale;
+        const QVector3D center = (lo + hi) * 0.5f;
+        const float radius = (hi - lo).length() * 0.5f + voxelRadius;
+        if (std::any_of(volumes.begin(), volumes.end(), [&] (const ViewVolume &v) { return v.sees(center, radius); }))
+            visible.push_back(c);
+    }
+    return true;
+}
+
+// ------------------------------------------------------------
+// buffers and tlas of a slot, grown by half to leave room for the next
+// views; the previous ones may still be traced by a frame in flight
+// ------------------------------------------------------------
+void VkRtCulling::reserve(Slot &slot, uint32_t instanceCount, uint64_t frame)
+{
+    if (slot.tlas && instanceCount <= slot.capacity)
+        return;
+
+    Slot grown;
+    grown.sceneGeneration = slot.sceneGeneration;
+    if (slot.tlas)
+        m_retired.emplace_back(std::move(slot), frame);
+    slot = std::move(grown);
+
+    const uint32_t chunkPoints = vkfrt::PointCloud::chunkPoints;
+    const uint32_t chunkCapacity = std::max<uint32_t>((instanceCount + instanceCount / 2) / chunkPoints, 1);
+    slot.capacity = chunkCapacity * chunkPoints;
+
+    slot.chunkBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                               m_physDev, m_dev, m_f, m_df, chunkCapacity * sizeof(uint32_t));
+    slot.instanceBuffer = createASBuffer(
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        m_physDev, m_dev, m_f, m_df, VkDeviceSize(slot.capacity) * sizeof(VkAccelerationStructureInstanceKHR));
+
+    VkAccelerationStructureGeometryKHR geometry = {};
+    geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo = {};
+    buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    buildInfo.flags = culledBuildFlags;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries = &geometry;
+
+    VkAccelerationStructureBuildSizesInfoKHR sizeInfo = {};
+    sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    vkGetAccelerationStructureBuildSizesKHR(m_dev, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                            &buildInfo, &slot.capacity, &sizeInfo);
+
+    slot.tlasBuffer = createASBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+                                     m_physDev, m_dev, m_f, m_df, sizeInfo.accelerationStructureSize);
+    slot.scratch = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                  m_physDev, m_dev, m_f, m_df, sizeInfo.buildScratchSize);
+
+    VkAccelerationStructureCreateInfoKHR createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    createInfo.buffer = slot.tlasBuffer.buf;
+    createInfo.size = sizeInfo.accelerationStructureSize;
+    createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    vkCreateAccelerationStructureKHR(m_dev, &createInfo, nullptr, &slot.tlas);
+
+    qDebug() << "[RayTracer] culled tlas for" << slot.capacity << "instances," << sizeInfo.accelerationStructureSize << "bytes";
+}
+
+// ------------------------------------------------------------
+// per-frame: cull, then rebuild the slot tlas when its chunks changed
+// ------------------------------------------------------------
+VkAccelerationStructureKHR VkRtCulling::record(VkCommandBuffer cb, uint32_t slotIndex,
+                                               const VkRtScene &scene, uint64_t sceneGeneration,
+                                               const std::vector<vkfrt::CameraState> &cameras, const QSize &traceSize,
+                                               float marginDegrees, uint64_t frame)
+{
+    retire(frame);
+
+    if (!visibleChunks(scene, cameras, traceSize, marginDegrees, m_visible)
+        || m_visible.size() == scene.chunks().size())
+        return scene.tlas();
+
+    Slot &slot = m_slots[slotIndex];
+    if (slot.tlas && slot.sceneGeneration == sceneGeneration && slot.chunks == m_visible)
+        return slot.tlas;
+
+    const uint32_t chunkPoints = vkfrt::PointCloud::chunkPoints;
+    const uint32_t instanceCount = uint32_t(m_visible.size()) * chunkPoints;
+    reserve(slot, instanceCount, frame);
+    slot.sceneGeneration = sceneGeneration;
+    slot.chunks = m_visible;
+
+    if (!m_visible.empty())
+        updateHostData(slot.chunkBuffer, m_dev, m_df, m_visible.data(), m_visible.size() * sizeof(uint32_t));
+    // the set of this slot is not in use anymore
+    m_instancePass->writeBuffer(slotIndex, 0, scene.positionBuffer());
+    m_instancePass->writeBuffer(slotIndex, 1, slot.instanceBuffer);
+    m_instancePass->writeBuffer(slotIndex, 2, slot.chunkBuffer);
+
+    // the blas may have been built just before, in this command buffer
+    {
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        m_df->vkCmdPipelineBarrier(cb,
+                                   VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                   VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                   0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    if (instanceCount > 0) {
+        const uint32_t rowLength = VkRtScene::instanceRowLength;
+        const VkRtScene::InstanceParams params{ scene.blasAddress(), uint32_t(scene.pointCount()), rowLength,
+                                                VkRayTracer::sceneScale, VkRayTracer::voxelHalfExtent,
+                                                chunkPoints, uint32_t(m_visible.size()) };
+        m_instancePass->dispatch(cb, slotIndex, rowLength, (instanceCount + rowLength - 1) / rowLength, 1, &params);
+
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        m_df->vkCmdPipelineBarrier(cb,
+                                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                   VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                   0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    VkAccelerationStructureGeometryKHR geometry = {};
+    geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    geometry.geometry.instances.data.deviceAddress = slot.instanceBuffer.addr;
+
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo = {};
+    buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    buildInfo.flags = culledBuildFlags;
+    buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildInfo.dstAccelerationStructure = slot.tlas;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries = &geometry;
+    buildInfo.scratchData.deviceAddress = slot.scratch.addr;
+
+    VkAccelerationStructureBuildRangeInfoKHR rangeInfo = {};
+    rangeInfo.primitiveCount = instanceCount;
+    const VkAccelerationStructureBuildRangeInfoKHR *rangeInfos = &rangeInfo;
+    vkCmdBuildAccelerationStructuresKHR(cb, 1, &buildInfo, &rangeInfos);
+
+    return slot.tlas;
+}
@@ -0,0 +1,83 @@
+#ifndef VK_RT_CULLING_H
+#define VK_RT_CULLING_H
+
+#include <QSize>
+#include <QVulkanFunctions>
+
+#include <fulldome_voxel/Projection.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_compute_pass.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_rt_scene.hpp>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+// ------------------------------------------------------------
+// visibility culling: chunks of the scene outside of every view (cone of
+// the fisheye, frustum of the perspective) are left out of a compact tlas
+// holding the instances of the visible chunks only, rebuilt for a frame
+// slot when its visible chunks change. the scene tlas is traced while
+// every chunk is visible or the views cannot be culled (cubemap modes,
+// calibration maps, full sphere fisheyes).
+// ------------------------------------------------------------
+class VkRtCulling
+{
+public:
+    VkRtCulling(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                VkPipelineCache cache, uint32_t setCount, uint32_t framesInFlight);
+    VkRtCulling(const VkRtCulling&) = delete;
+    VkRtCulling& operator=(const VkRtCulling&) = delete;
+    ~VkRtCulling();
+
+    // chunks seen by at least one of the cameras, in scene order; false
+    // when they cannot be culled. marginDegrees widens every view, for
+    // cameras moved after the culling (late latch).
+    static bool visibleChunks(const VkRtScene &scene, const std::vector<vkfrt::CameraState> &cameras,
+                              const QSize &traceSize, float marginDegrees, std::vector<uint32_t> &visible);
+
+    // tlas to trace in this slot, recording the build of the culled one
+    // when needed. sceneGeneration identifies the scene, frame is the
+    // tracer frame counter for freeing the replaced buffers.
+    VkAccelerationStructureKHR record(VkCommandBuffer cb, uint32_t slot,
+                                      const VkRtScene &scene, uint64_t sceneGeneration,
+                                      const std::vector<vkfrt::CameraState> &cameras, const QSize &traceSize,
+                                      float marginDegrees, uint64_t frame);
+
+private:
+    // culled tlas of a frame slot and the chunks it holds
+    struct Slot {
+        uint64_t sceneGeneration = 0;
+        std::vector<uint32_t> chunks;
+        // instances the buffers can hold, whole chunks
+        uint32_t capacity = 0;
+        vkrt::Buffer chunkBuffer;
+        vkrt::Buffer instanceBuffer;
+        vkrt::Buffer tlasBuffer;
+        vkrt::Buffer scratch;
+        VkAccelerationStructureKHR tlas = VK_NULL_HANDLE;
+    };
+
+    void reserve(Slot &slot, uint32_t instanceCount, uint64_t frame);
+    void destroy(Slot &slot);
+    void retire(uint64_t frame);
+
+    VkPhysicalDevice m_physDev = VK_NULL_HANDLE;
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanFunctions *m_f = nullptr;
+    QVulkanDeviceFunctions *m_df = nullptr;
+    uint32_t m_framesInFlight = 2;
+
+    PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR = nullptr;
+    PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR = nullptr;
+    PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR = nullptr;
+    PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR = nullptr;
+
+    // culled variant of tlas_instances.comp, one set per slot
+    std::unique_ptr<VkComputePass> m_instancePass;
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_visible;
+    std::deque<std::pair<Slot, uint64_t>> m_retired;
+};
+
+#endif
@@ -0,0 +1,454 @@
+#include "vk_rt_pipeline.hpp"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+template <class Int>
+inline Int aligned(Int v, Int byteAlign)
+{
+    return (v + byteAlign - 1) & ~(byteAlign - 1);
+}
+
+static const char entryPoint[] = "main";
+
+// ------------------------------------------------------------
+// helper to load spir-v and create shader stage info
+// (the module is owned by the caller and must be destroyed)
+// ------------------------------------------------------------
+static VkPipelineShaderStageCreateInfo getShader(const QString &name, VkShaderStageFlagBits stage, VkDevice dev, QVulkanDeviceFunctions *df)
+{
+    QFile f(name);
+    if (!f.open(QIODevice::ReadOnly))
+        qFatal("Failed to open %s", qPrintable(name));
+    const QByteArray data = f.readAll();
+
+    VkShaderModuleCreateInfo shaderInfo = {};
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = data.size();
+    shaderInfo.pCode = reinterpret_cast<const quint32 *>(data.constData());
+    VkShaderModule module;
+    df->vkCreateShaderModule(dev, &shaderInfo, nullptr, &module);
+
+    VkPipelineShaderStageCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage = stage;
+    info.module = module;
+    info.pName = entryPoint;
+
+    return info;
+}
+
+// ------------------------------------------------------------
+// one pipeline per device and color format, kept alive by the ray tracers
+// using it
+// ------------------------------------------------------------
+std::shared_ptr<VkRtPipeline> VkRtPipeline::forDevice(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                                                      vkrt::ColorFormat colorFormat)
+{
+    static std::mutex mutex;
+    static std::map<std::pair<VkDevice, vkrt::ColorFormat>, std::weak_ptr<VkRtPipeline>> pipelines;
+
+    std::lock_guard lock{mutex};
+    auto &slot = pipelines[{dev, colorFormat}];
+    if (auto existing = slot.lock())
+        return existing;
+
+    std::shared_ptr<VkRtPipeline> p{new VkRtPipeline{physDev, dev, f, df, colorFormat}};
+    slot = p;
+    return p;
+}
+
+// ------------------------------------------------------------
+// ray query support of the physical device
+// ------------------------------------------------------------
+bool VkRtPipeline::supportsRayQuery(VkPhysicalDevice physDev, QVulkanFunctions *f)
+{
+    uint32_t count = 0;
+    f->vkEnumerateDeviceExtensionProperties(physDev, nullptr, &count, nullptr);
+    std::vector<VkExtensionProperties> extensions(count);
+    f->vkEnumerateDeviceExtensionProperties(physDev, nullptr, &count, extensions.data());
+    const bool hasExtension = std::any_of(extensions.begin(), extensions.end(), [] (const VkExtensionProperties &ext) {
+        return strcmp(ext.extensionName, VK_KHR_RAY_QUERY_EXTENSION_NAME) == 0;
+    });
+    if (!hasExtension)
+        return false;
+
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures = {};
+    rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &rayQueryFeatures;
+    f->vkGetPhysicalDeviceFeatures2(physDev, &features2);
+    return rayQueryFeatures.rayQuery == VK_TRUE;
+}
+
+VkRtPipeline::VkRtPipeline(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                           vkrt::ColorFormat colorFormat)
+    : m_physDev{physDev}
+    , m_dev{dev}
+    , m_f{f}
+    , m_df{df}
+    , m_colorFormat{colorFormat}
+{
+    m_rtProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+    VkPhysicalDeviceProperties2 deviceProperties2 = {};
+    deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    deviceProperties2.pNext = &m_rtProps;
+    f->vkGetPhysicalDeviceProperties2(physDev, &deviceProperties2);
+
+    // cache content is only valid for the exact device + driver
+    const VkPhysicalDeviceProperties &props = deviceProperties2.properties;
+    const QByteArray uuid = QByteArray(reinterpret_cast<const char *>(props.pipelineCacheUUID), VK_UUID_SIZE).toHex();
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/vkfrt");
+    m_cacheFile = QStringLiteral("%1/pipeline-%2-%3-%4-%5%6.bin")
+                      .arg(dir)
+                      .arg(QString::fromLatin1(uuid))
+                      .arg(props.vendorID, 0, 16)
+                      .arg(props.deviceID, 0, 16)
+                      .arg(props.driverVersion, 0, 16)
+                      .arg(QLatin1String(vkrt::shaderVariant(colorFormat)));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    loadPipelineCache();
+    createLayouts();
+    // the generic variant handles any view, the others come on demand
+    program(Variant{});
+
+    qDebug() << "[TIMESTAMP] ray tracing pipeline ready in" << timer.elapsed() << "ms.";
+}
+
+VkRtPipeline::~VkRtPipeline()
+{
+    for (auto &[variant, program] : m_programs)
+    {
+        vkrt::freeBuffer(program.sbt, m_dev, m_df);
+        m_df->vkDestroyPipeline(m_dev, program.pipeline, nullptr);
+    }
+    m_df->vkDestroyPipelineLayout(m_dev, m_pipelineLayout, nullptr);
+    m_df->vkDestroyDescriptorSetLayout(m_dev, m_descSetLayout, nullptr);
+    m_df->vkDestroyPipelineCache(m_dev, m_pipelineCache, nullptr);
+}
+
+// ------------------------------------------------------------
+// pipeline cache persisted on disk
+// ------------------------------------------------------------
+void VkRtPipeline::loadPipelineCache()
+{
+    QByteArray data;
+    {
+        QFile file(m_cacheFile);
+        if (file.open(QIODevice::ReadOnly))
+            data = file.readAll();
+    }
+
+    // drivers are supposed to reject mismatching data, but some don't:
+    // check the VkPipelineCacheHeaderVersionOne ourselves
+    VkPhysicalDeviceProperties props;
+    m_f->vkGetPhysicalDeviceProperties(m_physDev, &props);
+    if (data.size() >= qsizetype(sizeof(VkPipelineCacheHeaderVersionOne)))
+    {
+        VkPipelineCacheHeaderVersionOne header;
+        memcpy(&header, data.constData(), sizeof(header));
+        if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+            || header.vendorID != props.vendorID
+            || header.deviceID != props.deviceID
+            || memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            qDebug() << "discarding stale pipeline cache" << m_cacheFile;
+            data.clear();
+        }
+    }
+    else
+    {
+        data.clear();
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.isEmpty() ? nullptr : data.constData();
+    if (m_df->vkCreatePipelineCache(m_dev, &cacheInfo, nullptr, &m_pipelineCache) != VK_SUCCESS)
+    {
+        // corrupted data: start from an empty cache
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = nullptr;
+        m_df->vkCreatePipelineCache(m_dev, &cacheInfo, nullptr, &m_pipelineCache);
+    }
+
+    qDebug() << "pipeline cache" << m_cacheFile << "loaded with" << data.size() << "bytes";
+}
+
+void VkRtPipeline::savePipelineCache()
+{
+    size_t size = 0;
+    if (m_df->vkGetPipelineCacheData(m_dev, m_pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0)
+        return;
+
+    QByteArray data(qsizetype(size), Qt::Uninitialized);
+    if (m_df->vkGetPipelineCacheData(m_dev, m_pipelineCache, &size, data.data()) != VK_SUCCESS)
+        return;
+    data.resize(qsizetype(size));
+
+    QDir().mkpath(QFileInfo(m_cacheFile).absolutePath());
+    QSaveFile file(m_cacheFile);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "cannot write pipeline cache" << m_cacheFile;
+        return;
+    }
+    file.write(data);
+    file.commit();
+}
+
+// ------------------------------------------------------------
+// descriptor set layout: 0=tlas, 1=output image, 2=ubo, 3=colors,
+// 4=depth, 5=ray directions
+// ------------------------------------------------------------
+void VkRtPipeline::createLayouts()
+{
+    VkDescriptorSetLayoutBinding asLayoutBinding = {};
+    asLayoutBinding.binding = 0;
+    asLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    asLayoutBinding.descriptorCount = 1;
+    asLayoutBinding.stageFlags = traceShaderStages;
+
+    VkDescriptorSetLayoutBinding outputLayoutBinding = {};
+    outputLayoutBinding.binding = 1;
+    outputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    outputLayoutBinding.descriptorCount = 1;
+    outputLayoutBinding.stageFlags = traceShaderStages;
+
+    VkDescriptorSetLayoutBinding ubLayoutBinding = {};
+    ubLayoutBinding.binding = 2;
+    ubLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubLayoutBinding.descriptorCount = 1;
+    ubLayoutBinding.stageFlags = traceShaderStages;
+
+    VkDescriptorSetLayoutBinding colorLayoutBinding = {};
+    colorLayoutBinding.binding = 3;
+    colorLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    colorLayoutBinding.descriptorCount = 1;
+    colorLayoutBinding.stageFlags = traceShaderStages | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+
+    // hit distances, for the temporal reprojection
+    VkDescriptorSetLayoutBinding depthLayoutBinding = {};
+    depthLayoutBinding.binding = 4;
+    depthLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    depthLayoutBinding.descriptorCount = 1;
+    depthLayoutBinding.stageFlags = traceShaderStages;
+
+    // precomputed ray directions, see VkRayDirections
+    VkDescriptorSetLayoutBinding directionsLayoutBinding = {};
+    directionsLayoutBinding.binding = 5;
+    directionsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    directionsLayoutBinding.descriptorCount = 1;
+    directionsLayoutBinding.stageFlags = traceShaderStages;
+
+    const VkDescriptorSetLayoutBinding bindings[6] = {
+        asLayoutBinding,
+        outputLayoutBinding,
+        ubLayoutBinding,
+        colorLayoutBinding,
+        depthLayoutBinding,
+        directionsLayoutBinding,
+    };
+
+    VkDescriptorSetLayoutCreateInfo descSetLayoutCreateInfo = {};
+    descSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descSetLayoutCreateInfo.bindingCount = 6;
+    descSetLayoutCreateInfo.pBindings = bindings;
+    m_df->vkCreateDescriptorSetLayout(m_dev, &descSetLayoutCreateInfo, nullptr, &m_descSetLayout);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &m_descSetLayout;
+
+    // tile offset of the launch, see VkRtPipeline::TilePushConstants
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = traceShaderStages;
+    pushRange.size = sizeof(TilePushConstants);
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushRange;
+    m_df->vkCreatePipelineLayout(m_dev, &pipelineLayoutCreateInfo, nullptr, &m_pipelineLayout);
+}
+
+// ------------------------------------------------------------
+// trace specializations, see the constants of projection.glsl
+// ------------------------------------------------------------
+const VkRtPipeline::Program& VkRtPipeline::program(const Variant &variant)
+{
+    std::lock_guard lock{m_programsMutex};
+    auto it = m_programs.find(variant);
+    if (it != m_programs.end())
+        return it->second;
+
+    QElapsedTimer timer;
+    timer.start();
+    Program &p = m_programs[variant] = variant.backend == RayQuery ? createQueryProgram(variant)
+                                                                   : createProgram(variant);
+    savePipelineCache();
+    qDebug() << (variant.backend == RayQuery ? "ray query variant" : "raygen variant")
+             << variant.projectionMode << variant.features
+             << "ready in" << timer.elapsed() << "ms.";
+    return p;
+}
+
+VkRtPipeline::Program VkRtPipeline::createProgram(const Variant &variant)
+{
+    const auto vkCreateRayTracingPipelinesKHR = reinterpret_cast<PFN_vkCreateRayTracingPipelinesKHR>(m_f->vkGetDeviceProcAddr(m_dev, "vkCreateRayTracingPipelinesKHR"));
+
+    VkPipelineShaderStageCreateInfo stages[3] = {
+        getShader(QStringLiteral(":/shaders/raygen.rgen%1.spv").arg(QLatin1String(vkrt::shaderVariant(m_colorFormat))),
+                  VK_SHADER_STAGE_RAYGEN_BIT_KHR, m_dev, m_df),
+        getShader(":/shaders/miss.rmiss.spv", VK_SHADER_STAGE_MISS_BIT_KHR, m_dev, m_df),
+        getShader(":/shaders/closesthit.rchit.spv", VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, m_dev, m_df)
+    };
+
+    const VkSpecializationMapEntry specEntries[2] = {
+        { 0, offsetof(Variant, projectionMode), sizeof(int32_t) },
+        { 1, offsetof(Variant, features), sizeof(uint32_t) }
+    };
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = 2;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(Variant);
+    specInfo.pData = &variant;
+    stages[0].pSpecializationInfo = &specInfo;
+
+    VkRayTracingShaderGroupCreateInfoKHR shaderGroups[3];
+    {
+      // rgen group
+      VkRayTracingShaderGroupCreateInfoKHR g = {};
+      g.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR;
+      g.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+      g.generalShader = 0;
+      g.closestHitShader = VK_SHADER_UNUSED_KHR;
+      g.anyHitShader = VK_SHADER_UNUSED_KHR;
+      g.intersectionShader = VK_SHADER_UNUSED_KHR;
+      shaderGroups[0] = g;
+
+      // rmiss group
+      g.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+      g.generalShader = 1;
+      g.closestHitShader = VK_SHADER_UNUSED_KHR;
+      shaderGroups[1] = g;
+
+      // triangles hit group
+      g.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
+      g.generalShader = VK_SHADER_UNUSED_KHR;
+      g.closestHitShader = 2;
+      g.anyHitShader = VK_SHADER_UNUSED_KHR;
+      g.intersectionShader = VK_SHADER_UNUSED_KHR;
+      shaderGroups[2] = g;
+    }
+
+    VkRayTracingPipelineCreateInfoKHR pipelineCreateInfo = {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
+    pipelineCreateInfo.stageCount = 3;
+    pipelineCreateInfo.pStages = stages;
+    pipelineCreateInfo.groupCount = 3;
+    pipelineCreateInfo.pGroups = shaderGroups;
+    pipelineCreateInfo.maxPipelineRayRecursionDepth = 1;
+    pipelineCreateInfo.layout = m_pipelineLayout;
+    Program program;
+    vkCreateRayTracingPipelinesKHR(m_dev, VK_NULL_HANDLE, m_pipelineCache, 1, &pipelineCreateInfo, nullptr, &program.pipeline);
+
+    // modules are not needed anymore once the pipeline exists
+    for (const auto &stage : stages)
+        m_df->vkDestroyShaderModule(m_dev, stage.module, nullptr);
+
+    createShaderBindingTable(program);
+    return program;
+}
+
+// ------------------------------------------------------------
+// ray query backend: one compute pipeline, same layout and constants
+// ------------------------------------------------------------
+VkRtPipeline::Program VkRtPipeline::createQueryProgram(const Variant &variant)
+{
+    VkPipelineShaderStageCreateInfo stage =
+        getShader(QStringLiteral(":/shaders/trace.comp%1.spv").arg(QLatin1String(vkrt::shaderVariant(m_colorFormat))),
+                  VK_SHADER_STAGE_COMPUTE_BIT, m_dev, m_df);
+
+    const VkSpecializationMapEntry specEntries[4] = {
+        { 0, offsetof(Variant, projectionMode), sizeof(int32_t) },
+        { 1, offsetof(Variant, features), sizeof(uint32_t) },
+        { 2, offsetof(Variant, groupWidth), sizeof(uint32_t) },
+        { 3, offsetof(Variant, groupHeight), sizeof(uint32_t) }
+    };
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = 4;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(Variant);
+    specInfo.pData = &variant;
+    stage.pSpecializationInfo = &specInfo;
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage = stage;
+    pipelineCreateInfo.layout = m_pipelineLayout;
+
+    Program program;
+    program.backend = RayQuery;
+    program.groupWidth = variant.groupWidth;
+    program.groupHeight = variant.groupHeight;
+    m_df->vkCreateComputePipelines(m_dev, m_pipelineCache, 1, &pipelineCreateInfo, nullptr, &program.pipeline);
+
+    m_df->vkDestroyShaderModule(m_dev, stage.module, nullptr);
+    return program;
+}
+
+// ------------------------------------------------------------
+// shader binding table (rgen, miss, hit)
+// ------------------------------------------------------------
+void VkRtPipeline::createShaderBindingTable(Program &program)
+{
+    const auto vkGetRayTracingShaderGroupHandlesKHR = reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(m_f->vkGetDeviceProcAddr(m_dev, "vkGetRayTracingShaderGroupHandlesKHR"));
+
+    const uint32_t handleSize = m_rtProps.shaderGroupHandleSize;
+    const uint32_t handleSizeAligned = aligned(handleSize, m_rtProps.shaderGroupHandleAlignment);
+    const uint32_t groupSize = 3;
+    const uint32_t handleListByteSize = groupSize * handleSize;
+
+    std::vector<uint8_t> handles(handleListByteSize);
+    vkGetRayTracingShaderGroupHandlesKHR(m_dev, program.pipeline, 0, groupSize, handleListByteSize, handles.data());
+
+    // sbt entry stride must honor handle alignment and base alignment
+    const uint32_t sbtBufferEntrySize = aligned(handleSizeAligned, m_rtProps.shaderGroupBaseAlignment);
+    const uint32_t sbtBufferSize = groupSize * sbtBufferEntrySize;
+
+    program.sbt = vkrt::createHostVisibleBuffer(VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+                                                m_physDev, m_dev, m_f, m_df, sbtBufferSize);
+    std::vector<uint8_t> sbtBufData(sbtBufferSize);
+    for (uint32_t i = 0; i < groupSize; ++i)
+      memcpy(sbtBufData.data() + i * sbtBufferEntrySize, handles.data() + i * handleSize, handleSize);
+    vkrt::updateHostData(program.sbt, m_dev, m_df, sbtBufData.data(), sbtBufferSize);
+
+    // raygen region size must match its stride
+    program.raygenRegion.deviceAddress = program.sbt.addr;
+    program.raygenRegion.stride = handleSizeAligned;
+    program.raygenRegion.size = handleSizeAligned;
+
+    program.missRegion.deviceAddress = program.sbt.addr + sbtBufferEntrySize;
+    program.missRegion.stride = handleSizeAligned;
+    program.missRegion.size = handleSize;
+
+    program.hitRegion.deviceAddress = program.sbt.addr + sbtBufferEntrySize * 2;
+    program.hitRegion.stride = handleSizeAligned;
+    program.hitRegion.size = handleSize;
+}
@@ -0,0 +1,137 @@
+#ifndef VK_RT_PIPELINE_H
+#define VK_RT_PIPELINE_H
+
+#include <QVulkanFunctions>
+
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_image.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+// ------------------------------------------------------------
+// trace pipelines, their layout and sbts: either ray tracing pipelines
+// (rgen/rmiss/rchit) or compute pipelines using ray queries (trace.comp),
+// both with the same layout. they only depend on the device and the color
+// format, so they are built once per VkDevice and format and shared by
+// every VkRayTracer; the specializations are created on first use.
+// compilation goes through a VkPipelineCache which is persisted on disk
+// between sessions.
+// ------------------------------------------------------------
+class VkRtPipeline
+{
+public:
+    // raygen push constants: launches may cover a tile of the image, whose
+    // pixel offset is pushed before each trace
+    struct TilePushConstants {
+        int32_t offsetX;
+        int32_t offsetY;
+    };
+    // stages of the layout, for the push constants
+    static constexpr VkShaderStageFlags traceShaderStages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+    // stages the trace runs in, for the barriers around it
+    static constexpr VkPipelineStageFlags traceStages = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    // how the rays are traced: vkCmdTraceRaysKHR over the sbt, or a compute
+    // dispatch with inline ray queries (no sbt, tiled in workgroups)
+    enum Backend : int32_t {
+        RayTracingPipeline = 0,
+        RayQuery = 1
+    };
+    // the device can run the RayQuery backend. the device is created by the
+    // host, which must have enabled VK_KHR_ray_query for it
+    static bool supportsRayQuery(VkPhysicalDevice physDev, QVulkanFunctions *f);
+
+    // raygen specialization constants, see projection.glsl
+    enum Feature : uint32_t {
+        DomeMask = 1,
+        Foveation = 2,
+        TemporalInterleave = 4,
+        ProgressiveRefinement = 8,
+        DirectionLut = 16,
+        AllFeatures = 31
+    };
+    struct Variant {
+        // projection mode of every view of a launch, -1 to read it per view
+        int32_t projectionMode = -1;
+        // features the views of a launch may use, the others are compiled out
+        uint32_t features = AllFeatures;
+        Backend backend = RayTracingPipeline;
+        // RayQuery only: workgroup size in pixels
+        uint32_t groupWidth = 8;
+        uint32_t groupHeight = 8;
+
+        bool operator<(const Variant &other) const noexcept
+        {
+            return std::tie(projectionMode, features, backend, groupWidth, groupHeight)
+                   < std::tie(other.projectionMode, other.features, other.backend, other.groupWidth, other.groupHeight);
+        }
+    };
+
+    // a specialized pipeline; the sbt regions to pass to vkCmdTraceRaysKHR,
+    // or the workgroup size of the dispatch for ray queries
+    struct Program {
+        Backend backend = RayTracingPipeline;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        vkrt::Buffer sbt;
+        VkStridedDeviceAddressRegionKHR raygenRegion = {};
+        VkStridedDeviceAddressRegionKHR missRegion = {};
+        VkStridedDeviceAddressRegionKHR hitRegion = {};
+        VkStridedDeviceAddressRegionKHR callableRegion = {};
+        uint32_t groupWidth = 0;
+        uint32_t groupHeight = 0;
+
+        VkPipelineBindPoint bindPoint() const noexcept
+        {
+            return backend == RayQuery ? VK_PIPELINE_BIND_POINT_COMPUTE : VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR;
+        }
+    };
+
+    // returns the pipeline of this device writing colorFormat images,
+    // creating it if needed
+    static std::shared_ptr<VkRtPipeline> forDevice(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                                                   vkrt::ColorFormat colorFormat = vkrt::ColorFormat::RGBA8);
+
+    VkRtPipeline(const VkRtPipeline&) = delete;
+    VkRtPipeline& operator=(const VkRtPipeline&) = delete;
+    ~VkRtPipeline();
+
+    VkDescriptorSetLayout descriptorSetLayout() const noexcept { return m_descSetLayout; }
+    VkPipelineLayout layout() const noexcept { return m_pipelineLayout; }
+    // persisted cache, also used for the compute passes of the tracers
+    VkPipelineCache pipelineCache() const noexcept { return m_pipelineCache; }
+
+    // pipeline of a specialization, created on first use
+    const Program& program(const Variant &variant);
+
+private:
+    VkRtPipeline(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                 vkrt::ColorFormat colorFormat);
+
+    void loadPipelineCache();
+    void savePipelineCache();
+    void createLayouts();
+    Program createProgram(const Variant &variant);
+    Program createQueryProgram(const Variant &variant);
+    void createShaderBindingTable(Program &program);
+
+    VkPhysicalDevice m_physDev = VK_NULL_HANDLE;
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanFunctions *m_f = nullptr;
+    QVulkanDeviceFunctions *m_df = nullptr;
+    vkrt::ColorFormat m_colorFormat = vkrt::ColorFormat::RGBA8;
+
+    VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProps = {};
+    QString m_cacheFile;
+
+    VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+
+    std::mutex m_programsMutex;
+    std::map<Variant, Program> m_programs;
+};
+
+#endif
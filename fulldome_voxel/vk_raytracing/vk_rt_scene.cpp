@@ -0,0 +1,478 @@
+#include "vk_rt_scene.hpp"
+
+#include <fulldome_voxel/vk_raytracing/vk_voxel_raytracing.hpp>
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+using namespace vkrt;
+
+// ------------------------------------------------------------
+// static cube template (used as single BLAS geometry), scaled to
+// VkRayTracer::voxelHalfExtent by the instance transforms
+// ------------------------------------------------------------
+const float r = 1.f;
+const float cube_verts_template[8 * 3] = {
+  -r, -r, -r,   r, -r, -r,   r,  r, -r,  -r,  r, -r,
+  -r, -r,  r,   r, -r,  r,   r,  r,  r,  -r,  r,  r
+};
+const uint32_t cube_indices_template[36] = {
+  0, 1, 2, 2, 3, 0, // front
+  1, 5, 6, 6, 2, 1, // right
+  5, 4, 7, 7, 6, 5, // back
+  4, 0, 3, 3, 7, 4, // left
+  3, 2, 6, 6, 7, 3, // top
+  4, 5, 1, 1, 0, 4  // bottom
+};
+
+// geometry of the tlas builds: the instances written by tlas_instances.comp
+static VkAccelerationStructureGeometryKHR tlasGeometry(VkDeviceAddress instances)
+{
+    VkAccelerationStructureGeometryKHR geom = {};
+    geom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geom.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    geom.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geom.geometry.instances.arrayOfPointers = VK_FALSE;
+    geom.geometry.instances.data.deviceAddress = instances;
+    return geom;
+}
+
+static std::mutex g_scenesMutex;
+static std::map<VkRtScene::Key, std::weak_ptr<VkRtScene>> g_scenes;
+
+std::shared_ptr<VkRtScene> VkRtScene::acquire(const Key &key,
+                                              std::shared_ptr<const vkfrt::PointCloud> cloud)
+{
+    std::lock_guard lock{g_scenesMutex};
+    if (auto existing = g_scenes[key].lock())
+    {
+        qDebug() << "[RayTracer] sharing scene" << key.source << key.revision << "with" << existing->pointCount() << "points";
+        return existing;
+    }
+
+    std::shared_ptr<VkRtScene> scene{new VkRtScene{key, std::move(cloud)}};
+    g_scenes[key] = scene;
+    return scene;
+}
+
+std::shared_ptr<VkRtScene> VkRtScene::createStreaming(const Key &key,
+                                                      std::shared_ptr<const vkfrt::PointCloud> cloud)
+{
+    Q_ASSERT(cloud->sequenceCapacity > 0);
+    const size_t capacity = std::max(cloud->sequenceCapacity, cloud->positions.size());
+    std::shared_ptr<VkRtScene> scene{new VkRtScene{key, std::move(cloud)}};
+    scene->m_capacity = capacity;
+    return scene;
+}
+
+bool VkRtScene::stream(std::shared_ptr<const vkfrt::PointCloud> cloud)
+{
+    if (!isStreaming() || cloud->positions.size() > m_capacity)
+        return false;
+
+    // a frame not uploaded yet is simply skipped
+    m_key.revision = cloud->revision;
+    m_cloud = std::move(cloud);
+    return true;
+}
+
+VkRtScene::VkRtScene(const Key &key, std::shared_ptr<const vkfrt::PointCloud> cloud)
+    : m_key{key}
+    , m_pointCount{cloud->positions.size()}
+    , m_cloud{std::move(cloud)}
+    , m_chunks{m_cloud->chunks}
+{
+}
+
+VkRtScene::~VkRtScene()
+{
+    if (!isStreaming()) {
+        std::lock_guard lock{g_scenesMutex};
+        auto it = g_scenes.find(m_key);
+        if (it != g_scenes.end() && it->second.expired())
+            g_scenes.erase(it);
+    }
+
+    if (!m_dev)
+        return;
+
+    if (m_tlas)
+        vkDestroyAccelerationStructureKHR(m_dev, m_tlas, nullptr);
+    if (m_blas)
+        vkDestroyAccelerationStructureKHR(m_dev, m_blas, nullptr);
+
+    for (const Buffer &b : {m_vertexBuffer, m_indexBuffer, m_colorBuffer, m_blasBuffer, m_scratchBLAS,
+                            m_positionBuffer, m_instanceBuffer, m_tlasBuffer, m_scratchTLAS})
+        freeBuffer(b, m_dev, m_df);
+    for (int i = 0; i < stagingCount; ++i) {
+        if (m_stagingMapped[i])
+            m_df->vkUnmapMemory(m_dev, m_staging[i].mem);
+        if (m_staging[i].buf)
+            freeBuffer(m_staging[i], m_dev, m_df);
+    }
+}
+
+// ------------------------------------------------------------
+// one-time upload and blas / tlas build; streaming scenes then upload
+// each new frame and refit or rebuild the tlas in place
+// ------------------------------------------------------------
+void VkRtScene::ensureBuilt(VkCommandBuffer cb, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                            VkPipelineCache cache)
+{
+    if (isBuilt()) {
+        if (isStreaming() && m_cloud) {
+            recordUpload(cb);
+            recordInstances(cb);
+            recordTlasBuild(cb, m_pointCount == m_builtPointCount && m_refits < maxRefits);
+        }
+        return;
+    }
+
+    const auto vkCreateAccelerationStructureKHR = reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(f->vkGetDeviceProcAddr(dev, "vkCreateAccelerationStructureKHR"));
+    const auto vkGetAccelerationStructureBuildSizesKHR = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(f->vkGetDeviceProcAddr(dev, "vkGetAccelerationStructureBuildSizesKHR"));
+    const auto vkGetAccelerationStructureDeviceAddressKHR = reinterpret_cast<PFN_vkGetAccelerationStructureDeviceAddressKHR>(f->vkGetDeviceProcAddr(dev, "vkGetAccelerationStructureDeviceAddressKHR"));
+    vkCmdBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(f->vkGetDeviceProcAddr(dev, "vkCmdBuildAccelerationStructuresKHR"));
+    vkDestroyAccelerationStructureKHR = reinterpret_cast<PFN_vkDestroyAccelerationStructureKHR>(f->vkGetDeviceProcAddr(dev, "vkDestroyAccelerationStructureKHR"));
+    m_dev = dev;
+    m_df = df;
+
+    QElapsedTimer timer;
+    timer.start();
+    qDebug() << "[RayTracer] building scene with" << m_pointCount << "points";
+
+    // use a single cube mesh for the BLAS
+    std::vector<float>    all_vertices(cube_verts_template,   cube_verts_template + 24);
+    std::vector<uint32_t> all_indices (cube_indices_template, cube_indices_template + 36);
+    qDebug() << "using single cube template with" << all_vertices.size() / 3 << "vertices and" << all_indices.size() << "indices for BLAS.";
+
+    // upload cube mesh to gpu
+    m_vertexBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                             physDev, dev, f, df, all_vertices.size() * sizeof(float));
+    updateHostData(m_vertexBuffer, dev, df, all_vertices.data(), all_vertices.size() * sizeof(float));
+
+    m_indexBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                            physDev, dev, f, df, all_indices.size() * sizeof(uint32_t));
+    updateHostData(m_indexBuffer, dev, df, all_indices.data(), all_indices.size() * sizeof(uint32_t));
+
+    // color buffer (one vec4 per point); points without color are drawn
+    // white rather than reading out of bounds
+    if (isStreaming()) {
+        // written by the uploads, see recordUpload
+        m_colorBuffer = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       physDev, dev, f, df, m_capacity * sizeof(QVector4D));
+    } else {
+        std::vector<QVector4D> white;
+        if (m_cloud->colors.size() != m_pointCount)
+            white.assign(m_pointCount, QVector4D(1.f, 1.f, 1.f, 1.f));
+        const std::vector<QVector4D> &all_colors = white.empty() ? m_cloud->colors : white;
+
+        m_colorBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                physDev, dev, f, df, all_colors.size() * sizeof(QVector4D));
+        updateHostData(m_colorBuffer, dev, df, all_colors.data(), all_colors.size() * sizeof(QVector4D));
+    }
+
+    // --------------------------------------------------------
+    // build BLAS: triangles (single cube)
+    // --------------------------------------------------------
+    qDebug() << "[TIMESTAMP] BLAS creation started at" << timer.elapsed() << "ms.";
+    VkDeviceOrHostAddressConstKHR vertexBufferDeviceAddress = {};
+    vertexBufferDeviceAddress.deviceAddress = m_vertexBuffer.addr;
+    VkDeviceOrHostAddressConstKHR indexBufferDeviceAddress = {};
+    indexBufferDeviceAddress.deviceAddress = m_indexBuffer.addr;
+
+    VkAccelerationStructureGeometryKHR asGeom = {};
+    asGeom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR; // keep opaque for fastest path
+    asGeom.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+    asGeom.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+    asGeom.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    asGeom.geometry.triangles.vertexData = vertexBufferDeviceAddress;
+    asGeom.geometry.triangles.vertexStride = 3 * sizeof(float);
+    asGeom.geometry.triangles.maxVertex = (all_vertices.size() / 3) - 1;
+    asGeom.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+    asGeom.geometry.triangles.indexData = indexBufferDeviceAddress;
+
+    VkAccelerationStructureBuildGeometryInfoKHR asBuildGeomInfo = {};
+    asBuildGeomInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    asBuildGeomInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    asBuildGeomInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR; // you can swap to FAST_BUILD if startup matters more
+    asBuildGeomInfo.geometryCount = 1;
+    asBuildGeomInfo.pGeometries = &asGeom;
+
+    const uint32_t primitiveCountPerGeometry = static_cast<uint32_t>(all_indices.size() / 3);
+    VkAccelerationStructureBuildSizesInfoKHR sizeInfo = {};
+    sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    vkGetAccelerationStructureBuildSizesKHR(dev,
+                                            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                            &asBuildGeomInfo,
+                                            &primitiveCountPerGeometry,
+                                            &sizeInfo);
+
+    qDebug() << "blas buffer size" << sizeInfo.accelerationStructureSize;
+    m_blasBuffer = createASBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+                                  physDev, dev, f, df, sizeInfo.accelerationStructureSize);
+
+    VkAccelerationStructureCreateInfoKHR asCreateInfo = {};
+    asCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    asCreateInfo.buffer = m_blasBuffer.buf;
+    asCreateInfo.size = sizeInfo.accelerationStructureSize;
+    asCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    vkCreateAccelerationStructureKHR(dev, &asCreateInfo, nullptr, &m_blas);
+
+    qDebug() << "blas scratch buffer size" << sizeInfo.buildScratchSize;
+    m_scratchBLAS = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        physDev, dev, f, df, sizeInfo.buildScratchSize);
+
+    memset(&asBuildGeomInfo, 0, sizeof(asBuildGeomInfo));
+    asBuildGeomInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    asBuildGeomInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    asBuildGeomInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    asBuildGeomInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    asBuildGeomInfo.dstAccelerationStructure = m_blas;
+    asBuildGeomInfo.geometryCount = 1;
+    asBuildGeomInfo.pGeometries = &asGeom;
+    asBuildGeomInfo.scratchData.deviceAddress = m_scratchBLAS.addr;
+
+    VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfo = {};
+    asBuildRangeInfo.primitiveCount = primitiveCountPerGeometry;
+    asBuildRangeInfo.primitiveOffset = 0;
+    asBuildRangeInfo.firstVertex = 0;
+    asBuildRangeInfo.transformOffset = 0;
+
+    VkAccelerationStructureBuildRangeInfoKHR *rangeInfo = &asBuildRangeInfo;
+
+    // record build on command buffer (nvidia typically reports no host build)
+    vkCmdBuildAccelerationStructuresKHR(cb, 1, &asBuildGeomInfo, &rangeInfo);
+
+    // get device address for this BLAS
+    VkAccelerationStructureDeviceAddressInfoKHR asAddrInfo = {};
+    asAddrInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    asAddrInfo.accelerationStructure = m_blas;
+    m_blasAddr = vkGetAccelerationStructureDeviceAddressKHR(dev, &asAddrInfo);
+
+    // barrier to make blas build visible before tlas build
+    {
+      VkMemoryBarrier memoryBarrier = {};
+      memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      const VkAccessFlags accelAccess = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+      memoryBarrier.srcAccessMask = accelAccess;
+      memoryBarrier.dstAccessMask = accelAccess;
+      df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                               VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    // --------------------------------------------------------
+    // build TLAS: instance the single cube for each point
+    // --------------------------------------------------------
+    qDebug() << "[TIMESTAMP] TLAS creation started at" << timer.elapsed() << "ms.";
+
+    // instances are generated on the gpu from the positions, in a
+    // device-local buffer read by the build. Streaming scenes are sized for
+    // their largest frame and get the positions through the staging ring.
+    const size_t capacity = std::max<size_t>({m_capacity, m_pointCount, 1});
+    if (isStreaming()) {
+        m_positionBuffer = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          physDev, dev, f, df, capacity * sizeof(QVector4D));
+        for (int i = 0; i < stagingCount; ++i) {
+            m_staging[i] = createHostVisibleBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, physDev, dev, f, df,
+                                                   2 * capacity * sizeof(QVector4D));
+            void *p = nullptr;
+            df->vkMapMemory(dev, m_staging[i].mem, 0, VK_WHOLE_SIZE, 0, &p);
+            m_stagingMapped[i] = static_cast<uchar *>(p);
+        }
+        recordUpload(cb);
+    } else {
+        m_positionBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                   physDev, dev, f, df, capacity * sizeof(QVector4D));
+        updateHostData(m_positionBuffer, dev, df, m_cloud->positions.data(), m_pointCount * sizeof(QVector4D));
+    }
+
+    m_instanceBuffer = createASBuffer(
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        physDev, dev, f, df, capacity * sizeof(VkAccelerationStructureInstanceKHR));
+
+    m_instancePass = std::make_unique<VkComputePass>(
+        dev, df, cache, QStringLiteral(":/shaders/tlas_instances.comp.spv"),
+        std::vector<VkDescriptorType>{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        sizeof(InstanceParams), 1);
+    m_instancePass->writeBuffer(0, 0, m_positionBuffer);
+    m_instancePass->writeBuffer(0, 1, m_instanceBuffer);
+    recordInstances(cb);
+    qDebug() << "generating" << m_pointCount << "instances for the tlas build.";
+
+    // streaming scenes are rebuilt or refit every frame: fast builds, and
+    // sized for the capacity so that any frame fits in place
+    if (isStreaming())
+        m_tlasFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR
+                      | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+    const VkAccelerationStructureGeometryKHR asGeomTLAS = tlasGeometry(m_instanceBuffer.addr);
+    VkAccelerationStructureBuildGeometryInfoKHR asBuildGeomInfoTLAS = {};
+    asBuildGeomInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    asBuildGeomInfoTLAS.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    asBuildGeomInfoTLAS.flags = m_tlasFlags;
+    asBuildGeomInfoTLAS.geometryCount = 1;
+    asBuildGeomInfoTLAS.pGeometries = &asGeomTLAS;
+
+    const uint32_t tlasCount = static_cast<uint32_t>(capacity);
+    VkAccelerationStructureBuildSizesInfoKHR sizeInfoTLAS = {};
+    sizeInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    vkGetAccelerationStructureBuildSizesKHR(dev,
+                                            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                            &asBuildGeomInfoTLAS,
+                                            &tlasCount,
+                                            &sizeInfoTLAS);
+
+    qDebug() << "tlas buffer size" << sizeInfoTLAS.accelerationStructureSize;
+    m_tlasBuffer = createASBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+                                  physDev, dev, f, df, sizeInfoTLAS.accelerationStructureSize);
+
+    VkAccelerationStructureCreateInfoKHR asCreateInfoTLAS = {};
+    asCreateInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    asCreateInfoTLAS.buffer = m_tlasBuffer.buf;
+    asCreateInfoTLAS.size = sizeInfoTLAS.accelerationStructureSize;
+    asCreateInfoTLAS.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    vkCreateAccelerationStructureKHR(dev, &asCreateInfoTLAS, nullptr, &m_tlas);
+
+    const VkDeviceSize scratchSize = std::max(sizeInfoTLAS.buildScratchSize,
+                                              isStreaming() ? sizeInfoTLAS.updateScratchSize : 0);
+    qDebug() << "tlas scratch buffer size" << scratchSize;
+    m_scratchTLAS = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        physDev, dev, f, df, scratchSize);
+
+    recordTlasBuild(cb, false);
+
+    // fetch tlas device address
+    VkAccelerationStructureDeviceAddressInfoKHR asAddrInfoTLAS = {};
+    asAddrInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    asAddrInfoTLAS.accelerationStructure = m_tlas;
+    m_tlasAddr = vkGetAccelerationStructureDeviceAddressKHR(dev, &asAddrInfoTLAS);
+
+    qDebug() << "[TIMESTAMP] TLAS creation finished at" << timer.elapsed() << "ms.";
+
+    // the cpu side is not needed anymore
+    m_cloud.reset();
+}
+
+// ------------------------------------------------------------
+// tlas instances: one per point, written by tlas_instances.comp and made
+// visible to the tlas build that follows
+// ------------------------------------------------------------
+void VkRtScene::recordInstances(VkCommandBuffer cb)
+{
+    const uint32_t rowLength = instanceRowLength;
+    const uint32_t pointCount = static_cast<uint32_t>(m_pointCount);
+    const InstanceParams params{ m_blasAddr, pointCount, rowLength,
+                                 VkRayTracer::sceneScale, VkRayTracer::voxelHalfExtent, 0, 0 };
+    m_instancePass->dispatch(cb, 0, rowLength, (pointCount + rowLength - 1) / rowLength, 1, &params);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    m_df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+// ------------------------------------------------------------
+// streaming: the frame goes into the next staging buffer, then is copied
+// into the buffers read by the instance generation and the trace once the
+// frames in flight are done reading them
+// ------------------------------------------------------------
+void VkRtScene::recordUpload(VkCommandBuffer cb)
+{
+    const vkfrt::PointCloud &cloud = *m_cloud;
+    const size_t count = cloud.positions.size();
+    const VkDeviceSize bytes = count * sizeof(QVector4D);
+    const VkDeviceSize colorOffset = m_capacity * sizeof(QVector4D);
+
+    const int staging = m_nextStaging;
+    m_nextStaging = (m_nextStaging + 1) % stagingCount;
+    uchar *mapped = m_stagingMapped[staging];
+    memcpy(mapped, cloud.positions.data(), bytes);
+    if (cloud.colors.size() == count)
+        memcpy(mapped + colorOffset, cloud.colors.data(), bytes);
+    else
+        std::fill_n(reinterpret_cast<QVector4D *>(mapped + colorOffset), count, QVector4D(1.f, 1.f, 1.f, 1.f));
+
+    // the previous frame may still be traced, or its instances and tlas built
+    {
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = 0;
+        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT
+                                      | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        m_df->vkCmdPipelineBarrier(cb,
+                                   VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                       | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                   VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                       | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                   0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    if (count > 0) {
+        VkBufferCopy region = {};
+        region.size = bytes;
+        m_df->vkCmdCopyBuffer(cb, m_staging[staging].buf, m_positionBuffer.buf, 1, &region);
+        region.srcOffset = colorOffset;
+        m_df->vkCmdCopyBuffer(cb, m_staging[staging].buf, m_colorBuffer.buf, 1, &region);
+    }
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    m_df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    m_pointCount = count;
+    m_chunks = cloud.chunks;
+    m_cloud.reset();
+}
+
+// ------------------------------------------------------------
+// tlas over the instances of the current points: a full build into the
+// existing structure, or a refit when the streamed frame kept the point
+// count of the last build
+// ------------------------------------------------------------
+void VkRtScene::recordTlasBuild(VkCommandBuffer cb, bool update)
+{
+    const VkAccelerationStructureGeometryKHR asGeomTLAS = tlasGeometry(m_instanceBuffer.addr);
+
+    VkAccelerationStructureBuildGeometryInfoKHR asBuildGeomInfoTLAS = {};
+    asBuildGeomInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    asBuildGeomInfoTLAS.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    asBuildGeomInfoTLAS.flags = m_tlasFlags;
+    asBuildGeomInfoTLAS.mode = update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+                                      : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    asBuildGeomInfoTLAS.srcAccelerationStructure = update ? m_tlas : VK_NULL_HANDLE;
+    asBuildGeomInfoTLAS.dstAccelerationStructure = m_tlas;
+    asBuildGeomInfoTLAS.geometryCount = 1;
+    asBuildGeomInfoTLAS.pGeometries = &asGeomTLAS;
+    asBuildGeomInfoTLAS.scratchData.deviceAddress = m_scratchTLAS.addr;
+
+    VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfoTLAS = {};
+    asBuildRangeInfoTLAS.primitiveCount = static_cast<uint32_t>(m_pointCount);
+
+    VkAccelerationStructureBuildRangeInfoKHR *rangeInfoTLAS = &asBuildRangeInfoTLAS;
+    vkCmdBuildAccelerationStructuresKHR(cb, 1, &asBuildGeomInfoTLAS, &rangeInfoTLAS);
+
+    if (update) {
+        m_refits++;
+    } else {
+        m_refits = 0;
+        m_builtPointCount = m_pointCount;
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef VK_RT_SCENE_H
+#define VK_RT_SCENE_H
+
+#include <QVector4D>
+#include <QVulkanFunctions>
+
+#include <fulldome_voxel/PointCloud.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_compute_pass.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// ------------------------------------------------------------
+// gpu side of a point cloud: color ssbo, cube blas, instances and tlas.
+// scenes are shared between every VkRayTracer of a device that renders the
+// same geometry, identified by its source and revision (dirty_index).
+// ------------------------------------------------------------
+class VkRtScene
+{
+public:
+    struct Key {
+        VkDevice dev = VK_NULL_HANDLE;
+        const void *source = nullptr;
+        int64_t revision = -1;
+
+        bool operator<(const Key &other) const noexcept
+        {
+            if (dev != other.dev)
+                return dev < other.dev;
+            if (source != other.source)
+                return source < other.source;
+            return revision < other.revision;
+        }
+    };
+
+    // returns the scene for this key; the cloud is kept, not copied, until
+    // the scene is uploaded
+    static std::shared_ptr<VkRtScene> acquire(const Key &key,
+                                              std::shared_ptr<const vkfrt::PointCloud> cloud);
+
+    // frames of a sequence (cloud->sequenceCapacity set): a scene of its
+    // own, sized for the largest frame, into which each new frame is copied
+    // through a staging ring; the tlas is refit when the point count did
+    // not change
+    static std::shared_ptr<VkRtScene> createStreaming(const Key &key,
+                                                      std::shared_ptr<const vkfrt::PointCloud> cloud);
+    bool isStreaming() const noexcept { return m_capacity > 0; }
+    // replaces the frame uploaded by the next ensureBuilt(); false when it
+    // does not fit and a new scene is needed
+    bool stream(std::shared_ptr<const vkfrt::PointCloud> cloud);
+
+    VkRtScene(const VkRtScene&) = delete;
+    VkRtScene& operator=(const VkRtScene&) = delete;
+    ~VkRtScene();
+
+    // records the acceleration structure builds in cb the first time, and
+    // the upload of the new frame of a streaming scene; callers still need a
+    // build -> trace barrier as the build may have been recorded by another
+    // tracer in an earlier command buffer. cache is used for the instance
+    // generation pass
+    void ensureBuilt(VkCommandBuffer cb, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df,
+                     VkPipelineCache cache);
+
+    bool isBuilt() const noexcept { return m_tlas != VK_NULL_HANDLE; }
+    const Key &key() const noexcept { return m_key; }
+    size_t pointCount() const noexcept { return m_pointCount; }
+
+    VkAccelerationStructureKHR tlas() const noexcept { return m_tlas; }
+    const vkrt::Buffer &colorBuffer() const noexcept { return m_colorBuffer; }
+
+    // for the culled tlas of VkRtCulling: the cube blas, the positions and
+    // the chunk bounds of the cloud (empty when it has none)
+    VkDeviceAddress blasAddress() const noexcept { return m_blasAddr; }
+    const vkrt::Buffer &positionBuffer() const noexcept { return m_positionBuffer; }
+    const std::vector<vkfrt::PointCloud::ChunkBounds> &chunks() const noexcept { return m_chunks; }
+
+    // push constants of tlas_instances.comp; the chunks are only read by
+    // its culled variant
+    struct InstanceParams {
+        VkDeviceAddress blasAddress;
+        uint32_t pointCount;
+        uint32_t rowLength;
+        float sceneScale;
+        float voxelHalfExtent;
+        uint32_t chunkPoints;
+        uint32_t chunkCount;
+    };
+    // points are dispatched as rows of rowLength, keeping the group count
+    // of each dimension small
+    static constexpr uint32_t instanceRowLength = 256 * VkComputePass::groupSize;
+
+private:
+    VkRtScene(const Key &key, std::shared_ptr<const vkfrt::PointCloud> cloud);
+
+    // records the generation of the tlas instances from the positions
+    void recordInstances(VkCommandBuffer cb);
+    // streaming: copy of the pending frame through the next staging buffer
+    void recordUpload(VkCommandBuffer cb);
+    // full build, or refit of the current tlas
+    void recordTlasBuild(VkCommandBuffer cb, bool update);
+
+    Key m_key;
+    size_t m_pointCount = 0;
+
+    // cpu side, released once uploaded
+    std::shared_ptr<const vkfrt::PointCloud> m_cloud;
+    std::vector<vkfrt::PointCloud::ChunkBounds> m_chunks;
+
+    VkDevice m_dev = VK_NULL_HANDLE;
+    QVulkanDeviceFunctions *m_df = nullptr;
+    PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR = nullptr;
+    PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR = nullptr;
+
+    vkrt::Buffer m_vertexBuffer;
+    vkrt::Buffer m_indexBuffer;
+    vkrt::Buffer m_colorBuffer;
+    vkrt::Buffer m_blasBuffer;
+    vkrt::Buffer m_scratchBLAS;
+    VkAccelerationStructureKHR m_blas = VK_NULL_HANDLE;
+    VkDeviceAddress m_blasAddr = 0;
+
+    // positions (vec4 per point) read by the instance generation
+    vkrt::Buffer m_positionBuffer;
+    std::unique_ptr<VkComputePass> m_instancePass;
+    vkrt::Buffer m_instanceBuffer;
+    vkrt::Buffer m_tlasBuffer;
+    vkrt::Buffer m_scratchTLAS;
+    VkAccelerationStructureKHR m_tlas = VK_NULL_HANDLE;
+    VkDeviceAddress m_tlasAddr = 0;
+    VkBuildAccelerationStructureFlagsKHR m_tlasFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+
+    // streaming: points the buffers are sized for (0 for the other scenes),
+    // and the host-visible copies of the last frames, one written per
+    // upload: a buffer comes back once its frame is complete
+    static constexpr int stagingCount = 3;
+    // refits degrade the tlas, it is rebuilt after this many
+    static constexpr int maxRefits = 30;
+    size_t m_capacity = 0;
+    vkrt::Buffer m_staging[stagingCount];
+    uchar *m_stagingMapped[stagingCount] = {};
+    int m_nextStaging = 0;
+    size_t m_builtPointCount = 0;
+    int m_refits = 0;
+};
+
+#endif
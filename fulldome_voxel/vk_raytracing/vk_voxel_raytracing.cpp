@@ -4,134 +4,107 @@
 
 #include <QElapsedTimer>
 #include <QDateTime>
-#include "Gfx/GfxContext.hpp"
-#include "score/gfx/Vulkan.hpp"
-
 #include <QFile>
 #include <QDebug>
 
-#include <rhi/qrhi_platform.h>
-
-struct VoxelUBO {
-  QMatrix4x4 projInv;
-  QMatrix4x4 viewInv;
-  int projMode;
-};
+#include <algorithm>
+#include <cmath>
 
+using namespace vkrt;
 
-// ------------------------------------------------------------
-// static cube template (used as single BLAS geometry)
-// ------------------------------------------------------------
-const float r = 0.01f; // a small half-extent for cube voxel
-const float cube_verts_template[8 * 3] = {
-  -r, -r, -r,   r, -r, -r,   r,  r, -r,  -r,  r, -r,
-  -r, -r,  r,   r, -r,  r,   r,  r,  r,  -r,  r,  r
-};
-const uint32_t cube_indices_template[36] = {
-  0, 1, 2, 2, 3, 0, // front
-  1, 5, 6, 6, 2, 1, // right
-  5, 4, 7, 7, 6, 5, // back
-  4, 0, 3, 3, 7, 4, // left
-  3, 2, 6, 6, 7, 3, // top
-  4, 5, 1, 1, 0, 4  // bottom
-};
-
-template <class Int>
-inline Int aligned(Int v, Int byteAlign)
+namespace
+{
+// std140 layout of one Camera entry in projection.glsl:
+// projInverse, viewInverse, fov, projectionMode, domeMask, foveation,
+// focusDirection, fullRateAngle, falloffAngle, interleave, interleavePhase,
+// refinementStride, refinedStride, directionLut, padded to 16 bytes
+constexpr VkDeviceSize cameraUBOStride = 192;
+constexpr VkDeviceSize cameraUBOSize = cameraUBOStride * VkRayTracer::MAX_VIEWS;
+
+// pixels traced per frame in temporal mode: 0 when off, 2 or 4 otherwise.
+// The cubemap modes already amortize their faces over frames; calibrated
+// views have no inverse mapping to reproject with.
+int temporalInterleave(const vkfrt::CameraState &cam)
 {
-    return (v + byteAlign - 1) & ~(byteAlign - 1);
+    if (vkfrt::usesCubemap(cam.projectionMode) || cam.temporalInterleave <= 1 || !cam.calibrationMap.isEmpty())
+        return 0;
+    return cam.temporalInterleave <= 2 ? 2 : 4;
 }
 
-// ------------------------------------------------------------
-// recreate storage image used as raytracing output target
-// ------------------------------------------------------------
-void VkRayTracer::recreateTexture(int w, int h){
-  // destroy previous rhi + vk image objects if any
-  if (m_tex) {
-    m_tex->destroy();
-    m_tex = nullptr;
-  }
-
-  if (m_vkImgView) {
-    m_df->vkDestroyImageView(m_device, m_vkImgView, nullptr);
-    m_vkImgView = VK_NULL_HANDLE;
-  }
-
-  if (m_vkImg) {
-    m_df->vkDestroyImage(m_device, m_vkImg, nullptr);
-    m_vkImg = VK_NULL_HANDLE;
-  }
-
-  if (m_vkImgMem) {
-    m_df->vkFreeMemory(m_device, m_vkImgMem, nullptr);
-    m_vkImgMem = VK_NULL_HANDLE;
-  }
+void writeCameraEntry(uchar *entry, const vkfrt::CameraState &cam, const QMatrix4x4 &projInv, const QMatrix4x4 &viewInv,
+                      int32_t interleave = 0, int32_t interleavePhase = 0,
+                      int32_t refinementStride = 1, int32_t refinedStride = 0,
+                      int32_t directionLut = VkRayDirections::None)
+{
+    // the dome disc and the focus angles do not apply to a calibration map
+    const bool calibrated = directionLut == VkRayDirections::Calibrated;
+    memcpy(entry,        projInv.constData(), 64);
+    memcpy(entry + 64,   viewInv.constData(), 64);
+    memcpy(entry + 128, &cam.fov, 4);
+    memcpy(entry + 132, &cam.projectionMode, 4);
+    const int32_t domeMask = cam.domeMask && !calibrated ? 1 : 0;
+    memcpy(entry + 136, &domeMask, 4);
+    const int32_t foveation = cam.foveation && interleave == 0 && !calibrated ? 1 : 0;
+    memcpy(entry + 140, &foveation, 4);
+    const QVector3D focus = cam.focusDirection.normalized();
+    memcpy(entry + 144, &focus, 12);
+    memcpy(entry + 160, &cam.fullRateAngle, 4);
+    memcpy(entry + 164, &cam.falloffAngle, 4);
+    memcpy(entry + 168, &interleave, 4);
+    memcpy(entry + 172, &interleavePhase, 4);
+    memcpy(entry + 176, &refinementStride, 4);
+    memcpy(entry + 180, &refinedStride, 4);
+    memcpy(entry + 184, &directionLut, 4);
+}
 
-  // create a storage-capable rgba8 image
-  VkImageCreateInfo imageInfo = {};
-  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  imageInfo.imageType = VK_IMAGE_TYPE_2D;
-  imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-  imageInfo.extent.width = w;
-  imageInfo.extent.height = h;
-  imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
-  imageInfo.arrayLayers = 1;
-  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-  imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-  VkResult res = m_df->vkCreateImage(m_device, &imageInfo, nullptr, &m_vkImg);
-  Q_ASSERT(res == VK_SUCCESS);
-
-  // allocate device-local memory for image
-  VkMemoryRequirements memReq;
-  m_df->vkGetImageMemoryRequirements(m_device, m_vkImg, &memReq);
-
-  VkMemoryAllocateInfo memAlloc = {};
-  memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  memAlloc.allocationSize = memReq.size;
-
-  VkPhysicalDeviceMemoryProperties memProps;
-  m_f->vkGetPhysicalDeviceMemoryProperties(m_physDev, &memProps);
-
-  for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
-    if ((memReq.memoryTypeBits & (1 << i)) &&
-        (memProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
-      memAlloc.memoryTypeIndex = i;
-      break;
-    }
-  }
+// dynamic resolution: the scale moves by steps of 1/16, at most every
+// rescaleInterval frames, so that targets are not reallocated every frame
+constexpr float resolutionScaleStep = 1.f / 16.f;
+constexpr int rescaleInterval = 30;
 
-  res = m_df->vkAllocateMemory(m_device, &memAlloc, nullptr, &m_vkImgMem);
-  Q_ASSERT(res == VK_SUCCESS);
-  res = m_df->vkBindImageMemory(m_device, m_vkImg, m_vkImgMem, 0);
-  Q_ASSERT(res == VK_SUCCESS);
+// tile scheduling: tiles start at tileSide pixels and grow until there are
+// at most maxTiles of them, each one timed by a timestamp
+constexpr int tileSide = 64;
+constexpr uint32_t maxTiles = 1023;
 
-  // create view for shader access
-  VkImageViewCreateInfo viewInfo = {};
-  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-  viewInfo.image = m_vkImg;
-  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-  viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  viewInfo.subresourceRange.levelCount = 1;
-  viewInfo.subresourceRange.layerCount = 1;
+// backend benchmark: frames averaged per backend between two logs
+constexpr int benchmarkFrames = 120;
 
-  res = m_df->vkCreateImageView(m_device, &viewInfo, nullptr, &m_vkImgView);
-  Q_ASSERT(res == VK_SUCCESS);
+QSize scaledSize(const QSize &size, float scale)
+{
+    return QSize(std::max(8, int(std::lround(size.width() * scale))),
+                 std::max(8, int(std::lround(size.height() * scale))));
+}
 
-  // wrap the native image in qrhi texture for easy sampling later
-  QRhiTexture::NativeTexture nativeTex = {};
-  nativeTex.object = quint64(m_vkImg);
-  nativeTex.layout = QRhiTexture::UsedWithLoadStore;
+// progressive refinement applies to the views traced directly in full
+bool refines(const vkfrt::CameraState &cam)
+{
+    return !vkfrt::usesCubemap(cam.projectionMode) && temporalInterleave(cam) == 0;
+}
 
-  m_tex = m_rhi->newTexture(QRhiTexture::RGBA8, QSize(w, h), 1, QRhiTexture::UsedWithLoadStore);
-  m_tex->createFrom(nativeTex);
+// camera to world transform of a cube face traced with a 90° perspective
+// camera: the camera-space ray (dx, dy, -1) maps to
+// forward + dx * right + dy * down, following the vulkan cube face
+// selection rules (+x, -x, +y, -y, +z, -z)
+QMatrix4x4 cubeFaceViewInverse(int face, const QVector3D &position)
+{
+    static const QVector3D axes[6][3] = {
+        // right            down               forward
+        { {  0,  0, -1 }, {  0, -1,  0 }, {  1,  0,  0 } },
+        { {  0,  0,  1 }, {  0, -1,  0 }, { -1,  0,  0 } },
+        { {  1,  0,  0 }, {  0,  0,  1 }, {  0,  1,  0 } },
+        { {  1,  0,  0 }, {  0,  0, -1 }, {  0, -1,  0 } },
+        { {  1,  0,  0 }, {  0, -1,  0 }, {  0,  0,  1 } },
+        { { -1,  0,  0 }, {  0, -1,  0 }, {  0,  0, -1 } },
+    };
 
-  m_size = QSize(w, h);
+    QMatrix4x4 m;
+    m.setColumn(0, QVector4D(axes[face][0], 0.f));
+    m.setColumn(1, QVector4D(axes[face][1], 0.f));
+    m.setColumn(2, QVector4D(-axes[face][2], 0.f));
+    m.setColumn(3, QVector4D(position, 1.f));
+    return m;
+}
 }
 
 // ------------------------------------------------------------
@@ -156,8 +129,6 @@ void VkRayTracer::init(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions
              << "shaderGroupHandleAlignment" << rtProps.shaderGroupHandleAlignment
              << "maxRayHitAttributeSize" << rtProps.maxRayHitAttributeSize;
 
-    m_rtProps = rtProps;
-
     // query acceleration structure feature flags
     VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures = {};
     asFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
@@ -174,69 +145,227 @@ void VkRayTracer::init(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions
     m_asFeatures = asFeatures;
 
     // load khr rt device functions
-    vkGetBufferDeviceAddressKHR = reinterpret_cast<PFN_vkGetBufferDeviceAddressKHR>(f->vkGetDeviceProcAddr(dev, "vkGetBufferDeviceAddressKHR"));
-    vkCmdBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(f->vkGetDeviceProcAddr(dev, "vkCmdBuildAccelerationStructuresKHR"));
-    vkBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkBuildAccelerationStructuresKHR>(f->vkGetDeviceProcAddr(dev, "vkBuildAccelerationStructuresKHR"));
-    vkCreateAccelerationStructureKHR = reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(f->vkGetDeviceProcAddr(dev, "vkCreateAccelerationStructureKHR"));
-    vkDestroyAccelerationStructureKHR = reinterpret_cast<PFN_vkDestroyAccelerationStructureKHR>(f->vkGetDeviceProcAddr(dev, "vkDestroyAccelerationStructureKHR"));
-    vkGetAccelerationStructureBuildSizesKHR = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(f->vkGetDeviceProcAddr(dev, "vkGetAccelerationStructureBuildSizesKHR"));
-    vkGetAccelerationStructureDeviceAddressKHR = reinterpret_cast<PFN_vkGetAccelerationStructureDeviceAddressKHR>(f->vkGetDeviceProcAddr(dev, "vkGetAccelerationStructureDeviceAddressKHR"));
     vkCmdTraceRaysKHR = reinterpret_cast<PFN_vkCmdTraceRaysKHR>(f->vkGetDeviceProcAddr(dev, "vkCmdTraceRaysKHR"));
-    vkGetRayTracingShaderGroupHandlesKHR = reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(f->vkGetDeviceProcAddr(dev, "vkGetRayTracingShaderGroupHandlesKHR"));
-    vkCreateRayTracingPipelinesKHR = reinterpret_cast<PFN_vkCreateRayTracingPipelinesKHR>(f->vkGetDeviceProcAddr(dev, "vkCreateRayTracingPipelinesKHR"));
 
-    // descriptor pool for as/image/ubo/ssbo
+    m_device  = dev;
+    m_f       = f;
+    m_df      = df;
+    m_physDev = physDev;
+
+    createColorPasses();
+    m_colorFormatDirty = false;
+
+    m_gpuTimer = std::make_unique<VkGpuTimer>(physDev, dev, f, df, FRAMES_IN_FLIGHT);
+    m_tileTimer = std::make_unique<VkGpuTimer>(physDev, dev, f, df, FRAMES_IN_FLIGHT, maxTiles + 1);
+    m_traceTimer = std::make_unique<VkGpuTimer>(physDev, dev, f, df, FRAMES_IN_FLIGHT);
+    m_rayQuerySupported = VkRtPipeline::supportsRayQuery(physDev, f);
+    if (!m_rayQuerySupported && (m_traceBackend == VkRtPipeline::RayQuery || m_backendBenchmark))
+        qWarning() << "ray queries are not supported by this device, tracing with the ray tracing pipeline";
+    m_rayDirections = std::make_unique<VkRayDirections>(physDev, dev, f, df, m_rtPipeline->pipelineCache(),
+                                                        FRAMES_IN_FLIGHT, FRAMES_IN_FLIGHT);
+    m_culling = std::make_unique<VkRtCulling>(physDev, dev, f, df, m_rtPipeline->pipelineCache(),
+                                              FRAMES_IN_FLIGHT, FRAMES_IN_FLIGHT);
+
+    // descriptor pool for as/image/ubo/ssbo: output and cubemap sets, each
+    // with a color, a hit distance and a ray direction image
     static const VkDescriptorPoolSize poolSizes[] = {
-        { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, FRAMES_IN_FLIGHT },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, FRAMES_IN_FLIGHT },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, FRAMES_IN_FLIGHT },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, FRAMES_IN_FLIGHT }
+        { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 2 * FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 6 * FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 * FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * FRAMES_IN_FLIGHT }
     };
     VkDescriptorPoolCreateInfo poolCreateInfo = {};
     poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolCreateInfo.maxSets = FRAMES_IN_FLIGHT * 1024; // keep a lot of headroom
+    poolCreateInfo.maxSets = 2 * FRAMES_IN_FLIGHT;
     poolCreateInfo.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]);
     poolCreateInfo.pPoolSizes = poolSizes;
     df->vkCreateDescriptorPool(dev, &poolCreateInfo, nullptr, &m_descPool);
 
-    // per-frame uniform buffers (projInv + viewInv)
-    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i)
-        m_uniformBuffers[i] = createHostVisibleBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, physDev, dev, f, df, 2 * 64 + 4);
+    // one descriptor set per frame slot, written once the scene is known
+    const VkDescriptorSetLayout layout = m_rtPipeline->descriptorSetLayout();
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {};
+    descSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descSetAllocInfo.descriptorPool = m_descPool;
+    descSetAllocInfo.descriptorSetCount = 1;
+    descSetAllocInfo.pSetLayouts = &layout;
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        df->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSets[i]);
+        df->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_cubeDescSets[i]);
+        m_descSetDirty[i] = true;
+    }
+
+    // per-frame uniform buffers (one camera entry per view / cube face); the
+    // output one is followed by the cameras of the previous frame
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        m_uniformBuffers[i] = createHostVisibleBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, physDev, dev, f, df, 2 * cameraUBOSize);
+        // kept mapped for the late latch
+        df->vkMapMemory(dev, m_uniformBuffers[i].mem, 0, m_uniformBuffers[i].size, 0,
+                        reinterpret_cast<void **>(&m_uniformMapped[i]));
+        m_cubeUniformBuffers[i] = createHostVisibleBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, physDev, dev, f, df, cameraUBOSize);
+    }
+
+    // bilinear lookups into the cubemap faces
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod = 0.f;
+    df->vkCreateSampler(dev, &samplerInfo, nullptr, &m_cubeSampler);
+    m_cubemapValid = false;
+
+    m_dummyDepth = createImage(physDev, dev, f, df, VK_FORMAT_R32_SFLOAT, QSize(1, 1), 1, VK_IMAGE_USAGE_STORAGE_BIT);
+    for (bool &valid : m_historyValid)
+        valid = false;
 
     m_lastOutputImageView = VK_NULL_HANDLE;
+}
 
-    m_device  = dev;
-    m_f       = f;
-    m_df      = df;
-    m_physDev = physDev;
+// ------------------------------------------------------------
+// pipeline and post passes accessing the color images, built for the
+// current color format
+// ------------------------------------------------------------
+void VkRayTracer::createColorPasses()
+{
+    // pipeline, layouts and sbt are shared by all the tracers of the device
+    m_rtPipeline = VkRtPipeline::forDevice(m_physDev, m_device, m_f, m_df, m_colorFormat);
+
+    const QLatin1String variant{vkrt::shaderVariant(m_colorFormat)};
+    const VkPipelineCache cache = m_rtPipeline->pipelineCache();
+    m_foveationFill = std::make_unique<VkComputePass>(
+        m_device, m_df, cache, QStringLiteral(":/shaders/foveation_fill.comp%1.spv").arg(variant),
+        std::vector<VkDescriptorType>{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                       VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+        0, FRAMES_IN_FLIGHT);
+    m_cubemapResample = std::make_unique<VkComputePass>(
+        m_device, m_df, cache, QStringLiteral(":/shaders/cubemap_resample.comp%1.spv").arg(variant),
+        std::vector<VkDescriptorType>{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
+        0, FRAMES_IN_FLIGHT);
+    const VkDescriptorType storageImage = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    m_temporalResolve = std::make_unique<VkComputePass>(
+        m_device, m_df, cache, QStringLiteral(":/shaders/temporal_resolve.comp%1.spv").arg(variant),
+        std::vector<VkDescriptorType>{ storageImage, storageImage, storageImage, storageImage, storageImage, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
+        sizeof(int32_t), FRAMES_IN_FLIGHT);
+    m_upscale = std::make_unique<VkComputePass>(
+        m_device, m_df, cache, QStringLiteral(":/shaders/upscale.comp%1.spv").arg(variant),
+        std::vector<VkDescriptorType>{ storageImage, storageImage },
+        0, FRAMES_IN_FLIGHT);
 }
 
-static const char entryPoint[] = "main";
+void VkRayTracer::setColorFormat(vkrt::ColorFormat format)
+{
+    if (format == m_colorFormat)
+        return;
+    m_colorFormat = format;
+    m_colorFormatDirty = m_rtPipeline != nullptr;
+    m_outputDirty = true;
+}
+
+// ------------------------------------------------------------
+// color format change: new pipeline and passes, the previous ones and the
+// images in the previous format are retired until no frame uses them
+// ------------------------------------------------------------
+void VkRayTracer::applyColorFormat()
+{
+    m_retiredPasses.emplace_back(std::move(m_rtPipeline), m_frameCounter);
+    for (auto *pass : { &m_foveationFill, &m_cubemapResample, &m_temporalResolve, &m_upscale })
+        m_retiredPasses.emplace_back(std::shared_ptr<VkComputePass>(std::move(*pass)), m_frameCounter);
+    createColorPasses();
+
+    retireImage(m_cubemap);
+    m_cubemapValid = false;
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        retireImage(m_historyColor[i]);
+        retireImage(m_historyDepth[i]);
+        m_historyValid[i] = false;
+    }
+    retireImage(m_traceTarget);
+
+    for (bool &dirty : m_descSetDirty)
+        dirty = true;
+    m_colorFormatDirty = false;
+}
 
 // ------------------------------------------------------------
-// helper to load spir-v and create shader stage info
+// free everything owned by this tracer
 // ------------------------------------------------------------
-static VkPipelineShaderStageCreateInfo getShader(const QString &name, VkShaderStageFlagBits stage, VkDevice dev, QVulkanDeviceFunctions *df)
+void VkRayTracer::release()
 {
-    QFile f(name);
-    if (!f.open(QIODevice::ReadOnly))
-        qFatal("Failed to open %s", qPrintable(name));
-    const QByteArray data = f.readAll();
+    if (!m_device)
+        return;
+
+    // resources may still be referenced by frames in flight
+    m_df->vkDeviceWaitIdle(m_device);
+
+    // shared scenes are only freed with their last tracer
+    m_scene.reset();
+    m_retiredScenes.clear();
 
-    VkShaderModuleCreateInfo shaderInfo = {};
-    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderInfo.codeSize = data.size();
-    shaderInfo.pCode = reinterpret_cast<const quint32 *>(data.constData());
-    VkShaderModule module;
-    df->vkCreateShaderModule(dev, &shaderInfo, nullptr, &module);
+    for (auto &retired : m_retiredImages)
+        freeImage(retired.first, m_device, m_df);
+    m_retiredImages.clear();
+    m_retiredPasses.clear();
+    if (m_traceTarget.image)
+        freeImage(m_traceTarget, m_device, m_df);
+    m_traceTarget = {};
 
-    VkPipelineShaderStageCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    info.stage = stage;
-    info.module = module;
-    info.pName = entryPoint;
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i)
+    {
+        if (m_uniformMapped[i])
+            m_df->vkUnmapMemory(m_device, m_uniformBuffers[i].mem);
+        m_uniformMapped[i] = nullptr;
+        m_latchable[i] = false;
+        freeBuffer(m_uniformBuffers[i], m_device, m_df);
+        m_uniformBuffers[i] = {};
+    }
+    for (Buffer &b : m_cubeUniformBuffers)
+    {
+        freeBuffer(b, m_device, m_df);
+        b = {};
+    }
 
-    return info;
+    if (m_cubemap.image)
+        freeImage(m_cubemap, m_device, m_df);
+    m_cubemap = {};
+    m_cubemapValid = false;
+    m_df->vkDestroySampler(m_device, m_cubeSampler, nullptr);
+    m_cubeSampler = VK_NULL_HANDLE;
+
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        if (m_historyColor[i].image)
+            freeImage(m_historyColor[i], m_device, m_df);
+        if (m_historyDepth[i].image)
+            freeImage(m_historyDepth[i], m_device, m_df);
+        m_historyColor[i] = {};
+        m_historyDepth[i] = {};
+        m_historyValid[i] = false;
+    }
+    freeImage(m_dummyDepth, m_device, m_df);
+    m_dummyDepth = {};
+
+    m_df->vkDestroyDescriptorPool(m_device, m_descPool, nullptr);
+    m_descPool = VK_NULL_HANDLE;
+
+    m_foveationFill.reset();
+    m_cubemapResample.reset();
+    m_temporalResolve.reset();
+    m_upscale.reset();
+    m_gpuTimer.reset();
+    m_tileTimer.reset();
+    m_traceTimer.reset();
+    m_rayDirections.reset();
+    m_culling.reset();
+    for (VkAccelerationStructureKHR &tlas : m_slotTlas)
+        tlas = VK_NULL_HANDLE;
+    m_tiles.clear();
+    m_tileGridSize = QSize();
+    for (std::vector<int> &tiles : m_slotTiles)
+        tiles.clear();
+    m_rtPipeline.reset();
+    m_device = VK_NULL_HANDLE;
 }
 
 // ------------------------------------------------------------
@@ -254,415 +383,173 @@ VkImageLayout VkRayTracer::render(QVulkanInstance *inst,
                                uint currentFrameSlot,
                                const QSize &pixelSize)
 {
-  // setup path: first frame or render target view changed
-  if (!m_vertexBuffer.buf || (m_lastOutputImageView && m_lastOutputImageView != outputImageView)) {
-      qDebug("ray tracing setup");
-      m_lastOutputImageView = outputImageView;
-
-      QElapsedTimer timer;
-      timer.start();
-      qDebug() << "[TIMESTAMP] setup started at: " << QDateTime::currentDateTime().toString(Qt::ISODateWithMs);
-
-      // use a single cube mesh for the BLAS
-      std::vector<float>    all_vertices(cube_verts_template,   cube_verts_template + 24);
-      std::vector<uint32_t> all_indices (cube_indices_template, cube_indices_template + 36);
-      qDebug() << "using single cube template with" << all_vertices.size() / 3 << "vertices and" << all_indices.size() << "indices for BLAS.";
-
-      // upload cube mesh to gpu
-      m_vertexBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-                                               physDev, dev, f, df, all_vertices.size() * sizeof(float));
-      updateHostData(m_vertexBuffer, dev, df, all_vertices.data(), all_vertices.size() * sizeof(float));
-
-      m_indexBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-                                              physDev, dev, f, df, all_indices.size() * sizeof(uint32_t));
-      updateHostData(m_indexBuffer, dev, df, all_indices.data(), all_indices.size() * sizeof(uint32_t));
-
-      // color buffer (one vec4 per point)
-      std::vector<QVector4D> all_colors;
-      all_colors.reserve(m_point_colors.size());
-      for (size_t i = 0; i < m_point_colors.size(); ++i)
-        all_colors.push_back(m_point_colors[i]);
-
-      m_colorBuffer = createHostVisibleBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                                              physDev, dev, f, df, all_colors.size() * sizeof(QVector4D));
-      updateHostData(m_colorBuffer, dev, df, all_colors.data(), all_colors.size() * sizeof(QVector4D));
-
-      // --------------------------------------------------------
-      // build BLAS: triangles (single cube)
-      // --------------------------------------------------------
-      qDebug() << "[TIMESTAMP] BLAS creation started at" << timer.elapsed() << "ms.";
-      VkDeviceOrHostAddressConstKHR vertexBufferDeviceAddress = {};
-      vertexBufferDeviceAddress.deviceAddress = m_vertexBuffer.addr;
-      VkDeviceOrHostAddressConstKHR indexBufferDeviceAddress = {};
-      indexBufferDeviceAddress.deviceAddress = m_indexBuffer.addr;
-
-      VkAccelerationStructureGeometryKHR asGeom = {};
-      asGeom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-      asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR; // keep opaque for fastest path
-      asGeom.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-      asGeom.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-      asGeom.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-      asGeom.geometry.triangles.vertexData = vertexBufferDeviceAddress;
-      asGeom.geometry.triangles.vertexStride = 3 * sizeof(float);
-      asGeom.geometry.triangles.maxVertex = (all_vertices.size() / 3) - 1;
-      asGeom.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-      asGeom.geometry.triangles.indexData = indexBufferDeviceAddress;
-
-      VkAccelerationStructureBuildGeometryInfoKHR asBuildGeomInfo = {};
-      asBuildGeomInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-      asBuildGeomInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-      asBuildGeomInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR; // you can swap to FAST_BUILD if startup matters more
-      asBuildGeomInfo.geometryCount = 1;
-      asBuildGeomInfo.pGeometries = &asGeom;
-
-      const uint32_t primitiveCountPerGeometry = static_cast<uint32_t>(all_indices.size() / 3);
-      VkAccelerationStructureBuildSizesInfoKHR sizeInfo = {};
-      sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-      vkGetAccelerationStructureBuildSizesKHR(dev,
-                                              VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-                                              &asBuildGeomInfo,
-                                              &primitiveCountPerGeometry,
-                                              &sizeInfo);
-
-      qDebug() << "blas buffer size" << sizeInfo.accelerationStructureSize;
-      m_blasBuffer = createASBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
-                                    physDev, dev, f, df, sizeInfo.accelerationStructureSize);
-
-      VkAccelerationStructureCreateInfoKHR asCreateInfo = {};
-      asCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-      asCreateInfo.buffer = m_blasBuffer.buf;
-      asCreateInfo.size = sizeInfo.accelerationStructureSize;
-      asCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-      vkCreateAccelerationStructureKHR(dev, &asCreateInfo, nullptr, &m_blas);
-
-      qDebug() << "blas scratch buffer size" << sizeInfo.buildScratchSize;
-      Buffer scratchBLAS = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                          physDev, dev, f, df, sizeInfo.buildScratchSize);
-
-      memset(&asBuildGeomInfo, 0, sizeof(asBuildGeomInfo));
-      asBuildGeomInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-      asBuildGeomInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-      asBuildGeomInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-      asBuildGeomInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-      asBuildGeomInfo.dstAccelerationStructure = m_blas;
-      asBuildGeomInfo.geometryCount = 1;
-      asBuildGeomInfo.pGeometries = &asGeom;
-      asBuildGeomInfo.scratchData.deviceAddress = scratchBLAS.addr;
-
-      VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfo = {};
-      asBuildRangeInfo.primitiveCount = primitiveCountPerGeometry;
-      asBuildRangeInfo.primitiveOffset = 0;
-      asBuildRangeInfo.firstVertex = 0;
-      asBuildRangeInfo.transformOffset = 0;
-
-      VkAccelerationStructureBuildRangeInfoKHR *rangeInfo = &asBuildRangeInfo;
-
-      // record build on command buffer (nvidia typically reports no host build)
-      vkCmdBuildAccelerationStructuresKHR(cb, 1, &asBuildGeomInfo, &rangeInfo);
-
-      // get device address for this BLAS
-      VkAccelerationStructureDeviceAddressInfoKHR asAddrInfo = {};
-      asAddrInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-      asAddrInfo.accelerationStructure = m_blas;
-      m_blasAddr = vkGetAccelerationStructureDeviceAddressKHR(dev, &asAddrInfo);
-
-      // barrier to make blas build visible before tlas build
-      {
-        VkMemoryBarrier memoryBarrier = {};
-        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-        const VkAccessFlags accelAccess = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-        memoryBarrier.srcAccessMask = accelAccess;
-        memoryBarrier.dstAccessMask = accelAccess;
-        df->vkCmdPipelineBarrier(cb,
-                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-                                 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
-      }
-
-      // --------------------------------------------------------
-      // build TLAS: instance the single cube for each point
-      // --------------------------------------------------------
-      qDebug() << "[TIMESTAMP] TLAS creation started at" << timer.elapsed() << "ms.";
-
-      // create instances array with per-instance translate (and custom index)
-      std::vector<VkAccelerationStructureInstanceKHR> instances;
-      instances.reserve(m_point_positions.size());
-
-      const float scale = 5.f; // your scene scale
-      for (size_t i = 0; i < m_point_positions.size(); ++i) {
-        const auto& pos = m_point_positions[i];
+  // nothing to latch unless this frame traces
+  m_latchable[currentFrameSlot] = false;
+  if (!m_scene)
+      return currentOutputImageLayout;
+
+  const uint32_t viewCount = uint32_t(m_cameras.size());
+
+  // dynamic resolution: gpu time of the last frame of this slot
+  if (m_dynamicResolution) {
+      const double gpuMs = m_gpuTimer->collect(currentFrameSlot);
+      if (gpuMs >= 0.)
+          updateResolutionScale(gpuMs);
+  }
+  // backend benchmark: trace time of the last frame of this slot
+  {
+      const double traceMs = m_traceTimer->collect(currentFrameSlot);
+      if (traceMs >= 0.)
+          recordBackendTime(m_slotBackends[currentFrameSlot], traceMs);
+  }
+  const QSize traceSize = m_resolutionScale < 1.f ? scaledSize(pixelSize, m_resolutionScale) : pixelSize;
+  const bool upscale = traceSize != pixelSize;
+
+  // caching: the output still holds the last frame, which nothing changed
+  const bool inputsChanged = m_outputDirty || m_boundSceneGeneration != m_sceneGeneration
+                             || m_lastOutputImageView != outputImageView || m_lastPixelSize != pixelSize
+                             || m_lastTraceSize != traceSize;
+  if (m_caching && !inputsChanged && m_convergenceFrames == 0
+      && m_refinementStride == 1 && m_refinedStride == 0 && !m_tilePassPending)
+      return currentOutputImageLayout;
+
+  // progressive refinement: every change restarts from the coarsest lattice,
+  // each pass then traces the next finer one into the same image. With tile
+  // scheduling, the current pass is abandoned for a new one.
+  if (inputsChanged) {
+      m_refinementStride = m_progressiveStride;
+      m_refinedStride = 0;
+      m_changePass = ++m_tracePass;
+  }
+  const int refinementStride = m_refinementStride;
+  const int refinedStride = m_refinedStride;
+
+  // scenes and images replaced since are kept until no frame in flight uses them
+  ++m_frameCounter;
+  while (!m_retiredScenes.empty() && m_frameCounter - m_retiredScenes.front().second > FRAMES_IN_FLIGHT)
+      m_retiredScenes.pop_front();
+  while (!m_retiredImages.empty() && m_frameCounter - m_retiredImages.front().second > FRAMES_IN_FLIGHT) {
+      freeImage(m_retiredImages.front().first, m_device, m_df);
+      m_retiredImages.pop_front();
+  }
+  while (!m_retiredPasses.empty() && m_frameCounter - m_retiredPasses.front().second > FRAMES_IN_FLIGHT)
+      m_retiredPasses.pop_front();
+
+  if (m_colorFormatDirty)
+      applyColorFormat();
+
+  // the passes below all work at the trace size: directly in the output,
+  // or in the reduced target when upscaling
+  ensureTraceTarget(traceSize, viewCount, upscale);
+  const VkImageView traceImageView = upscale ? m_traceTarget.view : outputImageView;
+
+  // one-time per scene: upload + blas / tlas build, unless another tracer
+  // sharing this scene already did it
+  m_scene->ensureBuilt(cb, physDev, dev, f, df, m_rtPipeline->pipelineCache());
+
+  // views using a cubemap mode are resampled from faces traced around the
+  // first of them; the others are traced directly
+  const auto cubeCamera = std::find_if(m_cameras.begin(), m_cameras.end(), [] (const vkfrt::CameraState &cam) {
+      return vkfrt::usesCubemap(cam.projectionMode);
+  });
+  const bool hasCubeViews = cubeCamera != m_cameras.end();
+  const bool hasDirectViews = std::any_of(m_cameras.begin(), m_cameras.end(), [] (const vkfrt::CameraState &cam) {
+      return !vkfrt::usesCubemap(cam.projectionMode);
+  });
+  if (hasCubeViews)
+      ensureCubemap(traceSize);
+
+  // temporal mode: history targets while a view uses it, dropped with the
+  // scene it shows
+  const bool temporal = std::any_of(m_cameras.begin(), m_cameras.end(), [] (const vkfrt::CameraState &cam) {
+      return temporalInterleave(cam) > 0;
+  });
+  ensureHistory(traceSize, viewCount, temporal);
+  if (m_historySceneGeneration != m_sceneGeneration) {
+      m_historySceneGeneration = m_sceneGeneration;
+      for (bool &valid : m_historyValid)
+          valid = false;
+  }
+  const uint previousFrameSlot = (currentFrameSlot + 1) % FRAMES_IN_FLIGHT;
 
-        VkAccelerationStructureInstanceKHR instance = {};
-        QMatrix4x4 instanceTransform; // identity
-        instanceTransform.translate(pos.x() * scale, pos.y() * scale, pos.z() * scale);
+  // precomputed ray directions of the fulldome and calibrated views
+  if (m_rayDirections->ensure(m_cameras, traceSize, m_frameCounter)) {
+      for (bool &dirty : m_descSetDirty)
+          dirty = true;
+  }
 
-        // vulkan wants 3x4 row-major; qmatrix4x4 is column-major → transpose then copy 12 floats
-        instanceTransform = instanceTransform.transposed();
-        memcpy(instance.transform.matrix, instanceTransform.constData(), 12 * sizeof(float));
+  // descriptors follow the scene and the render target view; each slot is
+  // rewritten when it comes back, as it is not in use by the gpu anymore
+  if (m_boundSceneGeneration != m_sceneGeneration || m_lastOutputImageView != outputImageView
+      || m_lastTraceImageView != traceImageView) {
+      m_boundSceneGeneration = m_sceneGeneration;
+      m_lastOutputImageView = outputImageView;
+      m_lastTraceImageView = traceImageView;
+      for (bool &dirty : m_descSetDirty)
+          dirty = true;
+  }
 
-        instance.instanceCustomIndex = static_cast<uint32_t>(i); // used in rchit via gl_InstanceCustomIndexEXT
-        instance.mask = 0xFF;
-        instance.instanceShaderBindingTableRecordOffset = 0;
-        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        instance.accelerationStructureReference = m_blasAddr;
+  if (m_descSetDirty[currentFrameSlot]) {
+      writeDescriptorSet(currentFrameSlot, traceImageView, outputImageView);
+      m_descSetDirty[currentFrameSlot] = false;
+  }
 
-        instances.push_back(instance);
-      }
-      qDebug() << "created" << instances.size() << "instances for the tlas build.";
-
-      // upload instances
-      m_instanceBuffer = createHostVisibleBuffer(
-          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-          physDev, dev, f, df,
-          static_cast<uint32_t>(instances.size() * sizeof(VkAccelerationStructureInstanceKHR)));
-      updateHostData(m_instanceBuffer, dev, df, instances.data(),
-                     instances.size() * sizeof(VkAccelerationStructureInstanceKHR));
-
-      VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress = {};
-      instanceDataDeviceAddress.deviceAddress = m_instanceBuffer.addr;
-
-      VkAccelerationStructureGeometryKHR asGeomTLAS = {};
-      asGeomTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-      asGeomTLAS.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-      asGeomTLAS.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-      asGeomTLAS.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-      asGeomTLAS.geometry.instances.arrayOfPointers = VK_FALSE;
-      asGeomTLAS.geometry.instances.data = instanceDataDeviceAddress;
-
-      VkAccelerationStructureBuildGeometryInfoKHR asBuildGeomInfoTLAS = {};
-      asBuildGeomInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-      asBuildGeomInfoTLAS.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-      asBuildGeomInfoTLAS.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-      asBuildGeomInfoTLAS.geometryCount = 1;
-      asBuildGeomInfoTLAS.pGeometries = &asGeomTLAS;
-
-      const uint32_t tlasCount = static_cast<uint32_t>(instances.size());
-      VkAccelerationStructureBuildSizesInfoKHR sizeInfoTLAS = {};
-      sizeInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-      vkGetAccelerationStructureBuildSizesKHR(dev,
-                                              VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-                                              &asBuildGeomInfoTLAS,
-                                              &tlasCount,
-                                              &sizeInfoTLAS);
-
-      qDebug() << "tlas buffer size" << sizeInfoTLAS.accelerationStructureSize;
-      m_tlasBuffer = createASBuffer(VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
-                                    physDev, dev, f, df, sizeInfoTLAS.accelerationStructureSize);
-
-      VkAccelerationStructureCreateInfoKHR asCreateInfoTLAS = {};
-      asCreateInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-      asCreateInfoTLAS.buffer = m_tlasBuffer.buf;
-      asCreateInfoTLAS.size = sizeInfoTLAS.accelerationStructureSize;
-      asCreateInfoTLAS.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-      vkCreateAccelerationStructureKHR(dev, &asCreateInfoTLAS, nullptr, &m_tlas);
-
-      qDebug() << "tlas scratch buffer size" << sizeInfoTLAS.buildScratchSize;
-      Buffer scratchTLAS = createASBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                          physDev, dev, f, df, sizeInfoTLAS.buildScratchSize);
-
-      memset(&asBuildGeomInfoTLAS, 0, sizeof(asBuildGeomInfoTLAS));
-      asBuildGeomInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-      asBuildGeomInfoTLAS.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-      asBuildGeomInfoTLAS.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-      asBuildGeomInfoTLAS.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-      asBuildGeomInfoTLAS.dstAccelerationStructure = m_tlas;
-      asBuildGeomInfoTLAS.geometryCount = 1;
-      asBuildGeomInfoTLAS.pGeometries = &asGeomTLAS;
-      asBuildGeomInfoTLAS.scratchData.deviceAddress = scratchTLAS.addr;
-
-      VkAccelerationStructureBuildRangeInfoKHR asBuildRangeInfoTLAS = {};
-      asBuildRangeInfoTLAS.primitiveCount = tlasCount;
-      asBuildRangeInfoTLAS.primitiveOffset = 0;
-      asBuildRangeInfoTLAS.firstVertex = 0;
-      asBuildRangeInfoTLAS.transformOffset = 0;
-
-      VkAccelerationStructureBuildRangeInfoKHR *rangeInfoTLAS = &asBuildRangeInfoTLAS;
-      vkCmdBuildAccelerationStructuresKHR(cb, 1, &asBuildGeomInfoTLAS, &rangeInfoTLAS);
-
-      // fetch tlas device address
-      VkAccelerationStructureDeviceAddressInfoKHR asAddrInfoTLAS = {};
-      asAddrInfoTLAS.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-      asAddrInfoTLAS.accelerationStructure = m_tlas;
-      m_tlasAddr = vkGetAccelerationStructureDeviceAddressKHR(dev, &asAddrInfoTLAS);
-
-      qDebug() << "[TIMESTAMP] TLAS creation finished at" << timer.elapsed() << "ms.";
-
-      // --------------------------------------------------------
-      // pipeline (rgen/rmiss/rchit), sbt, descriptors
-      // --------------------------------------------------------
-      // descriptor set layout: 0=tlas, 1=output image, 2=ubo, 3=colors
-      VkDescriptorSetLayoutBinding asLayoutBinding = {};
-      asLayoutBinding.binding = 0;
-      asLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-      asLayoutBinding.descriptorCount = 1;
-      asLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
-
-      VkDescriptorSetLayoutBinding outputLayoutBinding = {};
-      outputLayoutBinding.binding = 1;
-      outputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-      outputLayoutBinding.descriptorCount = 1;
-      outputLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
-
-      VkDescriptorSetLayoutBinding ubLayoutBinding = {};
-      ubLayoutBinding.binding = 2;
-      ubLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-      ubLayoutBinding.descriptorCount = 1;
-      ubLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
-
-      VkDescriptorSetLayoutBinding colorLayoutBinding = {};
-      colorLayoutBinding.binding = 3;
-      colorLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-      colorLayoutBinding.descriptorCount = 1;
-      colorLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-
-      const VkDescriptorSetLayoutBinding bindings[4] = {
-          asLayoutBinding,
-          outputLayoutBinding,
-          ubLayoutBinding,
-          colorLayoutBinding,
-      };
-
-      VkDescriptorSetLayoutCreateInfo descSetLayoutCreateInfo = {};
-      descSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-      descSetLayoutCreateInfo.bindingCount = 4;
-      descSetLayoutCreateInfo.pBindings = bindings;
-      df->vkCreateDescriptorSetLayout(dev, &descSetLayoutCreateInfo, nullptr, &m_descSetLayout);
-
-      VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-      pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-      pipelineLayoutCreateInfo.setLayoutCount = 1;
-      pipelineLayoutCreateInfo.pSetLayouts = &m_descSetLayout;
-      df->vkCreatePipelineLayout(dev, &pipelineLayoutCreateInfo, nullptr, &m_pipelineLayout);
-
-      VkPipelineShaderStageCreateInfo stages[3] = {
-          getShader(":/shaders/raygen.rgen.spv", VK_SHADER_STAGE_RAYGEN_BIT_KHR, dev, df),
-          getShader(":/shaders/miss.rmiss.spv", VK_SHADER_STAGE_MISS_BIT_KHR, dev, df),
-          getShader(":/shaders/closesthit.rchit.spv", VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, dev, df)
-      };
-
-      VkRayTracingShaderGroupCreateInfoKHR shaderGroups[3];
-      {
-        // rgen group
-        VkRayTracingShaderGroupCreateInfoKHR g = {};
-        g.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR;
-        g.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
-        g.generalShader = 0;
-        g.closestHitShader = VK_SHADER_UNUSED_KHR;
-        g.anyHitShader = VK_SHADER_UNUSED_KHR;
-        g.intersectionShader = VK_SHADER_UNUSED_KHR;
-        shaderGroups[0] = g;
-
-        // rmiss group
-        g.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
-        g.generalShader = 1;
-        g.closestHitShader = VK_SHADER_UNUSED_KHR;
-        shaderGroups[1] = g;
-
-        // triangles hit group
-        g.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
-        g.generalShader = VK_SHADER_UNUSED_KHR;
-        g.closestHitShader = 2;
-        g.anyHitShader = VK_SHADER_UNUSED_KHR;
-        g.intersectionShader = VK_SHADER_UNUSED_KHR;
-        shaderGroups[2] = g;
+  // visibility culling: the views traced directly get a tlas of the chunks
+  // they see; late latched views may turn a little past them
+  {
+      constexpr float latchMarginDegrees = 15.f;
+      const VkAccelerationStructureKHR tlas = m_visibilityCulling
+          ? m_culling->record(cb, currentFrameSlot, *m_scene, m_sceneGeneration, m_cameras, traceSize,
+                              m_lateLatch ? latchMarginDegrees : 0.f, m_frameCounter)
+          : m_scene->tlas();
+      if (tlas != m_slotTlas[currentFrameSlot]) {
+          writeTlasDescriptor(m_descSets[currentFrameSlot], tlas);
+          m_slotTlas[currentFrameSlot] = tlas;
       }
+  }
 
-      VkRayTracingPipelineCreateInfoKHR pipelineCreateInfo = {};
-      pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
-      pipelineCreateInfo.stageCount = 3;
-      pipelineCreateInfo.pStages = stages;
-      pipelineCreateInfo.groupCount = 3;
-      pipelineCreateInfo.pGroups = shaderGroups;
-      pipelineCreateInfo.maxPipelineRayRecursionDepth = 1;
-      pipelineCreateInfo.layout = m_pipelineLayout;
-      vkCreateRayTracingPipelinesKHR(dev, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &m_pipeline);
-
-      // shader binding table (rgen, miss, hit)
-      const uint32_t handleSize = m_rtProps.shaderGroupHandleSize;
-      const uint32_t handleSizeAligned = aligned(handleSize, m_rtProps.shaderGroupHandleAlignment);
-      const uint32_t groupSize = 3;
-      const uint32_t handleListByteSize = groupSize * handleSize;
-
-      std::vector<uint8_t> handles(handleListByteSize);
-      vkGetRayTracingShaderGroupHandlesKHR(dev, m_pipeline, 0, groupSize, handleListByteSize, handles.data());
-
-      // sbt entry stride must honor handle alignment and base alignment
-      const uint32_t sbtBufferEntrySize = aligned(handleSizeAligned, m_rtProps.shaderGroupBaseAlignment);
-      const uint32_t sbtBufferSize = groupSize * sbtBufferEntrySize;
-
-      m_sbt = createHostVisibleBuffer(VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
-                                      physDev, dev, f, df, sbtBufferSize);
-      std::vector<uint8_t> sbtBufData(sbtBufferSize);
-      for (uint32_t i = 0; i < groupSize; ++i)
-        memcpy(sbtBufData.data() + i * sbtBufferEntrySize, handles.data() + i * handleSize, handleSize);
-      updateHostData(m_sbt, dev, df, sbtBufData.data(), sbtBufferSize);
-
-      // allocate and update descriptor sets for each frame-in-flight
-      VkDescriptorSetAllocateInfo descSetAllocInfo = {};
-      descSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-      descSetAllocInfo.descriptorPool = m_descPool;
-      descSetAllocInfo.descriptorSetCount = 1;
-      descSetAllocInfo.pSetLayouts = &m_descSetLayout;
+  // ----------------------------------------------------------
+  // per-frame: make the acceleration structure builds visible to the trace
+  // ----------------------------------------------------------
+  {
+      VkMemoryBarrier memoryBarrier = {};
+      memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+      memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+      df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                               VkRtPipeline::traceStages,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+  }
 
-      for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-        df->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_descSets[i]);
+  if (m_dynamicResolution)
+      m_gpuTimer->begin(cb, currentFrameSlot);
 
-        // binding 0: tlas
-        VkWriteDescriptorSetAccelerationStructureKHR descSetAS = {};
-        descSetAS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
-        descSetAS.accelerationStructureCount = 1;
-        descSetAS.pAccelerationStructures = &m_tlas;
-
-        VkWriteDescriptorSet asWrite = {};
-        asWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        asWrite.pNext = &descSetAS;
-        asWrite.dstSet = m_descSets[i];
-        asWrite.dstBinding = 0;
-        asWrite.descriptorCount = 1;
-        asWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-
-        // binding 1: storage image (raytracing output)
-        VkDescriptorImageInfo descOutputImage = {};
-        descOutputImage.imageView = outputImageView;
-        descOutputImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-        VkWriteDescriptorSet imageWrite = {};
-        imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        imageWrite.dstSet = m_descSets[i];
-        imageWrite.dstBinding = 1;
-        imageWrite.descriptorCount = 1;
-        imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-        imageWrite.pImageInfo = &descOutputImage;
-
-        // binding 2: uniform buffer (projInv + viewInv)
-        VkDescriptorBufferInfo descUniformBuffer = {};
-        descUniformBuffer.buffer = m_uniformBuffers[i].buf;
-        descUniformBuffer.range = VK_WHOLE_SIZE;
-
-        VkWriteDescriptorSet ubWrite = {};
-        ubWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        ubWrite.dstSet = m_descSets[i];
-        ubWrite.dstBinding = 2;
-        ubWrite.descriptorCount = 1;
-        ubWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        ubWrite.pBufferInfo = &descUniformBuffer;
-
-        // binding 3: color buffer (vec4 per point)
-        VkDescriptorBufferInfo colorBufferInfo = { m_colorBuffer.buf, 0, m_colorBuffer.size };
-
-        VkWriteDescriptorSet colorWrite = {};
-        colorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        colorWrite.dstSet = m_descSets[i];
-        colorWrite.dstBinding = 3;
-        colorWrite.descriptorCount = 1;
-        colorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        colorWrite.pBufferInfo = &colorBufferInfo;
-
-        VkWriteDescriptorSet writeSets[] = { asWrite, imageWrite, ubWrite, colorWrite };
-        df->vkUpdateDescriptorSets(dev, 4, writeSets, 0, VK_NULL_HANDLE);
+  // ----------------------------------------------------------
+  // per-frame: hit distance targets, and the history written by the
+  // resolve of the previous frames
+  // ----------------------------------------------------------
+  if (m_dummyDepth.layout != VK_IMAGE_LAYOUT_GENERAL)
+      transitionImage(df, cb, m_dummyDepth, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VkRtPipeline::traceStages);
+  if (temporal) {
+      for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+          for (vkrt::Image *img : { &m_historyColor[i], &m_historyDepth[i] }) {
+              if (img->layout != VK_IMAGE_LAYOUT_GENERAL)
+                  transitionImage(df, cb, *img, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                  VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+          }
       }
 
-      qDebug() << "[TIMESTAMP] full setup finished in " << timer.elapsed() << "ms.";
+      VkMemoryBarrier memoryBarrier = {};
+      memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
   }
 
   // ----------------------------------------------------------
@@ -675,78 +562,239 @@ VkImageLayout VkRayTracer::render(QVulkanInstance *inst,
       barrier.subresourceRange.baseMipLevel = 0;
       barrier.subresourceRange.levelCount = 1;
       barrier.subresourceRange.baseArrayLayer = 0;
-      barrier.subresourceRange.layerCount = 1;
+      barrier.subresourceRange.layerCount = viewCount;
       barrier.oldLayout = currentOutputImageLayout;
       barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-      barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      // sampled by the consumer, or rendered to when it is a render target
+      barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
       barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
       barrier.image = outputImage;
 
       df->vkCmdPipelineBarrier(cb,
-                               VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                               VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                                0, 0, nullptr, 0, nullptr,
                                1, &barrier);
   }
+  if (upscale && m_traceTarget.layout != VK_IMAGE_LAYOUT_GENERAL)
+      transitionImage(df, cb, m_traceTarget, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
   // ----------------------------------------------------------
-  // per-frame: update camera (view/proj) and upload to ubo
+  // per-frame: update cameras (view/proj) and upload to ubo, followed by
+  // the cameras the previous history was rendered with
   // ----------------------------------------------------------
+  const std::vector<uchar> &previousCameras = m_historyCameras[previousFrameSlot];
+  const bool historyValid = temporal && m_historyValid[previousFrameSlot]
+                            && previousCameras.size() == viewCount * cameraUBOStride;
+  // trace backend of this frame, alternating while benchmarking
+  const VkRtPipeline::Backend backend = frameBackend();
+  // trace specialization of the views traced directly: their common
+  // projection mode, and the features at least one of them uses
+  VkRtPipeline::Variant directVariant{ m_cameras.front().projectionMode, 0, backend,
+                                       m_queryGroupWidth, m_queryGroupHeight };
   {
-    QVector3D upVector = QVector3D(0.0f, 1.0f, 0.0f); // world up
-    m_view.setToIdentity();
-    m_view.lookAt(m_cameraPosition, m_cameraCenter, upVector);
-
-    m_proj.setToIdentity();
-    m_proj.perspective(m_fov, float(pixelSize.width()) / pixelSize.height(), 0.1f, 512.0f);
+    uchar ubData[2 * cameraUBOSize] = {};
+    for (uint32_t v = 0; v < viewCount; ++v) {
+      const vkfrt::CameraState &cam = m_cameras[v];
+      const int32_t interleave = temporalInterleave(cam);
+      const bool refining = refines(cam) && (refinementStride > 1 || refinedStride > 0);
+      const VkRayDirections::Mode directions = VkRayDirections::mode(cam);
+      writeCameraEntry(ubData + v * cameraUBOStride, cam,
+                       vkfrt::projectionMatrix(cam, traceSize).inverted(),
+                       vkfrt::viewMatrix(cam).inverted(),
+                       interleave, m_temporalPhase,
+                       refining ? refinementStride : 1,
+                       refining ? refinedStride : 0,
+                       directions);
+
+      if (cam.projectionMode != directVariant.projectionMode)
+          directVariant.projectionMode = -1;
+      if (cam.domeMask)
+          directVariant.features |= VkRtPipeline::DomeMask;
+      if (cam.foveation && interleave == 0)
+          directVariant.features |= VkRtPipeline::Foveation;
+      if (interleave != 0)
+          directVariant.features |= VkRtPipeline::TemporalInterleave;
+      if (refining)
+          directVariant.features |= VkRtPipeline::ProgressiveRefinement;
+      if (directions != VkRayDirections::None)
+          directVariant.features |= VkRtPipeline::DirectionLut;
+    }
 
-    m_projInv = m_proj.inverted();
-    m_viewInv = m_view.inverted();
+    if (historyValid)
+      memcpy(ubData + cameraUBOSize, previousCameras.data(), previousCameras.size());
+    if (temporal)
+      m_historyCameras[currentFrameSlot].assign(ubData, ubData + viewCount * cameraUBOStride);
 
-    uchar ubData[136];
-    memcpy(ubData,        m_projInv.constData(), 64);
-    memcpy(ubData + 64,   m_viewInv.constData(), 64);
-    memcpy(ubData + 128, &m_fov, 4);
-    memcpy(ubData + 132, &m_projectionMode,4);
+    memcpy(m_uniformMapped[currentFrameSlot], ubData, sizeof(ubData));
+  }
+  m_rayDirections->record(cb, currentFrameSlot, m_cameras, m_uniformBuffers[currentFrameSlot], m_frameCounter);
 
-    updateHostData(m_uniformBuffers[currentFrameSlot], dev, df, ubData, 136);
+  // ----------------------------------------------------------
+  // cubemap modes: re-trace the faces only when the eye moved or the
+  // scene changed; rotation and fov only affect the resampling
+  // ----------------------------------------------------------
+  if (hasCubeViews &&
+      (!m_cubemapValid || m_cubemapPosition != cubeCamera->position || m_cubemapSceneGeneration != m_sceneGeneration)) {
+      const QSize faceSize = m_cubemap.size;
+
+      uchar ubData[cameraUBOSize] = {};
+      for (int face = 0; face < 6; ++face) {
+          vkfrt::CameraState faceCam;
+          faceCam.position = cubeCamera->position;
+          faceCam.fov = 90.f;
+          faceCam.projectionMode = vkfrt::Perspective;
+          faceCam.domeMask = false;
+          writeCameraEntry(ubData + face * cameraUBOStride, faceCam,
+                           vkfrt::projectionMatrix(faceCam, faceSize).inverted(),
+                           cubeFaceViewInverse(face, faceCam.position));
+      }
+      updateHostData(m_cubeUniformBuffers[currentFrameSlot], dev, df, ubData, 6 * cameraUBOStride);
+
+      transitionImage(df, cb, m_cubemap, VK_IMAGE_LAYOUT_GENERAL,
+                      VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VkRtPipeline::traceStages);
+
+      // faces are plain perspective views
+      const VkRtPipeline::Program &faceProgram = m_rtPipeline->program(
+          { vkfrt::Perspective, 0, backend, m_queryGroupWidth, m_queryGroupHeight });
+      df->vkCmdBindPipeline(cb, faceProgram.bindPoint(), faceProgram.pipeline);
+      df->vkCmdBindDescriptorSets(cb, faceProgram.bindPoint(),
+                                  m_rtPipeline->layout(), 0, 1, &m_cubeDescSets[currentFrameSlot], 0, nullptr);
+      traceRect(cb, faceProgram, QRect(QPoint(0, 0), faceSize), 6);
+
+      transitionImage(df, cb, m_cubemap, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                      VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                      VkRtPipeline::traceStages, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+      m_cubemapValid = true;
+      m_cubemapPosition = cubeCamera->position;
+      m_cubemapSceneGeneration = m_sceneGeneration;
   }
 
   // ----------------------------------------------------------
-  // per-frame: bind pipeline + descriptors and trace rays
+  // tile scheduling: record the cost of the tiles traced by the last frame
+  // of this slot. Temporal views already split their work over frames and
+  // are always traced in full.
   // ----------------------------------------------------------
   {
-    const uint32_t handleSize = m_rtProps.shaderGroupHandleSize;
-    const uint32_t handleSizeAligned = aligned(handleSize, m_rtProps.shaderGroupHandleAlignment);
-    const uint32_t sbtBufferEntrySize = aligned(handleSizeAligned, m_rtProps.shaderGroupBaseAlignment);
-
-    VkStridedDeviceAddressRegionKHR raygenShaderSbtEntry = {};
-    raygenShaderSbtEntry.deviceAddress = m_sbt.addr;
-    raygenShaderSbtEntry.stride = handleSizeAligned;
-    raygenShaderSbtEntry.size = handleSize;
-
-    VkStridedDeviceAddressRegionKHR missShaderSbtEntry = {};
-    missShaderSbtEntry.deviceAddress = m_sbt.addr + sbtBufferEntrySize;
-    missShaderSbtEntry.stride = handleSizeAligned;
-    missShaderSbtEntry.size = handleSize;
+    const std::vector<double> costs = m_tileTimer->collectIntervals(currentFrameSlot);
+    const std::vector<int> &timed = m_slotTiles[currentFrameSlot];
+    if (costs.size() == timed.size()) {
+      for (std::size_t i = 0; i < costs.size(); ++i) {
+        Tile &tile = m_tiles[timed[i]];
+        tile.costMs = tile.costMs < 0. ? costs[i] : 0.7 * tile.costMs + 0.3 * costs[i];
+      }
+    }
+    m_slotTiles[currentFrameSlot].clear();
+  }
+  const bool tiled = m_traceBudgetMs > 0.f && m_tileTimer->isSupported() && hasDirectViews && !temporal;
+  // tiles of one image would mix poses
+  m_latchable[currentFrameSlot] = m_lateLatch && !tiled;
 
-    VkStridedDeviceAddressRegionKHR hitShaderSbtEntry = {};
-    hitShaderSbtEntry.deviceAddress = m_sbt.addr + sbtBufferEntrySize * 2;
-    hitShaderSbtEntry.stride = handleSizeAligned;
-    hitShaderSbtEntry.size = handleSize;
+  // ----------------------------------------------------------
+  // per-frame: bind descriptors and trace rays, the launch depth is the
+  // view index
+  // ----------------------------------------------------------
+  bool passComplete = true;
+  if (hasDirectViews) {
+    const VkRtPipeline::Program &program = m_rtPipeline->program(directVariant);
+    df->vkCmdBindPipeline(cb, program.bindPoint(), program.pipeline);
+    df->vkCmdBindDescriptorSets(cb, program.bindPoint(),
+                                m_rtPipeline->layout(), 0, 1, &m_descSets[currentFrameSlot], 0, nullptr);
+
+    if (tiled) {
+      ensureTiles(traceSize);
+      const std::vector<int> tiles = scheduleTiles();
+
+      m_tileTimer->begin(cb, currentFrameSlot);
+      for (int t : tiles) {
+        traceRect(cb, program, m_tiles[t].rect, viewCount);
+        m_tileTimer->mark(cb, currentFrameSlot);
+        m_tiles[t].tracedPass = m_tracePass;
+      }
+      m_slotTiles[currentFrameSlot] = tiles;
+      passComplete = !tilesPending();
+    } else {
+      if (m_backendBenchmark)
+          m_traceTimer->begin(cb, currentFrameSlot);
+      traceRect(cb, program, QRect(QPoint(0, 0), traceSize), viewCount);
+      if (m_backendBenchmark) {
+          m_traceTimer->end(cb, currentFrameSlot);
+          m_slotBackends[currentFrameSlot] = backend;
+      }
+    }
+  }
+  m_tilePassPending = !passComplete;
 
-    VkStridedDeviceAddressRegionKHR callableShaderSbtEntry = {};
+  // ----------------------------------------------------------
+  // per-frame: compute passes writing the output after the trace,
+  // upsampling of the foveated / refining lattices, cubemap resampling and
+  // temporal reprojection; each works on its own views
+  // ----------------------------------------------------------
+  const bool sparse = std::any_of(m_cameras.begin(), m_cameras.end(), [=] (const vkfrt::CameraState &cam) {
+      return (cam.foveation && cam.projectionMode == vkfrt::Fulldome && temporalInterleave(cam) == 0)
+             || (refinementStride > 1 && refines(cam));
+  });
+  if (sparse || hasCubeViews || temporal) {
+      // output and hit distances
+      VkMemoryBarrier memoryBarrier = {};
+      memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      df->vkCmdPipelineBarrier(cb,
+                               VkRtPipeline::traceStages,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+  }
+  if (sparse)
+      m_foveationFill->dispatch(cb, currentFrameSlot, traceSize.width(), traceSize.height(), viewCount);
+  if (hasCubeViews)
+      m_cubemapResample->dispatch(cb, currentFrameSlot, traceSize.width(), traceSize.height(), viewCount);
+  if (temporal) {
+      const int32_t validFlag = historyValid ? 1 : 0;
+      m_temporalResolve->dispatch(cb, currentFrameSlot, traceSize.width(), traceSize.height(), viewCount, &validFlag);
+      m_historyValid[currentFrameSlot] = true;
+      m_temporalPhase = (m_temporalPhase + 1) % 4;
+  }
 
-    df->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_pipeline);
-    df->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                                m_pipelineLayout, 0, 1, &m_descSets[currentFrameSlot], 0, nullptr);
+  // a temporal frame only traces a subset of the pixels: keep going until
+  // each of them was traced since the last change
+  if (inputsChanged) {
+      m_convergenceFrames = 0;
+      for (const vkfrt::CameraState &cam : m_cameras)
+          m_convergenceFrames = std::max(m_convergenceFrames, temporalInterleave(cam) - 1);
+  } else if (m_convergenceFrames > 0) {
+      --m_convergenceFrames;
+  }
+  // refinement moves on once every tile traced the current lattice
+  if (passComplete) {
+      if (m_refinementStride > 1) {
+          m_refinedStride = m_refinementStride;
+          m_refinementStride /= 2;
+      } else {
+          m_refinedStride = 0;
+      }
+  }
+  m_outputDirty = false;
+  m_lastPixelSize = pixelSize;
+  m_lastTraceSize = traceSize;
 
-    vkCmdTraceRaysKHR(cb,
-                      &raygenShaderSbtEntry,
-                      &missShaderSbtEntry,
-                      &hitShaderSbtEntry,
-                      &callableShaderSbtEntry,
-                      pixelSize.width(), pixelSize.height(), 1);
+  // ----------------------------------------------------------
+  // dynamic resolution: upscale the reduced trace into the output
+  // ----------------------------------------------------------
+  if (upscale) {
+      VkMemoryBarrier memoryBarrier = {};
+      memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      df->vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+      m_upscale->dispatch(cb, currentFrameSlot, pixelSize.width(), pixelSize.height(), viewCount);
   }
 
   // ----------------------------------------------------------
@@ -759,7 +807,7 @@ VkImageLayout VkRayTracer::render(QVulkanInstance *inst,
       barrier.subresourceRange.baseMipLevel = 0;
       barrier.subresourceRange.levelCount = 1;
       barrier.subresourceRange.baseArrayLayer = 0;
-      barrier.subresourceRange.layerCount = 1;
+      barrier.subresourceRange.layerCount = viewCount;
       barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
       barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
       barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
@@ -767,162 +815,562 @@ VkImageLayout VkRayTracer::render(QVulkanInstance *inst,
       barrier.image = outputImage;
 
       df->vkCmdPipelineBarrier(cb,
-                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                               VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
                                0, 0, nullptr, 0, nullptr,
                                1, &barrier);
   }
 
+  if (m_dynamicResolution)
+      m_gpuTimer->end(cb, currentFrameSlot);
+
   return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
 
 // ------------------------------------------------------------
-// update point cloud buffers (positions feed instances; colors feed SSBO)
+// cubemap of the cubemap modes, sized so that the center of a 180°
+// fisheye keeps the output resolution
 // ------------------------------------------------------------
-void VkRayTracer::setPointCloud(const std::vector<QVector4D>& positions, const std::vector<QVector4D>& colors){
-  if (positions.empty())
-  {
-    qDebug() << "point cloud data is not valid";
-    return;
-  }
+void VkRayTracer::ensureCubemap(const QSize &pixelSize)
+{
+    const int side = std::max(64, (std::max(pixelSize.width(), pixelSize.height()) / 2 + 7) / 8 * 8);
+    if (m_cubemap.image && m_cubemap.size.width() == side)
+        return;
+
+    // the previous faces may still be sampled by frames in flight
+    retireImage(m_cubemap);
 
-  m_pointCount = positions.size();
-  m_point_positions = positions;
-  m_point_colors = colors;
+    m_cubemap = createImage(m_physDev, m_device, m_f, m_df, vkFormat(m_colorFormat), QSize(side, side), 6,
+                            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true);
+    m_cubemapValid = false;
 
-  qDebug() << "[RayTracer] update point cloud successfully, number:" << m_pointCount;
+    for (bool &dirty : m_descSetDirty)
+        dirty = true;
 }
 
 // ------------------------------------------------------------
-// update camera params for per-frame lookAt + perspective
+// temporal history: color + hit distance per frame slot, at the output
+// size with one layer per view
 // ------------------------------------------------------------
-void VkRayTracer::setCamera(const QVector3D& position, const QVector3D& center, float fov, int projectionMode){
-  m_cameraPosition = position;
-  m_cameraCenter   = center;
-  m_fov            = fov;
-  m_projectionMode = projectionMode;
+void VkRayTracer::ensureHistory(const QSize &pixelSize, uint32_t viewCount, bool enabled)
+{
+    const bool exists = m_historyColor[0].image != VK_NULL_HANDLE;
+    if (exists == enabled
+        && (!enabled || (m_historyColor[0].size == pixelSize && m_historyColor[0].layers == viewCount)))
+        return;
+
+    // the previous history may still be used by frames in flight
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        retireImage(m_historyColor[i]);
+        retireImage(m_historyDepth[i]);
+    }
+
+    if (enabled) {
+        for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+            m_historyColor[i] = createImage(m_physDev, m_device, m_f, m_df, vkFormat(m_colorFormat), pixelSize, viewCount,
+                                            VK_IMAGE_USAGE_STORAGE_BIT);
+            m_historyDepth[i] = createImage(m_physDev, m_device, m_f, m_df, VK_FORMAT_R32_SFLOAT, pixelSize, viewCount,
+                                            VK_IMAGE_USAGE_STORAGE_BIT);
+        }
+    }
+
+    for (bool &valid : m_historyValid)
+        valid = false;
+    for (bool &dirty : m_descSetDirty)
+        dirty = true;
 }
 
 // ------------------------------------------------------------
-// buffer helpers (as / host-visible / update / free / address)
+// dynamic resolution: reduced size target the trace and its post passes
+// write to, upscaled into the output
 // ------------------------------------------------------------
-VkRayTracer::Buffer VkRayTracer::createASBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, uint32_t size)
+void VkRayTracer::ensureTraceTarget(const QSize &traceSize, uint32_t viewCount, bool enabled)
 {
-    // usage = storage buffer or acceleration structure storage
-    VkBufferCreateInfo bufferCreateInfo = {};
-    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size = size;
-    bufferCreateInfo.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    const bool exists = m_traceTarget.image != VK_NULL_HANDLE;
+    if (exists == enabled
+        && (!enabled || (m_traceTarget.size == traceSize && m_traceTarget.layers == viewCount)))
+        return;
+
+    retireImage(m_traceTarget);
+    if (enabled)
+        m_traceTarget = createImage(m_physDev, m_device, m_f, m_df, vkFormat(m_colorFormat), traceSize, viewCount,
+                                    VK_IMAGE_USAGE_STORAGE_BIT);
+
+    for (bool &dirty : m_descSetDirty)
+        dirty = true;
+}
 
-    VkBuffer buf = VK_NULL_HANDLE;
-    df->vkCreateBuffer(dev, &bufferCreateInfo, nullptr, &buf);
+void VkRayTracer::retireImage(vkrt::Image &img)
+{
+    if (img.image)
+        m_retiredImages.emplace_back(img, m_frameCounter);
+    img = {};
+}
 
-    VkMemoryRequirements memReq = {};
-    df->vkGetBufferMemoryRequirements(dev, buf, &memReq);
+// ------------------------------------------------------------
+// dynamic resolution controller: the trace cost follows the pixel count,
+// i.e. the square of the scale. Smoothed, with hysteresis between
+// 80% and 100% of the target.
+// ------------------------------------------------------------
+void VkRayTracer::updateResolutionScale(double gpuMs)
+{
+    m_smoothedGpuMs = m_smoothedGpuMs > 0. ? 0.9 * m_smoothedGpuMs + 0.1 * gpuMs : gpuMs;
+    if (++m_framesSinceRescale < rescaleInterval)
+        return;
+
+    if (m_smoothedGpuMs <= m_targetFrameMs && m_smoothedGpuMs >= 0.8 * m_targetFrameMs)
+        return;
+
+    // aim slightly under the target, and grow by one step at most
+    const double ideal = m_resolutionScale * std::sqrt(0.9 * m_targetFrameMs / std::max(m_smoothedGpuMs, 0.01));
+    float scale = std::floor(float(ideal) / resolutionScaleStep) * resolutionScaleStep;
+    scale = std::min(scale, m_resolutionScale + resolutionScaleStep);
+    scale = std::clamp(scale, m_minResolutionScale, 1.f);
+    if (scale == m_resolutionScale)
+        return;
+
+    m_resolutionScale = scale;
+    m_framesSinceRescale = 0;
+    m_smoothedGpuMs = 0.;
+}
 
-    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {};
-    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+void VkRayTracer::setProgressiveRefinement(int coarsestStride)
+{
+    // power of two, at most the foveation block so that lattices nest
+    int stride = 1;
+    while (stride < 8 && stride * 2 <= coarsestStride)
+        stride *= 2;
+    m_progressiveStride = stride;
+    m_refinementStride = std::min(m_refinementStride, stride);
+    if (m_refinedStride > stride)
+        m_refinedStride = 0;
+}
 
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
-    memoryAllocateInfo.allocationSize = memReq.size;
+void VkRayTracer::setTraceBackend(VkRtPipeline::Backend backend, uint32_t groupWidth, uint32_t groupHeight)
+{
+    if (backend == VkRtPipeline::RayQuery && backend != m_traceBackend && m_device && !m_rayQuerySupported)
+        qWarning() << "ray queries are not supported by this device, tracing with the ray tracing pipeline";
+    m_traceBackend = backend;
+    m_queryGroupWidth = std::max(groupWidth, 1u);
+    m_queryGroupHeight = std::max(groupHeight, 1u);
+}
 
-    quint32 memIndex = UINT_MAX;
-    VkPhysicalDeviceMemoryProperties physDevMemProps;
-    f->vkGetPhysicalDeviceMemoryProperties(physDev, &physDevMemProps);
-    for (uint32_t i = 0; i < physDevMemProps.memoryTypeCount; ++i) {
-        if (!(memReq.memoryTypeBits & (1 << i))) continue;
-        if (physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
-            memIndex = i;
-            break;
+void VkRayTracer::setBackendBenchmark(bool enabled)
+{
+    if (enabled == m_backendBenchmark)
+        return;
+    if (enabled && m_device && !m_rayQuerySupported)
+        qWarning() << "ray queries are not supported by this device, only the ray tracing pipeline is timed";
+    m_backendBenchmark = enabled;
+    for (BackendTime &time : m_backendTimes)
+        time = {};
+}
+
+VkRtPipeline::Backend VkRayTracer::frameBackend() const noexcept
+{
+    if (!m_rayQuerySupported)
+        return VkRtPipeline::RayTracingPipeline;
+    if (m_backendBenchmark)
+        return m_frameCounter % 2 ? VkRtPipeline::RayQuery : VkRtPipeline::RayTracingPipeline;
+    return m_traceBackend;
+}
+
+// ------------------------------------------------------------
+// backend benchmark: averages logged once both backends traced
+// benchmarkFrames frames
+// ------------------------------------------------------------
+void VkRayTracer::recordBackendTime(VkRtPipeline::Backend backend, double traceMs)
+{
+    BackendTime &time = m_backendTimes[backend];
+    time.totalMs += traceMs;
+    ++time.frames;
+
+    const BackendTime &pipeline = m_backendTimes[VkRtPipeline::RayTracingPipeline];
+    const BackendTime &query = m_backendTimes[VkRtPipeline::RayQuery];
+    if (pipeline.frames < benchmarkFrames || (m_rayQuerySupported && query.frames < benchmarkFrames))
+        return;
+
+    if (m_rayQuerySupported)
+        qDebug() << "[TIMESTAMP] trace: ray tracing pipeline" << pipeline.totalMs / pipeline.frames
+                 << "ms, ray query" << m_queryGroupWidth << "x" << m_queryGroupHeight
+                 << query.totalMs / query.frames << "ms";
+    else
+        qDebug() << "[TIMESTAMP] trace: ray tracing pipeline" << pipeline.totalMs / pipeline.frames << "ms";
+    for (BackendTime &t : m_backendTimes)
+        t = {};
+}
+
+void VkRayTracer::setDynamicResolution(bool enabled, float targetMs, float minScale)
+{
+    m_dynamicResolution = enabled && m_gpuTimer && m_gpuTimer->isSupported();
+    m_targetFrameMs = std::max(targetMs, 1.f);
+    m_minResolutionScale = std::clamp(minScale, resolutionScaleStep, 1.f);
+    if (!m_dynamicResolution)
+        m_resolutionScale = 1.f;
+    m_resolutionScale = std::clamp(m_resolutionScale, m_minResolutionScale, 1.f);
+}
+
+// ------------------------------------------------------------
+// tile grid over the trace target
+// ------------------------------------------------------------
+void VkRayTracer::ensureTiles(const QSize &traceSize)
+{
+    if (m_tileGridSize == traceSize)
+        return;
+    m_tileGridSize = traceSize;
+
+    int side = tileSide;
+    while (uint32_t((traceSize.width() + side - 1) / side) * uint32_t((traceSize.height() + side - 1) / side) > maxTiles)
+        side *= 2;
+
+    const QPointF center(traceSize.width() / 2., traceSize.height() / 2.);
+    const double radius = std::hypot(center.x(), center.y());
+
+    m_tiles.clear();
+    for (int y = 0; y < traceSize.height(); y += side) {
+        for (int x = 0; x < traceSize.width(); x += side) {
+            Tile tile;
+            tile.rect = QRect(x, y, std::min(side, traceSize.width() - x), std::min(side, traceSize.height() - y));
+            const QPointF d = QRectF(tile.rect).center() - center;
+            tile.centerDistance = float(std::hypot(d.x(), d.y()) / radius);
+            m_tiles.push_back(tile);
         }
     }
-    if (memIndex == UINT_MAX)
-        qFatal("No suitable memory type");
 
-    memoryAllocateInfo.memoryTypeIndex = memIndex;
+    // timings of the previous grid do not apply anymore
+    for (std::vector<int> &tiles : m_slotTiles)
+        tiles.clear();
+}
 
-    VkDeviceMemory bufMem = VK_NULL_HANDLE;
-    df->vkAllocateMemory(dev, &memoryAllocateInfo, nullptr, &bufMem);
-    df->vkBindBufferMemory(dev, buf, bufMem, 0);
+bool VkRayTracer::tilesPending() const
+{
+    return std::any_of(m_tiles.begin(), m_tiles.end(), [this] (const Tile &tile) {
+        return tile.tracedPass < m_tracePass;
+    });
+}
 
-    Buffer result { buf, bufMem, 0, size };
-    result.addr = getBufferDeviceAddress(dev, result);
-    return result;
+// ------------------------------------------------------------
+// tiles of this frame: the ones still showing content from before the
+// last change first, then from the dome center outwards, until the
+// budget is spent. At least one tile is traced per frame.
+// ------------------------------------------------------------
+std::vector<int> VkRayTracer::scheduleTiles()
+{
+    // the previous pass is complete: start the next one
+    if (!tilesPending())
+        ++m_tracePass;
+
+    std::vector<int> pending;
+    double knownCost = 0.;
+    int knownCount = 0;
+    for (int i = 0; i < int(m_tiles.size()); ++i) {
+        if (m_tiles[i].tracedPass < m_tracePass)
+            pending.push_back(i);
+        if (m_tiles[i].costMs >= 0.) {
+            knownCost += m_tiles[i].costMs;
+            ++knownCount;
+        }
+    }
+
+    std::sort(pending.begin(), pending.end(), [this] (int a, int b) {
+        const bool staleA = m_tiles[a].tracedPass < m_changePass;
+        const bool staleB = m_tiles[b].tracedPass < m_changePass;
+        if (staleA != staleB)
+            return staleA;
+        return m_tiles[a].centerDistance < m_tiles[b].centerDistance;
+    });
+
+    // tiles never measured are assumed to cost the average
+    const double defaultCost = knownCount > 0 ? knownCost / knownCount : m_traceBudgetMs / 8.;
+
+    std::vector<int> scheduled;
+    double spent = 0.;
+    for (int t : pending) {
+        const double cost = m_tiles[t].costMs >= 0. ? m_tiles[t].costMs : defaultCost;
+        if (!scheduled.empty() && spent + cost > m_traceBudgetMs)
+            break;
+        scheduled.push_back(t);
+        spent += cost;
+    }
+    return scheduled;
 }
 
-VkRayTracer::Buffer VkRayTracer::createHostVisibleBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, uint32_t size)
+void VkRayTracer::traceRect(VkCommandBuffer cb, const VkRtPipeline::Program &program, const QRect &rect, uint32_t depth)
 {
-    // usage = build-read-only / sbt / ubo / etc., mapped on host for uploads
-    VkBufferCreateInfo bufferCreateInfo = {};
-    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size = size;
-    bufferCreateInfo.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    const VkRtPipeline::TilePushConstants tile{ rect.x(), rect.y() };
+    m_df->vkCmdPushConstants(cb, m_rtPipeline->layout(), VkRtPipeline::traceShaderStages, 0, sizeof(tile), &tile);
+
+    if (program.backend == VkRtPipeline::RayQuery) {
+        m_df->vkCmdDispatch(cb,
+                            (uint32_t(rect.width()) + program.groupWidth - 1) / program.groupWidth,
+                            (uint32_t(rect.height()) + program.groupHeight - 1) / program.groupHeight,
+                            depth);
+        return;
+    }
+
+    vkCmdTraceRaysKHR(cb,
+                      &program.raygenRegion,
+                      &program.missRegion,
+                      &program.hitRegion,
+                      &program.callableRegion,
+                      uint32_t(rect.width()), uint32_t(rect.height()), depth);
+}
 
-    VkBuffer buf = VK_NULL_HANDLE;
-    df->vkCreateBuffer(dev, &bufferCreateInfo, nullptr, &buf);
+// ------------------------------------------------------------
+// binding 0 of a trace descriptor set alone, for the culled tlas
+// ------------------------------------------------------------
+void VkRayTracer::writeTlasDescriptor(VkDescriptorSet set, VkAccelerationStructureKHR tlas)
+{
+    VkWriteDescriptorSetAccelerationStructureKHR descSetAS = {};
+    descSetAS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+    descSetAS.accelerationStructureCount = 1;
+    descSetAS.pAccelerationStructures = &tlas;
+
+    VkWriteDescriptorSet asWrite = {};
+    asWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    asWrite.pNext = &descSetAS;
+    asWrite.dstSet = set;
+    asWrite.dstBinding = 0;
+    asWrite.descriptorCount = 1;
+    asWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    m_df->vkUpdateDescriptorSets(m_device, 1, &asWrite, 0, nullptr);
+}
 
-    VkMemoryRequirements memReq = {};
-    df->vkGetBufferMemoryRequirements(dev, buf, &memReq);
+// ------------------------------------------------------------
+// trace descriptor set: 0=tlas, 1=output image, 2=ubo, 3=colors,
+// 4=hit distances, 5=ray directions
+// ------------------------------------------------------------
+void VkRayTracer::writeTraceDescriptorSet(VkDescriptorSet set, VkImageView outputImageView, const Buffer &uniformBuffer,
+                                          VkImageView depthImageView)
+{
+    const VkAccelerationStructureKHR tlas = m_scene->tlas();
+    const Buffer &colorBuffer = m_scene->colorBuffer();
+
+    // binding 0: tlas
+    VkWriteDescriptorSetAccelerationStructureKHR descSetAS = {};
+    descSetAS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+    descSetAS.accelerationStructureCount = 1;
+    descSetAS.pAccelerationStructures = &tlas;
+
+    VkWriteDescriptorSet asWrite = {};
+    asWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    asWrite.pNext = &descSetAS;
+    asWrite.dstSet = set;
+    asWrite.dstBinding = 0;
+    asWrite.descriptorCount = 1;
+    asWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+    // binding 1: storage image array (raytracing output, one layer per view)
+    VkDescriptorImageInfo descOutputImage = {};
+    descOutputImage.imageView = outputImageView;
+    descOutputImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet imageWrite = {};
+    imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    imageWrite.dstSet = set;
+    imageWrite.dstBinding = 1;
+    imageWrite.descriptorCount = 1;
+    imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    imageWrite.pImageInfo = &descOutputImage;
+
+    // binding 2: uniform buffer (cameras)
+    VkDescriptorBufferInfo descUniformBuffer = {};
+    descUniformBuffer.buffer = uniformBuffer.buf;
+    descUniformBuffer.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet ubWrite = {};
+    ubWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    ubWrite.dstSet = set;
+    ubWrite.dstBinding = 2;
+    ubWrite.descriptorCount = 1;
+    ubWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubWrite.pBufferInfo = &descUniformBuffer;
+
+    // binding 3: color buffer (vec4 per point)
+    VkDescriptorBufferInfo colorBufferInfo = { colorBuffer.buf, 0, colorBuffer.size };
+
+    VkWriteDescriptorSet colorWrite = {};
+    colorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    colorWrite.dstSet = set;
+    colorWrite.dstBinding = 3;
+    colorWrite.descriptorCount = 1;
+    colorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    colorWrite.pBufferInfo = &colorBufferInfo;
+
+    // binding 4: storage image array (hit distances, one layer per view)
+    VkDescriptorImageInfo descDepthImage = {};
+    descDepthImage.imageView = depthImageView;
+    descDepthImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet depthWrite = {};
+    depthWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    depthWrite.dstSet = set;
+    depthWrite.dstBinding = 4;
+    depthWrite.descriptorCount = 1;
+    depthWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    depthWrite.pImageInfo = &descDepthImage;
+
+    // binding 5: storage image array (ray directions, one layer per view)
+    VkDescriptorImageInfo descDirectionsImage = {};
+    descDirectionsImage.imageView = m_rayDirections->view();
+    descDirectionsImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet directionsWrite = {};
+    directionsWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    directionsWrite.dstSet = set;
+    directionsWrite.dstBinding = 5;
+    directionsWrite.descriptorCount = 1;
+    directionsWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    directionsWrite.pImageInfo = &descDirectionsImage;
+
+    VkWriteDescriptorSet writeSets[] = { asWrite, imageWrite, ubWrite, colorWrite, depthWrite, directionsWrite };
+    m_df->vkUpdateDescriptorSets(m_device, 6, writeSets, 0, VK_NULL_HANDLE);
+}
 
-    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {};
-    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+// ------------------------------------------------------------
+// every descriptor set of a frame slot: trace, cubemap faces and post passes
+// ------------------------------------------------------------
+void VkRayTracer::writeDescriptorSet(uint frameSlot, VkImageView traceImageView, VkImageView outputImageView)
+{
+    // hit distances are only kept in temporal mode
+    const bool temporal = m_historyDepth[frameSlot].image != VK_NULL_HANDLE;
+    writeTraceDescriptorSet(m_descSets[frameSlot], traceImageView, m_uniformBuffers[frameSlot],
+                            temporal ? m_historyDepth[frameSlot].view : m_dummyDepth.view);
+    m_slotTlas[frameSlot] = m_scene->tlas();
+
+    // post passes of this slot use the same trace target and cameras
+    m_foveationFill->writeImage(frameSlot, 0, traceImageView);
+    m_foveationFill->writeBuffer(frameSlot, 1, m_uniformBuffers[frameSlot]);
+    // same foveation rate as raygen, from the same ray directions
+    m_foveationFill->writeImage(frameSlot, 2, m_rayDirections->view());
+
+    if (m_cubemap.image) {
+        writeTraceDescriptorSet(m_cubeDescSets[frameSlot], m_cubemap.view, m_cubeUniformBuffers[frameSlot],
+                                m_dummyDepth.view);
+
+        m_cubemapResample->writeImage(frameSlot, 0, m_cubemap.cubeView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_cubeSampler);
+        m_cubemapResample->writeImage(frameSlot, 1, traceImageView);
+        m_cubemapResample->writeBuffer(frameSlot, 2, m_uniformBuffers[frameSlot]);
+    }
 
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
-    memoryAllocateInfo.allocationSize = memReq.size;
+    if (temporal) {
+        const uint previousFrameSlot = (frameSlot + 1) % FRAMES_IN_FLIGHT;
+        m_temporalResolve->writeImage(frameSlot, 0, traceImageView);
+        m_temporalResolve->writeImage(frameSlot, 1, m_historyDepth[frameSlot].view);
+        m_temporalResolve->writeImage(frameSlot, 2, m_historyColor[frameSlot].view);
+        m_temporalResolve->writeImage(frameSlot, 3, m_historyColor[previousFrameSlot].view);
+        m_temporalResolve->writeImage(frameSlot, 4, m_historyDepth[previousFrameSlot].view);
+        m_temporalResolve->writeBuffer(frameSlot, 5, m_uniformBuffers[frameSlot]);
+    }
 
-    quint32 memIndex = UINT_MAX;
-    VkPhysicalDeviceMemoryProperties physDevMemProps;
-    f->vkGetPhysicalDeviceMemoryProperties(physDev, &physDevMemProps);
-    for (uint32_t i = 0; i < physDevMemProps.memoryTypeCount; ++i) {
-        if (!(memReq.memoryTypeBits & (1 << i))) continue;
-        if ((physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
-            (physDevMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
-        {
-            memIndex = i;
-            break;
-        }
+    if (m_traceTarget.image) {
+        m_upscale->writeImage(frameSlot, 0, m_traceTarget.view);
+        m_upscale->writeImage(frameSlot, 1, outputImageView);
     }
-    if (memIndex == UINT_MAX)
-        qFatal("No suitable memory type");
+}
+
+// ------------------------------------------------------------
+// select the scene to trace; tracers given the same source and revision
+// share their acceleration structures
+// ------------------------------------------------------------
+void VkRayTracer::setPointCloud(std::shared_ptr<const vkfrt::PointCloud> cloud){
+  if (!cloud || cloud->positions.empty())
+  {
+    qDebug() << "point cloud data is not valid";
+    return;
+  }
+
+  const VkRtScene::Key key{m_device, cloud->source, cloud->revision};
+  if (m_scene && !(m_scene->key() < key) && !(key < m_scene->key()))
+    return;
+
+  // next frame of the sequence already shown: uploaded into the same scene
+  if (cloud->sequenceCapacity > 0 && m_scene && m_scene->isStreaming()
+      && m_scene->key().source == cloud->source && m_scene->stream(cloud))
+  {
+    m_sceneGeneration++;
+    return;
+  }
 
-    memoryAllocateInfo.memoryTypeIndex = memIndex;
+  if (m_scene)
+    m_retiredScenes.emplace_back(std::move(m_scene), m_frameCounter);
 
-    VkDeviceMemory bufMem = VK_NULL_HANDLE;
-    auto res = df->vkAllocateMemory(dev, &memoryAllocateInfo, nullptr, &bufMem);
-    Q_ASSERT(res == VK_SUCCESS);
-    df->vkBindBufferMemory(dev, buf, bufMem, 0);
+  m_scene = cloud->sequenceCapacity > 0 ? VkRtScene::createStreaming(key, std::move(cloud))
+                                        : VkRtScene::acquire(key, std::move(cloud));
+  m_sceneGeneration++;
 
-    Buffer result { buf, bufMem, 0, size };
-    result.addr = getBufferDeviceAddress(dev, result);
-    return result;
+  qDebug() << "[RayTracer] update point cloud successfully, number:" << m_scene->pointCount();
 }
 
-void VkRayTracer::updateHostData(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df, const void *data, size_t dataLen)
+// ------------------------------------------------------------
+// late latch: view matrices of the recorded frame moved to the latest pose
+// ------------------------------------------------------------
+void VkRayTracer::setLateLatch(bool enabled, float predictionMs) noexcept
 {
-    // note: assumes b.size >= dataLen
-    void *p = nullptr;
-    df->vkMapMemory(dev, b.mem, 0, b.size, 0, &p);
-    memcpy(p, data, dataLen);
-    df->vkUnmapMemory(dev, b.mem);
+  m_lateLatch = enabled;
+  m_predictionMs = std::max(predictionMs, 0.f);
 }
 
-void VkRayTracer::freeBuffer(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df)
+void VkRayTracer::latchPose(const vkfrt::CameraPose &pose, uint frameSlot)
 {
-    // release buffer + memory
-    df->vkDestroyBuffer(dev, b.buf, nullptr);
-    df->vkFreeMemory(dev, b.mem, nullptr);
+  if (!m_lateLatch || !pose.isValid() || frameSlot >= uint(FRAMES_IN_FLIGHT)
+      || !m_latchable[frameSlot] || !m_uniformMapped[frameSlot])
+      return;
+
+  const auto displayTime = vkfrt::CameraPose::Clock::now()
+                           + std::chrono::duration_cast<vkfrt::CameraPose::Clock::duration>(
+                               std::chrono::duration<float, std::milli>(m_predictionMs));
+  const vkfrt::CameraPose latched = vkfrt::extrapolatedPose(pose, displayTime);
+
+  // the uniforms are read by the gpu once the frame executes: they can be
+  // rewritten until it is submitted. The temporal history of the slot
+  // follows, as the next frame reprojects from it.
+  std::vector<uchar> &history = m_historyCameras[frameSlot];
+  for (std::size_t v = 0; v < m_cameras.size(); ++v) {
+      vkfrt::CameraState cam = m_cameras[v];
+      if (vkfrt::usesCubemap(cam.projectionMode)) {
+          cam.center = cam.position + (latched.center - latched.position);
+      } else {
+          cam.position = latched.position;
+          cam.center = latched.center;
+      }
+      const QMatrix4x4 viewInv = vkfrt::viewMatrix(cam).inverted();
+      memcpy(m_uniformMapped[frameSlot] + v * cameraUBOStride + 64, viewInv.constData(), 64);
+      if (history.size() >= (v + 1) * cameraUBOStride)
+          memcpy(history.data() + v * cameraUBOStride + 64, viewInv.constData(), 64);
+  }
+  m_latchable[frameSlot] = false;
 }
 
-VkDeviceAddress VkRayTracer::getBufferDeviceAddress(VkDevice dev, const Buffer &b)
-{
-    VkBufferDeviceAddressInfoKHR info = {};
-    info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-    info.buffer = b.buf;
-    return vkGetBufferDeviceAddressKHR(dev, &info);
+// ------------------------------------------------------------
+// update camera params for per-frame lookAt + perspective
+// ------------------------------------------------------------
+void VkRayTracer::setCamera(const QVector3D& position, const QVector3D& center, float fov, int projectionMode, bool domeMask){
+  vkfrt::CameraState camera = m_cameras[0];
+  camera.position       = position;
+  camera.center         = center;
+  camera.fov            = fov;
+  camera.projectionMode = projectionMode;
+  camera.domeMask       = domeMask;
+  setCamera(camera);
+}
+
+void VkRayTracer::setCamera(const vkfrt::CameraState& camera){
+  setCameras({camera});
+}
+
+// ------------------------------------------------------------
+// several cameras traced together, view i goes to output layer i
+// ------------------------------------------------------------
+void VkRayTracer::setCameras(const std::vector<vkfrt::CameraState>& cameras){
+  if (cameras.empty() || cameras.size() > size_t(MAX_VIEWS))
+  {
+    qWarning() << "[RayTracer] unsupported view count:" << cameras.size();
+    return;
+  }
+  if (cameras == m_cameras)
+    return;
+
+  m_cameras = cameras;
+  m_outputDirty = true;
 }
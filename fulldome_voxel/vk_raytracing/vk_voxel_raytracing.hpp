@@ -6,19 +6,39 @@
 #include <QVulkanFunctions>
 #include <QSize>
 #include <QMatrix4x4>
+#include <QRect>
 
+#include <fulldome_voxel/PointCloud.hpp>
+#include <fulldome_voxel/Projection.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_buffer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_compute_pass.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_gpu_timer.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_image.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_ray_directions.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_rt_culling.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_rt_pipeline.hpp>
+#include <fulldome_voxel/vk_raytracing/vk_rt_scene.hpp>
 
-
-class QRhi;
-class QRhiCommandBuffer;
-class QRhiTexture;
-struct QRhiVulkanNativeHandles;
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
 
 class VkRayTracer
 {
 public:
+    // see Projection.hpp
+    static constexpr float voxelHalfExtent = vkfrt::voxelHalfExtent;
+    static constexpr float sceneScale = vkfrt::sceneScale;
+    static constexpr float missColor = vkfrt::missColor;
+    // cameras traced by a single dispatch, must match raygen.rgen
+    static constexpr int MAX_VIEWS = 8;
+
     void init(VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df);
+    void release();
 
+    // traces every camera in one dispatch: outputImage needs one array layer
+    // per view and outputImageView must be a 2D array view over them
     VkImageLayout render(QVulkanInstance *inst,
                        VkPhysicalDevice physDev,
                        VkDevice dev,
@@ -31,93 +51,228 @@ public:
                        uint currentFrameSlot,
                        const QSize &pixelSize);
 
-    void setPointCloud(const std::vector<QVector4D>& positions,
-    const std::vector<QVector4D>& colors);
+    // the cloud source + revision identify the geometry (e.g. mesh list and
+    // its dirty_index): tracers of the same device rendering the same
+    // geometry share one set of acceleration structures. The points are
+    // shared with the caller, not copied. Frames of a sequence are uploaded
+    // into the scene of the previous frame when they fit.
+    void setPointCloud(std::shared_ptr<const vkfrt::PointCloud> cloud);
+
+    // single view
+    void setCamera(const QVector3D& position, const QVector3D& center, float fov, int projectionMode, bool domeMask = true);
+    void setCamera(const vkfrt::CameraState& camera);
+    // one view per camera, up to MAX_VIEWS
+    void setCameras(const std::vector<vkfrt::CameraState>& cameras);
+    int viewCount() const noexcept { return int(m_cameras.size()); }
+
+    // caching: render() leaves the output untouched while the cameras, the
+    // scene and the target are unchanged; invalidate() forces a new trace
+    void setCaching(bool enabled) noexcept { m_caching = enabled; }
+    void invalidate() noexcept { m_outputDirty = true; }
+
+    // progressive refinement: after each change the first frame traces one
+    // pixel out of coarsestStride² (1, 2, 4 or 8), the next ones refine
+    // the same image down to every pixel. 1 disables it.
+    void setProgressiveRefinement(int coarsestStride);
+
+    // dynamic resolution: the trace runs at a fraction of the output size,
+    // adjusted from the measured gpu time to hold targetMs, and is upscaled
+    // into the output
+    void setDynamicResolution(bool enabled, float targetMs, float minScale);
+    float resolutionScale() const noexcept { return m_resolutionScale; }
+
+    // format of the output image passed to render(); the intermediate
+    // color images follow it. A change rebuilds the passes on the next
+    // render, callers check vkrt::supportsColorFormat first.
+    void setColorFormat(vkrt::ColorFormat format);
+    vkrt::ColorFormat colorFormat() const noexcept { return m_colorFormat; }
 
-    void setCamera(const QVector3D& position, const QVector3D& center, float fov, int projectionMode);
+    // tile scheduling: with a budget, the directly traced views are split in
+    // tiles and each frame only traces as many as fit in budgetMs of gpu
+    // time, most urgent first; the others keep their previous content.
+    // 0 traces the whole frame at once.
+    void setTraceBudget(float budgetMs) noexcept { m_traceBudgetMs = std::max(budgetMs, 0.f); }
+
+    // how the rays are traced, see VkRtPipeline::Backend; the group size
+    // is the workgroup tiling of the ray query dispatch. Devices without
+    // ray queries keep the ray tracing pipeline.
+    void setTraceBackend(VkRtPipeline::Backend backend, uint32_t groupWidth = 8, uint32_t groupHeight = 8);
+    // benchmark: traced frames alternate between the two backends and the
+    // average gpu time of their direct trace is logged; frames skipped by
+    // the caching or split in tiles are not measured
+    void setBackendBenchmark(bool enabled);
+
+    // visibility culling: chunks of the point cloud outside of every view
+    // are left out of the tlas traced by the frame, see VkRtCulling
+    void setVisibilityCulling(bool enabled) noexcept { m_visibilityCulling = enabled; }
+
+    // late latch: once render() recorded a frame, latchPose() moves its
+    // views to a newer pose, extrapolated predictionMs ahead, by rewriting
+    // their view matrices in the persistently mapped uniforms until the
+    // frame is submitted. Frames split in tiles are not latched.
+    void setLateLatch(bool enabled, float predictionMs) noexcept;
+    // every view takes the pose, but views resampled from the cubemap keep
+    // the eye the faces were traced from
+    void latchPose(const vkfrt::CameraPose &pose, uint frameSlot);
 private:
-    QRhiTexture* m_tex = nullptr;
-    QSize m_size;
-    VkImage m_vkImg = VK_NULL_HANDLE;
-    VkImageView m_vkImgView = VK_NULL_HANDLE;
+    struct Tile {
+        QRect rect;
+        // distance of the tile center to the image center, 1 at the corners
+        float centerDistance = 0.f;
+        // measured gpu time, negative until known
+        double costMs = -1.;
+        // pass that traced it last
+        uint64_t tracedPass = 0;
+    };
 
-    QRhi* m_rhi = nullptr;
     QVulkanFunctions* m_f = nullptr;
     QVulkanDeviceFunctions* m_df = nullptr;
     VkDevice m_device = VK_NULL_HANDLE;
-    VkDeviceMemory m_vkImgMem = VK_NULL_HANDLE;
     VkPhysicalDevice m_physDev = VK_NULL_HANDLE;
-    QVulkanInstance* m_inst = nullptr;
-
-    void recreateTexture(int w, int h);
 
     static const int FRAMES_IN_FLIGHT = 2;
 
-    struct Buffer {
-        VkBuffer buf = VK_NULL_HANDLE;
-        VkDeviceMemory mem = VK_NULL_HANDLE;
-        VkDeviceAddress addr = 0;
-        size_t size = 0;
-    };
-
-    std::vector<QVector4D> m_point_positions;
-    size_t m_pointCount = 0;
+    using Buffer = vkrt::Buffer;
 
-    std::vector<QVector4D> m_point_colors;
+    void writeDescriptorSet(uint frameSlot, VkImageView traceImageView, VkImageView outputImageView);
+    void writeTlasDescriptor(VkDescriptorSet set, VkAccelerationStructureKHR tlas);
+    void writeTraceDescriptorSet(VkDescriptorSet set, VkImageView outputImageView, const Buffer &uniformBuffer,
+                                 VkImageView depthImageView);
+    void createColorPasses();
+    void applyColorFormat();
+    void ensureCubemap(const QSize &pixelSize);
+    void ensureHistory(const QSize &pixelSize, uint32_t viewCount, bool enabled);
+    void ensureTraceTarget(const QSize &traceSize, uint32_t viewCount, bool enabled);
+    // freed once no frame in flight uses it anymore
+    void retireImage(vkrt::Image &img);
+    void updateResolutionScale(double gpuMs);
+    void ensureTiles(const QSize &traceSize);
+    bool tilesPending() const;
+    std::vector<int> scheduleTiles();
+    // launch over a rect of the bound target, one layer per view; program
+    // must be the bound pipeline
+    void traceRect(VkCommandBuffer cb, const VkRtPipeline::Program &program, const QRect &rect, uint32_t depth);
+    // backend of the launches of the next frame
+    VkRtPipeline::Backend frameBackend() const noexcept;
+    void recordBackendTime(VkRtPipeline::Backend backend, double traceMs);
 
-    Buffer createASBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, uint32_t size);
-    Buffer createHostVisibleBuffer(int usage, VkPhysicalDevice physDev, VkDevice dev, QVulkanFunctions *f, QVulkanDeviceFunctions *df, uint32_t size);
-    void updateHostData(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df, const void *data, size_t dataLen);
-    void freeBuffer(const Buffer &b, VkDevice dev, QVulkanDeviceFunctions *df);
-    VkDeviceAddress getBufferDeviceAddress(VkDevice dev, const Buffer &b);
-
-    VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProps;
     VkPhysicalDeviceAccelerationStructureFeaturesKHR m_asFeatures;
 
-    PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR;
-    PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR;
-    PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR;
-    PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
-    PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
-    PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
-    PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR;
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
-    PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR;
-    PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR;
-
-    Buffer m_vertexBuffer;
-    Buffer m_indexBuffer;
-    Buffer m_colorBuffer;
-    Buffer m_transformBuffer;
-    Buffer m_blasBuffer;
-    VkAccelerationStructureKHR m_blas;
-    VkDeviceAddress m_blasAddr = 0;
-
-    Buffer m_instanceBuffer;
-    Buffer m_tlasBuffer;
-    VkAccelerationStructureKHR m_tlas;
-    VkDeviceAddress m_tlasAddr = 0;
+
+    std::shared_ptr<VkRtScene> m_scene;
+    std::deque<std::pair<std::shared_ptr<VkRtScene>, uint64_t>> m_retiredScenes;
+    std::deque<std::pair<vkrt::Image, uint64_t>> m_retiredImages;
+    // pipelines and passes of a previous color format
+    std::deque<std::pair<std::shared_ptr<void>, uint64_t>> m_retiredPasses;
+    uint64_t m_sceneGeneration = 0;
+    uint64_t m_boundSceneGeneration = 0;
+    uint64_t m_frameCounter = 0;
 
     Buffer m_uniformBuffers[FRAMES_IN_FLIGHT];
-    VkDescriptorSetLayout m_descSetLayout;
-    VkPipelineLayout m_pipelineLayout;
-    VkPipeline m_pipeline;
-    Buffer m_sbt;
-    VkDescriptorPool m_descPool;
+    uchar *m_uniformMapped[FRAMES_IN_FLIGHT] = {};
+    std::shared_ptr<VkRtPipeline> m_rtPipeline;
+    // fills the pixels skipped by foveated tracing
+    std::unique_ptr<VkComputePass> m_foveationFill;
+
+    // cubemap modes: faces traced around the camera position, in world
+    // orientation, then resampled into the output
+    vkrt::Image m_cubemap;
+    VkSampler m_cubeSampler = VK_NULL_HANDLE;
+    Buffer m_cubeUniformBuffers[FRAMES_IN_FLIGHT];
+    VkDescriptorSet m_cubeDescSets[FRAMES_IN_FLIGHT];
+    std::unique_ptr<VkComputePass> m_cubemapResample;
+    bool m_cubemapValid = false;
+    QVector3D m_cubemapPosition;
+    uint64_t m_cubemapSceneGeneration = 0;
+
+    // temporal mode: color + hit distance of the last frames, one pair per
+    // frame slot; the other slot holds the previous frame
+    vkrt::Image m_historyColor[FRAMES_IN_FLIGHT];
+    vkrt::Image m_historyDepth[FRAMES_IN_FLIGHT];
+    // bound as hit distance target when the temporal mode is off
+    vkrt::Image m_dummyDepth;
+    std::unique_ptr<VkComputePass> m_temporalResolve;
+    // camera entries each history slot was rendered with
+    std::vector<uchar> m_historyCameras[FRAMES_IN_FLIGHT];
+    bool m_historyValid[FRAMES_IN_FLIGHT] = {};
+    uint64_t m_historySceneGeneration = 0;
+    int m_temporalPhase = 0;
+
+    VkDescriptorPool m_descPool = VK_NULL_HANDLE;
     VkDescriptorSet m_descSets[FRAMES_IN_FLIGHT];
+    bool m_descSetDirty[FRAMES_IN_FLIGHT];
+
+    VkImageView m_lastOutputImageView = VK_NULL_HANDLE;
+    VkImageView m_lastTraceImageView = VK_NULL_HANDLE;
+    QSize m_lastPixelSize;
+    QSize m_lastTraceSize;
+
+    // dynamic resolution: reduced size trace target, upscaled to the output
+    vkrt::Image m_traceTarget;
+    std::unique_ptr<VkComputePass> m_upscale;
+    std::unique_ptr<VkGpuTimer> m_gpuTimer;
+    // precomputed ray directions of the views traced directly
+    std::unique_ptr<VkRayDirections> m_rayDirections;
+    bool m_dynamicResolution = false;
+    float m_targetFrameMs = 16.6f;
+    float m_minResolutionScale = 0.5f;
+    float m_resolutionScale = 1.f;
+    double m_smoothedGpuMs = 0.;
+    int m_framesSinceRescale = 0;
+
+    // tile scheduling: a pass traces every tile once, over one or more
+    // frames; m_changePass is the first pass after the last input change
+    std::vector<Tile> m_tiles;
+    QSize m_tileGridSize;
+    uint64_t m_tracePass = 1;
+    uint64_t m_changePass = 1;
+    bool m_tilePassPending = false;
+    float m_traceBudgetMs = 0.f;
+    std::unique_ptr<VkGpuTimer> m_tileTimer;
+    // tiles traced by the last frame of each slot, in timestamp order
+    std::vector<int> m_slotTiles[FRAMES_IN_FLIGHT];
+
+    vkrt::ColorFormat m_colorFormat = vkrt::ColorFormat::RGBA8;
+    bool m_colorFormatDirty = false;
+
+    // trace backend; the benchmark times the direct trace of each frame
+    // and accumulates it per backend until both have enough frames
+    struct BackendTime {
+        double totalMs = 0.;
+        int frames = 0;
+    };
+    VkRtPipeline::Backend m_traceBackend = VkRtPipeline::RayTracingPipeline;
+    uint32_t m_queryGroupWidth = 8;
+    uint32_t m_queryGroupHeight = 8;
+    bool m_rayQuerySupported = false;
+    bool m_backendBenchmark = false;
+    std::unique_ptr<VkGpuTimer> m_traceTimer;
+    VkRtPipeline::Backend m_slotBackends[FRAMES_IN_FLIGHT] = {};
+    BackendTime m_backendTimes[2];
+
+    bool m_caching = false;
+    bool m_outputDirty = true;
+    // frames still needed by the temporal mode to trace every pixel
+    int m_convergenceFrames = 0;
+
+    // progressive refinement: lattice of the next frame, and the one
+    // already traced (0 once complete)
+    int m_progressiveStride = 1;
+    int m_refinementStride = 1;
+    int m_refinedStride = 0;
 
-    QMatrix4x4 m_proj;
-    QMatrix4x4 m_projInv;
-    QMatrix4x4 m_view;
-    QMatrix4x4 m_viewInv;
+    std::vector<vkfrt::CameraState> m_cameras{1};
 
-    VkImageView m_lastOutputImageView;
+    // visibility culling, and the tlas bound to the trace set of each slot
+    std::unique_ptr<VkRtCulling> m_culling;
+    bool m_visibilityCulling = false;
+    VkAccelerationStructureKHR m_slotTlas[FRAMES_IN_FLIGHT] = {};
 
-    QVector3D m_cameraPosition{ -15.0f, 6.0f, -35.75f };
-    QVector3D m_cameraCenter{ 20.0f, 0.0f, -36.75f };
-    float m_fov{ 60.f };
-    // 0 = perspective, 1 = full-dome
-    int m_projectionMode{0};
+    // late latch: set when the last render() of a slot traced in full
+    bool m_lateLatch = false;
+    float m_predictionMs = 0.f;
+    bool m_latchable[FRAMES_IN_FLIGHT] = {};
 };
 
 #endif
@@ -0,0 +1,100 @@
+// Golden-image and timing regression test, see vkfrt::regression::run.
+//
+//   vkfrt_regression --references <dir> [--output <dir>] [--backend cpu|gpu]
+//                    [--threads <n>] [--runs <n>] [--timing-threshold <factor>]
+//                    [--update | --update-timings]
+//
+// Exits with 0 when every case passes, 1 on a mismatch or a timing
+// regression, 77 when the requested backend is not available here (no
+// device supporting ray tracing), which ctest reports as skipped. Timings
+// are only reported unless a threshold is given and the references hold a
+// baseline recorded on this machine with --update-timings.
+#include <fulldome_voxel/reference/GpuBackend.hpp>
+#include <fulldome_voxel/reference/RegressionSuite.hpp>
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QGuiApplication>
+
+#include <cstdio>
+
+namespace
+{
+constexpr int skipped = 77;
+}
+
+int main(int argc, char** argv)
+{
+  // the cpu backend needs no display, the gpu one no window
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM") && qEnvironmentVariableIsEmpty("DISPLAY")
+      && qEnvironmentVariableIsEmpty("WAYLAND_DISPLAY"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QGuiApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(QStringLiteral("vkfrt rendering regression test"));
+  parser.addHelpOption();
+  const QCommandLineOption references(
+      QStringLiteral("references"), QStringLiteral("Golden images and timings.json."),
+      QStringLiteral("dir"));
+  const QCommandLineOption output(
+      QStringLiteral("output"),
+      QStringLiteral("Measured timings and mismatching images, the references by default."),
+      QStringLiteral("dir"));
+  const QCommandLineOption backend(
+      QStringLiteral("backend"), QStringLiteral("cpu (reference tracer) or gpu."),
+      QStringLiteral("name"), QStringLiteral("cpu"));
+  const QCommandLineOption threads(
+      QStringLiteral("threads"), QStringLiteral("Threads of the cpu backend, 0 for all."),
+      QStringLiteral("n"), QStringLiteral("0"));
+  const QCommandLineOption runs(
+      QStringLiteral("runs"), QStringLiteral("Timed runs of each measurement, the median is kept."),
+      QStringLiteral("n"), QStringLiteral("5"));
+  const QCommandLineOption threshold(
+      QStringLiteral("timing-threshold"),
+      QStringLiteral("Timings over baseline * factor fail when the baseline was recorded on this "
+                     "machine, 0 only reports them."),
+      QStringLiteral("factor"), QStringLiteral("0"));
+  const QCommandLineOption update(
+      QStringLiteral("update"), QStringLiteral("Write the results as the new references."));
+  const QCommandLineOption updateTimings(
+      QStringLiteral("update-timings"),
+      QStringLiteral("Write the timings of this machine as the new baseline, keep the images."));
+  parser.addOptions({references, output, backend, threads, runs, threshold, update, updateTimings});
+  parser.process(app);
+
+  if (!parser.isSet(references))
+  {
+    std::fputs("--references is required\n", stderr);
+    return 2;
+  }
+
+  vkfrt::regression::Backend b;
+  if (parser.value(backend) == QLatin1String("gpu"))
+    b = vkfrt::regression::gpuBackend();
+  else
+    b = vkfrt::regression::referenceBackend(parser.value(threads).toInt());
+  if (!b.isValid())
+  {
+    qWarning() << "backend" << parser.value(backend) << "not available, skipped";
+    return skipped;
+  }
+
+  vkfrt::regression::Settings settings;
+  settings.referenceDirectory = parser.value(references);
+  settings.outputDirectory = parser.value(output);
+  settings.updateReferences = parser.isSet(update);
+  settings.updateTimings = parser.isSet(updateTimings);
+  settings.timingRuns = parser.value(runs).toInt();
+  settings.timingThreshold = parser.value(threshold).toDouble();
+
+  const auto report = vkfrt::regression::run(settings, b);
+  if (report.cases.empty())
+    return 1;
+  if (settings.updateReferences || settings.updateTimings)
+    return 0;
+
+  const bool ok = vkfrt::regression::passed(report);
+  qDebug() << b.name << (ok ? "passed" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// Command line front end of vkfrt::batch, rendering with the CPU reference
+// tracer, see BatchRender.hpp for the job directory.
+//
+//   vkfrt_batch create <dir> <path.json> <cloud.ply>
+//   vkfrt_batch work <dir> [--threads <n>] [--id <name>]
+//   vkfrt_batch requeue <dir>
+//   vkfrt_batch status <dir>
+//
+// Start one worker per machine (or per share of its cores) on the same
+// directory; workers can be stopped and started again at any time.
+#include <fulldome_voxel/reference/BatchRender.hpp>
+#include <fulldome_voxel/reference/PlyCloud.hpp>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+
+#include <cstdio>
+
+namespace
+{
+constexpr int usageError = 2;
+
+int create(const QStringList& args)
+{
+  if (args.size() != 4)
+  {
+    std::fputs("usage: vkfrt_batch create <dir> <path.json> <cloud.ply>\n", stderr);
+    return usageError;
+  }
+
+  vkfrt::batch::Job job;
+  if (!vkfrt::batch::readJobFile(args[2], job))
+  {
+    std::fprintf(stderr, "invalid camera path %s\n", qPrintable(args[2]));
+    return 1;
+  }
+
+  std::vector<QVector4D> positions, colors;
+  if (!vkfrt::readPlyCloud(args[3], positions, colors))
+    return 1;
+  // the job stores a color per point: white, as in VkRtScene
+  if (colors.empty())
+    colors.assign(positions.size(), QVector4D(1.f, 1.f, 1.f, 1.f));
+
+  if (!vkfrt::batch::createJob(args[1], job, positions, colors))
+    return 1;
+  std::printf(
+      "%d frames of %dx%d, %zu points\n", job.frameCount, job.pixelSize.width(),
+      job.pixelSize.height(), positions.size());
+  return 0;
+}
+
+int work(const QStringList& args, int threads, const QString& id)
+{
+  if (args.size() != 2)
+  {
+    std::fputs("usage: vkfrt_batch work <dir> [--threads <n>] [--id <name>]\n", stderr);
+    return usageError;
+  }
+
+  vkfrt::batch::WorkerSettings settings;
+  settings.id = id;
+  const int rendered = vkfrt::batch::runWorker(
+      args[1], vkfrt::regression::referenceBackend(threads), settings);
+  if (rendered < 0)
+    return 1;
+  std::printf("%d frames rendered\n", rendered);
+  return 0;
+}
+
+int requeue(const QStringList& args)
+{
+  if (args.size() != 2)
+  {
+    std::fputs("usage: vkfrt_batch requeue <dir>\n", stderr);
+    return usageError;
+  }
+
+  vkfrt::batch::Job job;
+  if (!vkfrt::batch::readJobFile(QDir(args[1]).filePath(QStringLiteral("job.json")), job))
+  {
+    std::fprintf(stderr, "no job in %s\n", qPrintable(args[1]));
+    return 1;
+  }
+  return vkfrt::batch::requeue(args[1], job.rangeSize) ? 0 : 1;
+}
+
+int status(const QStringList& args)
+{
+  if (args.size() != 2)
+  {
+    std::fputs("usage: vkfrt_batch status <dir>\n", stderr);
+    return usageError;
+  }
+
+  const auto p = vkfrt::batch::progress(args[1]);
+  if (p.frameCount == 0)
+  {
+    std::fprintf(stderr, "no job in %s\n", qPrintable(args[1]));
+    return 1;
+  }
+  std::printf(
+      "%d / %d frames finished, %d ranges claimed\n", p.finished, p.frameCount,
+      p.claimed);
+  // done only once every frame exists: scripts can wait on the exit code
+  return p.finished == p.frameCount ? 0 : 3;
+}
+}
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(QStringLiteral(
+      "Offline rendering of a camera path, shared by workers through a job directory"));
+  parser.addHelpOption();
+  parser.addPositionalArgument(
+      QStringLiteral("command"), QStringLiteral("create, work, requeue or status."));
+  parser.addPositionalArgument(QStringLiteral("dir"), QStringLiteral("Job directory."));
+  const QCommandLineOption threads(
+      QStringLiteral("threads"),
+      QStringLiteral("work: threads of the reference tracer, 0 for all."),
+      QStringLiteral("n"), QStringLiteral("0"));
+  const QCommandLineOption id(
+      QStringLiteral("id"),
+      QStringLiteral("work: name of the worker, host name and pid by default."),
+      QStringLiteral("name"));
+  parser.addOptions({threads, id});
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  const QString command = args.value(0);
+  if (command == QLatin1String("create"))
+    return create(args);
+  if (command == QLatin1String("work"))
+    return work(args, parser.value(threads).toInt(), parser.value(id));
+  if (command == QLatin1String("requeue"))
+    return requeue(args);
+  if (command == QLatin1String("status"))
+    return status(args);
+
+  std::fputs(qPrintable(parser.helpText()), stderr);
+  return usageError;
+}
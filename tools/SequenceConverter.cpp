@@ -0,0 +1,109 @@
+// Converts a folder of PLY frames into a point cloud sequence file, for the
+// "Point cloud sequence" input of the node.
+//
+//   vkfrt_sequence <frames dir> <output file> [--fps <fps>]
+//
+// The frames are the .ply files of the folder sorted by name, so numbers
+// must be zero-padded. Each one goes through PointCloudIngest, as the
+// meshes of the node do, so that its points are filtered and Morton
+// ordered before PointCloudSequenceWriter stores it.
+#include <fulldome_voxel/PointCloudIngest.hpp>
+#include <fulldome_voxel/PointCloudSequence.hpp>
+#include <fulldome_voxel/reference/PlyCloud.hpp>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace
+{
+struct Frame
+{
+  std::vector<QVector4D> positions;
+  std::vector<QVector4D> colors;
+};
+
+// blocks until the submission is ingested
+std::shared_ptr<const vkfrt::PointCloud> ingest(
+    vkfrt::PointCloudIngest& ingest, const void* source, int64_t revision,
+    std::shared_ptr<const Frame> frame)
+{
+  vkfrt::PointCloudIngest::Points points;
+  points.count = frame->positions.size();
+  points.positions = reinterpret_cast<const char*>(frame->positions.data());
+  points.positionStride = sizeof(QVector4D);
+  if (!frame->colors.empty())
+  {
+    points.colors = reinterpret_cast<const char*>(frame->colors.data());
+    points.colorStride = sizeof(QVector4D);
+  }
+  points.owner = std::move(frame);
+  ingest.submit(source, revision, std::move(points));
+
+  while (ingest.busy())
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return ingest.latest();
+}
+}
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      QStringLiteral("Converts a folder of PLY frames into a point cloud sequence"));
+  parser.addHelpOption();
+  parser.addPositionalArgument(QStringLiteral("frames"), QStringLiteral("Folder of .ply frames."));
+  parser.addPositionalArgument(QStringLiteral("output"), QStringLiteral("Sequence file."));
+  const QCommandLineOption fps(
+      QStringLiteral("fps"), QStringLiteral("Playback rate of the frames."),
+      QStringLiteral("fps"), QStringLiteral("30"));
+  parser.addOption(fps);
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  const float rate = parser.value(fps).toFloat();
+  if (args.size() != 2 || !(rate > 0.f))
+  {
+    std::fputs(qPrintable(parser.helpText()), stderr);
+    return 2;
+  }
+
+  const QDir dir(args[0]);
+  const QStringList files
+      = dir.entryList({QStringLiteral("*.ply")}, QDir::Files, QDir::Name);
+  if (files.isEmpty())
+  {
+    std::fprintf(stderr, "no .ply frames in %s\n", qPrintable(args[0]));
+    return 1;
+  }
+
+  vkfrt::PointCloudSequenceWriter writer;
+  if (!writer.open(args[1], rate))
+    return 1;
+
+  vkfrt::PointCloudIngest ingester;
+  for (int i = 0; i < files.size(); ++i)
+  {
+    auto frame = std::make_shared<Frame>();
+    if (!vkfrt::readPlyCloud(dir.filePath(files[i]), frame->positions, frame->colors))
+      return 1;
+
+    const auto cloud = ingest(ingester, &writer, i, std::move(frame));
+    if (!cloud || cloud->revision != i || !writer.append(*cloud))
+    {
+      std::fprintf(stderr, "cannot convert %s\n", qPrintable(files[i]));
+      return 1;
+    }
+    std::printf(
+        "%d / %d %s: %zu points\n", i + 1, int(files.size()), qPrintable(files[i]),
+        cloud->positions.size());
+  }
+
+  return writer.finish() ? 0 : 1;
+}